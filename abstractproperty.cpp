@@ -10,11 +10,11 @@ namespace tdk {
 namespace ent {
 
 // Protected ctor
-AbstractProperty::AbstractProperty(const char* name, Entity* owner) : name_(name)
+AbstractProperty::AbstractProperty(const char* name, Entity* owner, PrimitiveKind kind) : name_(name), dirty_(false)
 {
 	if ( !owner )	return;
 	
-	owner->addProperty(this);
+	owner->addProperty(this, kind);
 }
 
 }	// End namespace ent
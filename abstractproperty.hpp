@@ -5,7 +5,8 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
-#include <deque>
+#include <stddef.h>
+#include <stdint.h>
  
 #include "propertyvisitor.hpp"
 
@@ -14,6 +15,13 @@ namespace ent {
 
 class Entity;
 
+/*! Bit mask of an entity's properties, where bit i is set for the property at
+ * index i of Entity::properties(). This limits entities to MAX_PROPERTIES
+ * properties.
+ */
+typedef uint64_t PropertyMask;
+static const size_t MAX_PROPERTIES = 64;
+
 /*! The abstract property base class provides the interface required for
  * the templated property class.
  *
@@ -40,6 +48,15 @@ public:
 	 */
 	virtual bool acceptReader(ReadVisitor&) = 0;
 	virtual void acceptWriter(WriteVisitor&) = 0;
+
+	/*! Whether or not the value has been set since the owning entity was last
+	 * saved, loaded or flushed. Values assigned by a WriteVisitor do not count
+	 * as being set, as they come from persistent storage.
+	 */
+	bool dirty() const { return dirty_; }
+
+	/*! Mark the value as matching persistent storage. */
+	void clearDirty() { dirty_ = false; }
 	
 protected:
 	/*! Construct a property with the given name.
@@ -48,8 +65,10 @@ protected:
 	 *			recommended.
 	 * \param	owner	Entity that this property belongs to. This property will
 	 *			be added to the Entity's list of properties.
+	 * \param	kind	Kind of primitive the property is visited as. This is
+	 *			recorded in the schema of the owner's entity type.
 	 */
-	AbstractProperty(const char* name, Entity* owner);
+	AbstractProperty(const char* name, Entity* owner, PrimitiveKind kind);
 	
 	/*! Construct a property with the given name, that has no owner.
 	 * 
@@ -58,10 +77,16 @@ protected:
 	 * Un-owned properties are used for loading and updating entities, where
 	 * all the properies of the entity to be updated / loaded are not known.
 	 */
-	AbstractProperty(const char* name) : name_(name) {}
+	AbstractProperty(const char* name) : name_(name), dirty_(false) {}
+
+	/*! Record that the value has been set. To be called by the setters of
+	 * implementing classes.
+	 */
+	void markDirty() { dirty_ = true; }
 	
 private:
 	const char* name_;
+	bool dirty_;
 };
 
 /*! Abstract property collection object. This is required for the persistence
@@ -72,11 +97,31 @@ private:
  */
 struct AbstractPropertyCollection 
 {
-	const std::deque<AbstractProperty*>& props() const { return props_; }
+	/*! Read only array of the properties in a collection, in the order they
+	 * were added. It is a view of the collection, so is cheap to copy, but is
+	 * invalidated when properties are added to the collection.
+	 */
+	class PropertyArray
+	{
+	public:
+		size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		AbstractProperty* operator [] (size_t i) const { return props_[i]; }
+		AbstractProperty* const* begin() const { return props_; }
+		AbstractProperty* const* end() const { return props_ + size_; }
+	private:
+		PropertyArray(AbstractProperty* const* props, size_t size) : props_(props), size_(size) {}
+		AbstractProperty* const* props_;
+		size_t size_;
+		friend struct AbstractPropertyCollection;
+	};
+
+	PropertyArray props() const { return PropertyArray(props_, size_); }
 
 protected:
-	std::deque<AbstractProperty*> props_;
-	AbstractPropertyCollection() {}
+	AbstractProperty** props_;
+	size_t size_;
+	AbstractPropertyCollection() : props_(NULL), size_(0) {}
 };
 
 }	// End namespace ent
@@ -0,0 +1,53 @@
+#ifndef ASYNC_ENTITY_FACTORY_HPP
+#define ASYNC_ENTITY_FACTORY_HPP
+/*! \file	asyncentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "asyncpersistenceapi.hpp"
+#include "entityfactory.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that writes behind the persistence of another factory. The
+ * entities it creates have an AsyncPersistenceApi installed, wrapping the
+ * persistence of the other factory, which must not be used directly for as
+ * long as this factory exists.
+ *
+ * ~~~{.cpp}
+ * Sqlite3EntityFactory sqlite("app.db");
+ * AsyncEntityFactory factory(sqlite);
+ * Person* person = factory.create<Person>();
+ * ...
+ * std::future<bool> saved = factory.persistence().saveAsync(*person);
+ * ~~~
+ *
+ * \see	AsyncPersistenceApi
+ */
+class AsyncEntityFactory : public EntityFactory
+{
+public:
+	/*! Create a factory writing behind another.
+	 * \param	inner		Factory whose persistence to write to. It must outlive
+	 *			this factory.
+	 * \param	maxBatch	Most changes to write in a single transaction.
+	 */
+	explicit AsyncEntityFactory(EntityFactory& inner,
+			size_t maxBatch = AsyncPersistenceApi::DEFAULT_MAX_BATCH)
+		: persistence_(persistenceApiOf(inner), maxBatch) {}
+
+	/*! Get the persistence installed in to entities, to queue changes on. */
+	AsyncPersistenceApi& persistence() { return persistence_; }
+
+private:
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(&persistence_); }
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
+	AsyncPersistenceApi persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,365 @@
+/*! \file	asyncpersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <vector>
+
+#include "asyncpersistenceapi.hpp"
+#include "entity.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+const size_t AsyncPersistenceApi::DEFAULT_MAX_BATCH;
+
+/*! Cursor that keeps the target locked, so the writer can not use it, for as
+ * long as the cursor is open.
+ */
+class AsyncPersistenceApi::LockedCursor : public PersistenceCursor
+{
+public:
+	LockedCursor(PersistenceCursor* cursor, unique_lock<mutex>&& lock)
+		: cursor_(cursor), lock_(std::move(lock)) {}
+
+	virtual bool step() throw(Entception&) { return cursor_->step(); }
+	virtual void read(Entity& ent) throw(Entception&) { cursor_->read(ent); }
+
+	virtual ~LockedCursor() { delete cursor_; }
+
+private:
+	PersistenceCursor* cursor_;
+	unique_lock<mutex> lock_;
+};
+
+// The queue is the intrusive MPSC queue by Dmitry Vyukov. Producers swap
+// themselves in as the head and then link the old head to themselves, so a
+// push is a single exchange. The stub node keeps the queue from ever being
+// empty, so the consumer never has to race a producer for the last node.
+AsyncPersistenceApi::ChangeQueue::ChangeQueue()
+	: head_(&stub_), tail_(&stub_)
+{
+	stub_.next.store(NULL, memory_order_relaxed);
+}
+
+void AsyncPersistenceApi::ChangeQueue::push(Node* n)
+{
+	n->next.store(NULL, memory_order_relaxed);
+	Node* prev = head_.exchange(n, memory_order_acq_rel);
+	prev->next.store(n, memory_order_release);
+}
+
+AsyncPersistenceApi::Change* AsyncPersistenceApi::ChangeQueue::pop()
+{
+	Node* tail = tail_;
+	Node* next = tail->next.load(memory_order_acquire);
+
+	if ( tail == &stub_ ) {
+		if ( !next )	return NULL;
+		tail_ = next;
+		tail = next;
+		next = next->next.load(memory_order_acquire);
+	}
+
+	if ( next ) {
+		tail_ = next;
+		return static_cast<Change*>(tail);
+	}
+
+	// The tail is the last node, unless a producer has swapped in a new head
+	// but not linked to it yet.
+	if ( tail != head_.load(memory_order_acquire) )	return NULL;
+
+	// Put the stub back behind the last node so it can be taken.
+	push(&stub_);
+	next = tail->next.load(memory_order_acquire);
+	if ( next ) {
+		tail_ = next;
+		return static_cast<Change*>(tail);
+	}
+	return NULL;
+}
+
+AsyncPersistenceApi::AsyncPersistenceApi(PersistenceApi& target, size_t maxBatch)
+	: target_(target), maxBatch_(maxBatch > 0 ? maxBatch : 1), queued_(0), sleeping_(false),
+	stop_(false), completed_(0)
+{
+	writer_ = thread(&AsyncPersistenceApi::run, this);
+}
+
+AsyncPersistenceApi::~AsyncPersistenceApi()
+{
+	{
+		lock_guard<mutex> lock(wakeMutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	writer_.join();
+}
+
+AsyncPersistenceApi::Change* AsyncPersistenceApi::newChange(Operation op, const Entity& ent,
+		const AbstractPropertyCollection* updates, PropertyMask dirty)
+{
+	Change* c = new Change;
+	c->op = op;
+	c->ent = &ent;
+	c->updates = updates;
+	c->dirty = dirty;
+	c->written = false;
+	return c;
+}
+
+void AsyncPersistenceApi::enqueue(Change* c)
+{
+	// Counted first, so the writer never sleeps with a change on its way in.
+	queued_.fetch_add(1);
+	queue_.push(c);
+
+	if ( sleeping_.load() ) {
+		lock_guard<mutex> lock(wakeMutex_);
+		wake_.notify_one();
+	}
+}
+
+future<bool> AsyncPersistenceApi::enqueueForResult(Change* c)
+{
+	future<bool> result = c->result.get_future();
+	enqueue(c);
+	return result;
+}
+
+future<bool> AsyncPersistenceApi::saveAsync(const Entity& ent)
+{
+	return enqueueForResult(newChange(SAVE, ent, NULL, 0));
+}
+
+void AsyncPersistenceApi::saveAsync(const Entity& ent, Callback done)
+{
+	Change* c = newChange(SAVE, ent, NULL, 0);
+	c->done = std::move(done);
+	enqueue(c);
+}
+
+future<bool> AsyncPersistenceApi::updateAsync(const Entity& ent, const AbstractPropertyCollection& updates)
+{
+	return enqueueForResult(newChange(UPDATE, ent, &updates, 0));
+}
+
+void AsyncPersistenceApi::updateAsync(const Entity& ent, const AbstractPropertyCollection& updates, Callback done)
+{
+	Change* c = newChange(UPDATE, ent, &updates, 0);
+	c->done = std::move(done);
+	enqueue(c);
+}
+
+future<bool> AsyncPersistenceApi::flushAsync(const Entity& ent, PropertyMask dirty)
+{
+	return enqueueForResult(newChange(FLUSH, ent, NULL, dirty));
+}
+
+void AsyncPersistenceApi::flushAsync(const Entity& ent, PropertyMask dirty, Callback done)
+{
+	Change* c = newChange(FLUSH, ent, NULL, dirty);
+	c->done = std::move(done);
+	enqueue(c);
+}
+
+future<bool> AsyncPersistenceApi::delAsync(const Entity& ent)
+{
+	return enqueueForResult(newChange(DEL, ent, NULL, 0));
+}
+
+void AsyncPersistenceApi::delAsync(const Entity& ent, Callback done)
+{
+	Change* c = newChange(DEL, ent, NULL, 0);
+	c->done = std::move(done);
+	enqueue(c);
+}
+
+void AsyncPersistenceApi::drain()
+{
+	// Changes complete in the order they were pushed, and each is counted
+	// before it is pushed, so once this many have completed, so has every
+	// change pushed before now.
+	size_t queued = queued_.load();
+
+	unique_lock<mutex> lock(doneMutex_);
+	done_.wait(lock, [this, queued] { return completed_ >= queued; });
+}
+
+bool AsyncPersistenceApi::save(const Entity& ent) throw(Entception&)
+{
+	return saveAsync(ent).get();
+}
+
+bool AsyncPersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	vector< future<bool> > results;
+	results.reserve(count);
+	for ( size_t i = 0; i < count; ++i ) {
+		results.push_back(saveAsync(*ents[i]));
+	}
+
+	// Wait for every save, as the entities must outlive them, before
+	// throwing the first error.
+	bool saved = true;
+	exception_ptr error;
+	for ( size_t i = 0; i < count; ++i ) {
+		try {
+			saved = results[i].get() && saved;
+		} catch (Entception& e) {
+			if ( !error )	error = current_exception();
+			saved = false;
+		}
+	}
+
+	if ( error )	rethrow_exception(error);
+	return saved;
+}
+
+bool AsyncPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	return updateAsync(ent, updates).get();
+}
+
+bool AsyncPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	return flushAsync(ent, dirty).get();
+}
+
+bool AsyncPersistenceApi::del(const Entity& ent) throw(Entception&)
+{
+	return delAsync(ent).get();
+}
+
+bool AsyncPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	drain();
+	lock_guard<mutex> lock(targetMutex_);
+	return target_.load(ent, criteria);
+}
+
+PersistenceCursor* AsyncPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	drain();
+	unique_lock<mutex> lock(targetMutex_);
+	PersistenceCursor* cursor = target_.openCursor(shape, criteria);
+	return new LockedCursor(cursor, std::move(lock));
+}
+
+void AsyncPersistenceApi::run()
+{
+	vector<Change*> batch;
+	batch.reserve(maxBatch_);
+	size_t taken = 0;
+
+	for ( ;; ) {
+		while ( batch.size() < maxBatch_ ) {
+			Change* c = queue_.pop();
+			if ( !c )	break;
+			batch.push_back(c);
+		}
+
+		if ( !batch.empty() ) {
+			taken += batch.size();
+			writeBatch(&batch[0], batch.size());
+			for ( size_t i = 0; i < batch.size(); ++i ) {
+				complete(batch[i]);
+			}
+
+			{
+				lock_guard<mutex> lock(doneMutex_);
+				completed_ += batch.size();
+			}
+			done_.notify_all();
+			batch.clear();
+			continue;
+		}
+
+		// A change has been counted, but not linked in to the queue yet.
+		if ( queued_.load() != taken ) {
+			this_thread::yield();
+			continue;
+		}
+
+		unique_lock<mutex> lock(wakeMutex_);
+		sleeping_.store(true);
+		wake_.wait(lock, [this, taken] { return stop_ || queued_.load() != taken; });
+		sleeping_.store(false);
+		if ( stop_ && queued_.load() == taken )	return;
+	}
+}
+
+void AsyncPersistenceApi::writeBatch(Change* const* batch, size_t count)
+{
+	lock_guard<mutex> lock(targetMutex_);
+
+	// Targets without transactions throw, and so get their changes written one
+	// at a time, as do the changes of a batch that failed.
+	bool inTransaction = false;
+	try {
+		target_.beginTransaction();
+		inTransaction = true;
+	} catch (Entception&) {
+	}
+
+	if ( inTransaction ) {
+		try {
+			for ( size_t i = 0; i < count; ++i ) {
+				batch[i]->written = apply(*batch[i]);
+			}
+			target_.commitTransaction();
+			return;
+		} catch (Entception&) {
+			try {
+				target_.rollbackTransaction();
+			} catch (Entception&) {
+			}
+		}
+	}
+
+	for ( size_t i = 0; i < count; ++i ) {
+		try {
+			batch[i]->written = apply(*batch[i]);
+		} catch (Entception&) {
+			batch[i]->written = false;
+			batch[i]->error = current_exception();
+		}
+	}
+}
+
+bool AsyncPersistenceApi::apply(const Change& c) throw(Entception&)
+{
+	switch ( c.op ) {
+		case SAVE:		return target_.save(*c.ent);
+		case UPDATE:	return target_.update(*c.ent, *c.updates);
+		case FLUSH:		return target_.flush(*c.ent, c.dirty);
+		case DEL:		return target_.del(*c.ent);
+	}
+	return false;
+}
+
+void AsyncPersistenceApi::complete(Change* c)
+{
+	if ( c->done ) {
+		if ( c->error ) {
+			try {
+				rethrow_exception(c->error);
+			} catch (Entception& e) {
+				c->done(false, &e);
+			}
+		} else {
+			c->done(c->written, NULL);
+		}
+	} else if ( c->error ) {
+		c->result.set_exception(c->error);
+	} else {
+		c->result.set_value(c->written);
+	}
+	delete c;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
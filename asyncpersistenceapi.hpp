@@ -0,0 +1,194 @@
+#ifndef ASYNC_PERSISTENCE_API_HPP
+#define ASYNC_PERSISTENCE_API_HPP
+/*! \file	asyncpersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "persistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Persistence that writes behind another persistence on a background thread.
+ *
+ * Saves, updates, flushes and deletes are put on a queue and return at once
+ * with a future, or a callback to call, for the result. A single writer thread
+ * takes everything that has been queued, up to the batch size, and writes it
+ * in one transaction of the wrapped persistence. The cost of syncing to disk is
+ * then paid once per batch, and never by the thread that queued the change.
+ *
+ * ~~~{.cpp}
+ * AsyncPersistenceApi async(persistence);
+ * person->setPersistence(&async);
+ * std::future<bool> saved = async.saveAsync(*person);
+ * ...
+ * if ( !saved.get() ) ...
+ * ~~~
+ *
+ * As with Transaction, queued entities are not copied. Each entity, and any
+ * collection of updates, must stay valid and unchanged until its change has
+ * completed.
+ *
+ * The methods of PersistenceApi are also queued, but wait for their change
+ * to complete, so they can be used by entities in the normal way. When several
+ * threads write at once, their changes still share transactions. Loads and
+ * cursors first wait for every change queued before them to complete, so they
+ * see them. The wrapped persistence is only used by one thread at a time, so it
+ * need not be thread safe, but it must not be used other than through this
+ * persistence while it is wrapped.
+ *
+ * Transactions are not supported, as changes are already grouped in to
+ * transactions by the writer.
+ */
+class AsyncPersistenceApi : public PersistenceApi
+{
+public:
+	/*! Called on the writer thread once a change has completed.
+	 * \param	result	What the wrapped persistence returned for the change.
+	 * \param	error	The exception the change failed with, or NULL if it did
+	 *			not throw.
+	 *
+	 * Callbacks must not throw, and must not use the blocking methods of the
+	 * persistence that called them, which would wait on the writer forever.
+	 */
+	typedef std::function<void (bool result, const Entception* error)> Callback;
+
+	/*! Start the writer thread.
+	 * \param	target		Persistence to write to. It must outlive this one.
+	 * \param	maxBatch	Most changes to write in a single transaction.
+	 */
+	explicit AsyncPersistenceApi(PersistenceApi& target, size_t maxBatch = DEFAULT_MAX_BATCH);
+
+	/*! Complete every queued change, then stop the writer thread. */
+	virtual ~AsyncPersistenceApi();
+
+	/*! Queue an entity to be saved. Unlike Entity::save, the entity's
+	 * properties are not marked as saved once it has been.
+	 * \return	Future for the result of the save. Getting it throws the
+	 *			Entception the save failed with, if any.
+	 */
+	std::future<bool> saveAsync(const Entity& ent);
+	void saveAsync(const Entity& ent, Callback done);
+
+	/*! Queue an entity to be updated with a collection of properties. */
+	std::future<bool> updateAsync(const Entity& ent, const AbstractPropertyCollection& updates);
+	void updateAsync(const Entity& ent, const AbstractPropertyCollection& updates, Callback done);
+
+	/*! Queue the modified properties of an entity to be written. */
+	std::future<bool> flushAsync(const Entity& ent, PropertyMask dirty);
+	void flushAsync(const Entity& ent, PropertyMask dirty, Callback done);
+
+	/*! Queue an entity to be deleted. */
+	std::future<bool> delAsync(const Entity& ent);
+	void delAsync(const Entity& ent, Callback done);
+
+	/*! Wait for every change queued so far to complete. */
+	void drain();
+
+	virtual bool save(const Entity& ent) throw(Entception&);
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool del(const Entity& ent) throw(Entception&);
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	/*! Open a cursor on the wrapped persistence. Changes queued while the
+	 * cursor is open are not written until it is deleted, so the thread with
+	 * the cursor must not wait on any of them.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	static const size_t DEFAULT_MAX_BATCH = 256;
+
+private:
+	typedef enum {
+		SAVE,
+		UPDATE,
+		FLUSH,
+		DEL,
+	} Operation;
+
+	struct Node {
+		std::atomic<Node*> next;
+	};
+
+	/*! A queued change. Once written, its result goes to the callback if
+	 * there is one, or else to the promise.
+	 */
+	struct Change : public Node {
+		Operation op;
+		const Entity* ent;
+		const AbstractPropertyCollection* updates;
+		PropertyMask dirty;
+		Callback done;
+		std::promise<bool> result;
+		bool written;
+		std::exception_ptr error;
+	};
+
+	/*! Intrusive queue that any number of threads can push on to without
+	 * locking, and one thread can pop from.
+	 */
+	class ChangeQueue
+	{
+	public:
+		ChangeQueue();
+		void push(Node* n);
+
+		/*! Take the oldest change off the queue.
+		 * \retval	NULL	The queue is empty, or the change being pushed
+		 *			after the last one is not linked in yet.
+		 */
+		Change* pop();
+
+	private:
+		std::atomic<Node*> head_;	// Newest node, pushed on to by producers.
+		Node* tail_;				// Oldest node, popped by the consumer.
+		Node stub_;
+	};
+
+	class LockedCursor;
+
+	Change* newChange(Operation op, const Entity& ent, const AbstractPropertyCollection* updates, PropertyMask dirty);
+	void enqueue(Change* c);
+	std::future<bool> enqueueForResult(Change* c);
+
+	void run();
+	void writeBatch(Change* const* batch, size_t count);
+	bool apply(const Change& c) throw(Entception&);
+	void complete(Change* c);
+
+	AsyncPersistenceApi(const AsyncPersistenceApi&);
+	AsyncPersistenceApi& operator = (const AsyncPersistenceApi&);
+
+	PersistenceApi& target_;
+	const size_t maxBatch_;
+
+	ChangeQueue queue_;
+	std::atomic<size_t> queued_;	// Changes counted before being pushed.
+	std::atomic<bool> sleeping_;	// The writer is waiting for changes.
+	bool stop_;
+	std::mutex wakeMutex_;
+	std::condition_variable wake_;
+
+	size_t completed_;	// Changes completed, guarded by doneMutex_.
+	std::mutex doneMutex_;
+	std::condition_variable done_;
+
+	std::mutex targetMutex_;	// Held while the target is in use.
+	std::thread writer_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,728 @@
+/** \file	entbench.cpp
+ *
+ * Microbenchmarks for the core of the entities library and the SQLite3,
+ * in-memory and log file persistences.
+ *
+ * Results are written to stdout as CSV, one line per benchmark, so runs can be
+ * compared by script to catch regressions:
+ *
+ *     benchmark,rows,columns,iterations,total_ns,ns_per_op
+ *
+ * Usage: entbench [database file] [max rows]
+ *
+ * The database file defaults to entbench.db in the current directory and is
+ * recreated on every run. The SQLite benchmarks are run at 1000 rows and every
+ * tenfold step up to max rows, which defaults to 100000.
+ *
+ * The save_all results are not comparable with the save results, and should
+ * not be read as batching costing more per row. Saves are timed inside a
+ * transaction that is already open, and its commit is not timed. A batch
+ * begins and commits its own transaction, so its time includes the commit
+ * and its sync to disk. It is also the first phase to run, so it includes
+ * preparing the insert statement. Batching is the cheaper way to save rows
+ * outside a transaction; compare save_all with sqlite_save_autocommit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include <sqlite3.h>
+
+#include "asyncentityfactory.hpp"
+#include "cachingentityfactory.hpp"
+#include "entity.hpp"
+#include "entitycodec.hpp"
+#include "entityfields.hpp"
+#include "entitypool.hpp"
+#include "entitytable.hpp"
+#include "property.hpp"
+#include "transaction.hpp"
+
+#include "factories/logentityfactory.hpp"
+#include "factories/memoryentityfactory.hpp"
+#include "factories/sqlite3entityfactory.hpp"
+#include "factories/sqlite3pooledentityfactory.hpp"
+#include "factories/sqlite3shardedentityfactory.hpp"
+
+using namespace std;
+using namespace tdk::ent;
+
+/** Entity with a handful of columns, keyed on id. */
+struct Narrow : public Entity
+{
+	Property<int>		id;
+	Property<string>	name;
+	Property<int>		age;
+	Property<double>	score;
+
+	Narrow() : Entity("narrow"),
+		id("id", this, 0),
+		name("name", this),
+		age("age", this, 0),
+		score("score", this, 0)
+	{
+		setPrimaryKey(id);
+	}
+
+	static const int COLUMNS = 4;
+	static const char* createSql() {
+		return "CREATE TABLE narrow(id INTEGER PRIMARY KEY, name TEXT, age INT, score REAL);";
+	}
+};
+
+/** Entity with many columns, keyed on id. */
+struct Wide : public Entity
+{
+	Property<int>		id;
+	Property<string>	name;
+	Property<int>		age;
+	Property<double>	score;
+	Property<string>	s1, s2, s3, s4;
+	Property<int>		i1, i2, i3, i4;
+	Property<double>	d1, d2, d3, d4;
+
+	Wide() : Entity("wide"),
+		id("id", this, 0), name("name", this), age("age", this, 0), score("score", this, 0),
+		s1("s1", this), s2("s2", this), s3("s3", this), s4("s4", this),
+		i1("i1", this, 0), i2("i2", this, 0), i3("i3", this, 0), i4("i4", this, 0),
+		d1("d1", this, 0), d2("d2", this, 0), d3("d3", this, 0), d4("d4", this, 0)
+	{
+		setPrimaryKey(id);
+		s1.set("alpha"); s2.set("beta"); s3.set("gamma"); s4.set("delta");
+	}
+
+	static const int COLUMNS = 16;
+	static const char* createSql() {
+		return "CREATE TABLE wide(id INTEGER PRIMARY KEY, name TEXT, age INT, score REAL,"
+			" s1 TEXT, s2 TEXT, s3 TEXT, s4 TEXT, i1 INT, i2 INT, i3 INT, i4 INT,"
+			" d1 REAL, d2 REAL, d3 REAL, d4 REAL);";
+	}
+};
+
+namespace tdk {
+namespace ent {
+
+// Describe Wide, so it can be visited statically.
+template <>
+struct EntityFields<Wide>
+{
+	static const bool described = true;
+	template <typename W, typename F>
+	static void apply(W& w, F& f) {
+		f(w.id); f(w.name); f(w.age); f(w.score);
+		f(w.s1); f(w.s2); f(w.s3); f(w.s4);
+		f(w.i1); f(w.i2); f(w.i3); f(w.i4);
+		f(w.d1); f(w.d2); f(w.d3); f(w.d4);
+	}
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+/** Read visitor that does as little as possible, to measure dispatch. */
+struct NullReader : public ReadVisitor
+{
+	NullReader() : sum(0) {}
+	virtual bool visit(const bool& b) { sum += b; return true; }
+	virtual bool visit(const char& c) { sum += c; return true; }
+	virtual bool visit(const int& i) { sum += i; return true; }
+	virtual bool visit(const unsigned int& ui) { sum += ui; return true; }
+	virtual bool visit(const double& d) { sum += static_cast<long>(d); return true; }
+	virtual bool visit(const StringPrimitive& str) { sum += str.len(); return true; }
+	virtual bool visit(const int64_t& i) { sum += i; return true; }
+	virtual bool visit(const BlobPrimitive& blob) { sum += blob.len(); return true; }
+	long sum;
+};
+
+/** Write visitor that assigns fixed values, to measure dispatch. */
+struct ConstWriter : public WriteVisitor
+{
+	virtual void visit(bool& b) { b = true; }
+	virtual void visit(char& c) { c = 'c'; }
+	virtual void visit(int& i) { i = 42; }
+	virtual void visit(unsigned int& ui) { ui = 42; }
+	virtual void visit(double& d) { d = 4.2; }
+	virtual void visit(StringPrimitive& str) { str = StringPrimitive("value", 5); }
+	virtual void visit(int64_t& i) { i = 42; }
+	virtual void visit(BlobPrimitive& blob) { blob = BlobPrimitive("value", 5); }
+};
+
+/** Non-virtual equivalents of the visitors above, for static dispatch. */
+struct StaticNullReader
+{
+	StaticNullReader() : sum(0) {}
+	bool visit(const bool& b) { sum += b; return true; }
+	bool visit(const char& c) { sum += c; return true; }
+	bool visit(const int& i) { sum += i; return true; }
+	bool visit(const unsigned int& ui) { sum += ui; return true; }
+	bool visit(const double& d) { sum += static_cast<long>(d); return true; }
+	bool visit(const StringPrimitive& str) { sum += str.len(); return true; }
+	bool visit(const int64_t& i) { sum += i; return true; }
+	bool visit(const BlobPrimitive& blob) { sum += blob.len(); return true; }
+	long sum;
+};
+
+struct StaticConstWriter
+{
+	void visit(bool& b) { b = true; }
+	void visit(char& c) { c = 'c'; }
+	void visit(int& i) { i = 42; }
+	void visit(unsigned int& ui) { ui = 42; }
+	void visit(double& d) { d = 4.2; }
+	void visit(StringPrimitive& str) { str = StringPrimitive("value", 5); }
+	void visit(int64_t& i) { i = 42; }
+	void visit(BlobPrimitive& blob) { blob = BlobPrimitive("value", 5); }
+};
+
+// Stops the compiler optimising away results.
+volatile long sink;
+
+typedef chrono::steady_clock Clock;
+
+void report(const char* name, long rows, int columns, long iterations, Clock::time_point start)
+{
+	long long ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+	printf("%s,%ld,%d,%ld,%lld,%.2f\n", name, rows, columns, iterations, ns,
+		iterations ? static_cast<double>(ns) / iterations : 0.0);
+	fflush(stdout);
+}
+
+void benchCore()
+{
+	const long N = 10000000;
+	Narrow n;
+	n.name.set("benchmark");
+
+	// Go through a volatile pointer, or the reads are hoisted out of the loop
+	// and the sets collapsed in to one.
+	Narrow* volatile np = &n;
+	Clock::time_point start = Clock::now();
+	long sum = 0;
+	for ( long i = 0; i < N; ++i ) {
+		sum += np->age.val();
+	}
+	sink = sum;
+	report("property_get", 0, 1, N, start);
+
+	start = Clock::now();
+	for ( long i = 0; i < N; ++i ) {
+		np->age.set(i);
+	}
+	report("property_set_int", 0, 1, N, start);
+
+	start = Clock::now();
+	string s("some string value");
+	for ( long i = 0; i < N; ++i ) {
+		n.name.set(s);
+	}
+	report("property_set_string", 0, 1, N, start);
+
+	start = Clock::now();
+	for ( long i = 0; i < N; ++i ) {
+		sum += n["score"] != NULL;
+	}
+	sink = sum;
+	report("entity_lookup_by_name", 0, Narrow::COLUMNS, N, start);
+
+	Wide w;
+	start = Clock::now();
+	for ( long i = 0; i < N; ++i ) {
+		sum += w["d4"] != NULL;
+	}
+	sink = sum;
+	report("entity_lookup_by_name", 0, Wide::COLUMNS, N, start);
+
+	NullReader reader;
+	start = Clock::now();
+	for ( long i = 0; i < N / Wide::COLUMNS; ++i ) {
+		Entity::PropertyList props = w.properties();
+		for ( size_t j = 0; j < props.size(); ++j ) {
+			props[j]->acceptReader(reader);
+		}
+	}
+	sink = reader.sum;
+	report("read_visitor_dispatch", 0, Wide::COLUMNS, N / Wide::COLUMNS * Wide::COLUMNS, start);
+
+	ConstWriter writer;
+	start = Clock::now();
+	for ( long i = 0; i < N / Wide::COLUMNS; ++i ) {
+		Entity::PropertyList props = w.properties();
+		for ( size_t j = 0; j < props.size(); ++j ) {
+			props[j]->acceptWriter(writer);
+		}
+	}
+	sink = w.age.val();
+	report("write_visitor_dispatch", 0, Wide::COLUMNS, N / Wide::COLUMNS * Wide::COLUMNS, start);
+
+	StaticNullReader staticReader;
+	start = Clock::now();
+	for ( long i = 0; i < N / Wide::COLUMNS; ++i ) {
+		forEachProperty(w, staticReader);
+	}
+	sink = staticReader.sum;
+	report("static_read_dispatch", 0, Wide::COLUMNS, N / Wide::COLUMNS * Wide::COLUMNS, start);
+
+	StaticConstWriter staticWriter;
+	start = Clock::now();
+	for ( long i = 0; i < N / Wide::COLUMNS; ++i ) {
+		forEachPropertyWrite(w, staticWriter);
+	}
+	sink = w.age.val();
+	report("static_write_dispatch", 0, Wide::COLUMNS, N / Wide::COLUMNS * Wide::COLUMNS, start);
+
+	const long M = N / 10;
+	string encoded;
+	start = Clock::now();
+	for ( long i = 0; i < M; ++i ) {
+		encoded.clear();
+		EntityCodec::encode(w, encoded);
+	}
+	report("codec_encode", 0, Wide::COLUMNS, M, start);
+
+	Wide decoded;
+	start = Clock::now();
+	for ( long i = 0; i < M; ++i ) {
+		EntityCodec::decode(decoded, encoded.data(), encoded.size());
+	}
+	sink = decoded.age.val();
+	report("codec_decode", 0, Wide::COLUMNS, M, start);
+
+	start = Clock::now();
+	for ( long i = 0; i < M; ++i ) {
+		PropertyCollection criteria;
+		criteria.add(n.age, 30);
+		criteria.add(n.name, s);
+		criteria.add(n.score, 1.5);
+		sum += criteria.props().size();
+	}
+	sink = sum;
+	report("property_collection_build", 0, 3, M, start);
+
+	start = Clock::now();
+	for ( long i = 0; i < M; ++i ) {
+		Narrow* tmp = new Narrow;
+		sum += tmp->age.val();
+		delete tmp;
+	}
+	sink = sum;
+	report("entity_construct", 0, Narrow::COLUMNS, M, start);
+
+	EntityPool<Narrow> pool;
+	start = Clock::now();
+	for ( long i = 0; i < M; ++i ) {
+		Narrow* tmp = pool.construct();
+		sum += tmp->age.val();
+		pool.destroy(tmp);
+	}
+	sink = sum;
+	report("entity_construct_pooled", 0, Narrow::COLUMNS, M, start);
+}
+
+void removeDb(const char* dbFile)
+{
+	string f(dbFile);
+	remove(f.c_str());
+	remove((f + "-wal").c_str());
+	remove((f + "-shm").c_str());
+}
+
+void createTables(const char* dbFile)
+{
+	removeDb(dbFile);
+
+	sqlite3* db = NULL;
+	if ( sqlite3_open(dbFile, &db) != SQLITE_OK ) {
+		fprintf(stderr, "Could not create %s\n", dbFile);
+		exit(1);
+	}
+	sqlite3_exec(db, Narrow::createSql(), NULL, NULL, NULL);
+	sqlite3_exec(db, Wide::createSql(), NULL, NULL, NULL);
+	sqlite3_close(db);
+}
+
+/** Write a benchmark's result, named for the persistence it ran against. */
+void report(const char* backend, const char* name, long rows, int columns, long iterations, Clock::time_point start)
+{
+	string full = string(backend) + "_" + name;
+	report(full.c_str(), rows, columns, iterations, start);
+}
+
+/** Run the persistence benchmarks for one entity type and row count. Each
+ * phase other than the batch save runs inside one transaction, so the results
+ * measure the per row cost rather than the disk syncs. The batch save commits
+ * its own transaction, which is timed with it.
+ */
+template <typename Ent>
+void benchPersistence(EntityFactory& factory, const char* backend, long rows)
+{
+	vector<Ent*> ents;
+	for ( long i = 0; i < rows; ++i ) {
+		Ent* e = factory.template create<Ent>();
+		e->id.set(i);
+		e->name.set("name");
+		e->age.set(i % 100);
+		e->score.set(i * 0.5);
+		ents.push_back(e);
+	}
+
+	Clock::time_point start = Clock::now();
+	factory.saveAll(ents.begin(), ents.end());
+	report(backend, "save_all", rows, Ent::COLUMNS, rows, start);
+
+	{
+		Transaction tx(factory);
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			ents[i]->id.set(rows + i);
+			ents[i]->save();
+		}
+		report(backend, "save", rows, Ent::COLUMNS, rows, start);
+		tx.commit();
+	}
+
+	Ent* loaded = factory.template create<Ent>();
+	{
+		Transaction tx(factory);
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			PropertyCollection criteria;
+			criteria.add(loaded->id, static_cast<int>(i));
+			loaded->load(criteria);
+		}
+		report(backend, "load_by_key", rows, Ent::COLUMNS, rows, start);
+		tx.commit();
+	}
+
+	{
+		start = Clock::now();
+		long n = 0;
+		Query<Ent> q = factory.template query<Ent>();
+		for ( typename Query<Ent>::iterator it = q.begin(); it != q.end(); ++it ) {
+			++n;
+		}
+		report(backend, "query_scan", rows, Ent::COLUMNS, n, start);
+	}
+
+	{
+		Transaction tx(factory);
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			PropertyCollection updates;
+			updates.add(ents[i]->age, 7);
+			ents[i]->update(updates);
+		}
+		report(backend, "update", rows, Ent::COLUMNS, rows, start);
+		tx.commit();
+	}
+
+	{
+		Transaction tx(factory);
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			ents[i]->score.set(i);
+			ents[i]->flush();
+		}
+		report(backend, "flush_one_column", rows, Ent::COLUMNS, rows, start);
+		tx.commit();
+	}
+
+	{
+		Transaction tx(factory);
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			ents[i]->del();
+		}
+		report(backend, "del", rows, Ent::COLUMNS, rows, start);
+		tx.commit();
+	}
+
+	delete loaded;
+	for ( size_t i = 0; i < ents.size(); ++i ) {
+		delete ents[i];
+	}
+}
+
+template <typename Ent>
+void benchSqlite(const char* dbFile, long rows)
+{
+	createTables(dbFile);
+	Sqlite3EntityFactory factory(dbFile);
+	benchPersistence<Ent>(factory, "sqlite", rows);
+}
+
+template <typename Ent>
+void benchMemory(long rows)
+{
+	MemoryEntityFactory factory;
+	benchPersistence<Ent>(factory, "memory", rows);
+}
+
+template <typename Ent>
+void benchLog(const char* dbFile, long rows)
+{
+	string logFile = string(dbFile) + ".log";
+	remove(logFile.c_str());
+	{
+		LogEntityFactory factory(logFile.c_str());
+		benchPersistence<Ent>(factory, "log", rows);
+	}
+	remove(logFile.c_str());
+}
+
+/** Filter and aggregate rows held as entity objects and as an EntityTable,
+ * and bulk load the table from a query.
+ */
+void benchTable(long rows)
+{
+	MemoryEntityFactory factory;
+	vector<Narrow*> ents;
+	{
+		Transaction t(factory);
+		for ( long i = 0; i < rows; ++i ) {
+			Narrow* n = factory.create<Narrow>();
+			n->id = static_cast<int>(i);
+			n->name = string("name");
+			n->age = static_cast<int>(i * 7919 % 100);
+			n->score = static_cast<double>(i % 1000) / 10;
+			n->save();
+			ents.push_back(n);
+		}
+		t.commit();
+	}
+
+	Clock::time_point start = Clock::now();
+	long count = 0;
+	for ( size_t i = 0; i < ents.size(); ++i ) {
+		count += ents[i]->age.val() >= 50 && ents[i]->score.val() < 25.0;
+	}
+	sink = count;
+	report("table", "entity_filter", rows, Narrow::COLUMNS, rows, start);
+
+	EntityTable<Narrow> table;
+	start = Clock::now();
+	Query<Narrow> q = factory.query<Narrow>();
+	table.load(q);
+	report("table", "table_load", rows, Narrow::COLUMNS, rows, start);
+
+	start = Clock::now();
+	RowMask mask = table.where("age", COMPARE_GE, 50);
+	mask &= table.where("score", COMPARE_LT, 25.0);
+	sink = mask.count();
+	report("table", "table_filter", rows, Narrow::COLUMNS, rows, start);
+
+	start = Clock::now();
+	sink = static_cast<long>(table.aggregate("score", &mask).sum);
+	report("table", "table_aggregate", rows, Narrow::COLUMNS, rows, start);
+
+	for ( size_t i = 0; i < ents.size(); ++i ) {
+		delete ents[i];
+	}
+}
+
+/** Load rows by key from several threads at once through a pooled factory,
+ * with one reader connection per thread.
+ */
+void benchPooledLoad(const char* dbFile, long rows, unsigned int threads)
+{
+	createTables(dbFile);
+	{
+		Sqlite3EntityFactory factory(dbFile);
+		vector<Narrow*> ents;
+		for ( long i = 0; i < rows; ++i ) {
+			Narrow* e = factory.create<Narrow>();
+			e->id.set(i);
+			e->name.set("name");
+			ents.push_back(e);
+		}
+		factory.saveAll(ents.begin(), ents.end());
+		for ( size_t i = 0; i < ents.size(); ++i ) {
+			delete ents[i];
+		}
+	}
+
+	Sqlite3PooledEntityFactory factory(dbFile, threads);
+	vector<thread> workers;
+	Clock::time_point start = Clock::now();
+	for ( unsigned int t = 0; t < threads; ++t ) {
+		workers.push_back(thread([&factory, rows, t] {
+			Narrow* e = factory.create<Narrow>();
+			for ( long i = 0; i < rows; ++i ) {
+				PropertyCollection criteria;
+				criteria.add(e->id, static_cast<int>((i + t) % rows));
+				e->load(criteria);
+			}
+			delete e;
+		}));
+	}
+	for ( size_t t = 0; t < workers.size(); ++t ) {
+		workers[t].join();
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "sqlite_pooled_load_by_key_%uthreads", threads);
+	report(name, rows, Narrow::COLUMNS, rows * threads, start);
+}
+
+/** Load rows by key through a cache in front of SQLite, once to fill the
+ * cache and again to be served from it.
+ */
+void benchCachedLoad(const char* dbFile, long rows)
+{
+	createTables(dbFile);
+	Sqlite3EntityFactory sqlite(dbFile);
+	{
+		vector<Narrow*> ents;
+		for ( long i = 0; i < rows; ++i ) {
+			Narrow* e = sqlite.create<Narrow>();
+			e->id.set(i);
+			e->name.set("name");
+			ents.push_back(e);
+		}
+		sqlite.saveAll(ents.begin(), ents.end());
+		for ( size_t i = 0; i < ents.size(); ++i ) {
+			delete ents[i];
+		}
+	}
+
+	CachingEntityFactory factory(sqlite);
+	Narrow* e = factory.create<Narrow>();
+	const char* names[] = { "sqlite_load_by_key_cache_miss", "sqlite_load_by_key_cache_hit" };
+	for ( int pass = 0; pass < 2; ++pass ) {
+		Clock::time_point start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			PropertyCollection criteria;
+			criteria.add(e->id, static_cast<int>(i));
+			e->load(criteria);
+		}
+		report(names[pass], rows, Narrow::COLUMNS, rows, start);
+	}
+	delete e;
+}
+
+/** Save rows one at a time, each in its own durable transaction, first
+ * directly and then written behind through an async factory. The async
+ * results are the time taken to queue the saves, and to write them all.
+ */
+void benchAsyncSave(const char* dbFile, long rows)
+{
+	createTables(dbFile);
+	Sqlite3EntityFactory factory(dbFile, Sqlite3Options::durable());
+
+	vector<Narrow*> ents;
+	for ( long i = 0; i < rows; ++i ) {
+		Narrow* e = factory.create<Narrow>();
+		e->id.set(i);
+		e->name.set("name");
+		ents.push_back(e);
+	}
+
+	Clock::time_point start = Clock::now();
+	for ( long i = 0; i < rows; ++i ) {
+		ents[i]->save();
+	}
+	report("sqlite_save_autocommit", rows, Narrow::COLUMNS, rows, start);
+
+	{
+		AsyncEntityFactory async(factory);
+		AsyncPersistenceApi& persistence = async.persistence();
+		start = Clock::now();
+		for ( long i = 0; i < rows; ++i ) {
+			ents[i]->id.set(rows + i);
+			persistence.saveAsync(*ents[i]);
+		}
+		report("sqlite_save_async_queue", rows, Narrow::COLUMNS, rows, start);
+		persistence.drain();
+		report("sqlite_save_async_written", rows, Narrow::COLUMNS, rows, start);
+	}
+
+	for ( size_t i = 0; i < ents.size(); ++i ) {
+		delete ents[i];
+	}
+}
+
+/** Save rows from several threads at once, each save its own transaction and
+ * so a sync to disk, through a sharded factory over one database file and then
+ * over several. The shard files are all created next to the database file, so
+ * their syncs queue for the same disk, and the results only differ by the
+ * locking. Sharding scales these saves when the files are on separate disks.
+ */
+void benchShardedSave(const char* dbFile, long rows, unsigned int threads)
+{
+	static const size_t SHARDS[] = {1, 4};
+	for ( size_t s = 0; s < sizeof(SHARDS) / sizeof(SHARDS[0]); ++s ) {
+		vector<string> files;
+		for ( size_t i = 0; i < SHARDS[s]; ++i ) {
+			char file[512];
+			snprintf(file, sizeof(file), "%s.shard%zu", dbFile, i);
+			createTables(file);
+			files.push_back(file);
+		}
+
+		{
+			Sqlite3ShardedEntityFactory factory(files);
+			vector<thread> workers;
+			Clock::time_point start = Clock::now();
+			for ( unsigned int t = 0; t < threads; ++t ) {
+				workers.push_back(thread([&factory, rows, threads, t] {
+					Narrow* e = factory.create<Narrow>();
+					e->name.set("name");
+					for ( long i = t; i < rows; i += threads ) {
+						e->id.set(static_cast<int>(i));
+						e->save();
+					}
+					delete e;
+				}));
+			}
+			for ( size_t t = 0; t < workers.size(); ++t ) {
+				workers[t].join();
+			}
+
+			char name[64];
+			snprintf(name, sizeof(name), "sqlite_sharded_save_%zushards_%uthreads", SHARDS[s], threads);
+			report(name, rows, Narrow::COLUMNS, rows, start);
+		}
+
+		for ( size_t i = 0; i < files.size(); ++i ) {
+			removeDb(files[i].c_str());
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* dbFile = argc > 1 ? argv[1] : "entbench.db";
+	long maxRows = argc > 2 ? atol(argv[2]) : 100000;
+
+	printf("benchmark,rows,columns,iterations,total_ns,ns_per_op\n");
+
+	try {
+		benchCore();
+
+		for ( long rows = 1000; rows <= maxRows; rows *= 10 ) {
+			benchSqlite<Narrow>(dbFile, rows);
+			benchSqlite<Wide>(dbFile, rows);
+			benchMemory<Narrow>(rows);
+			benchMemory<Wide>(rows);
+			benchLog<Narrow>(dbFile, rows);
+			benchLog<Wide>(dbFile, rows);
+			benchTable(rows);
+			benchPooledLoad(dbFile, rows, 1);
+			benchPooledLoad(dbFile, rows, 4);
+			benchCachedLoad(dbFile, rows);
+		}
+
+		// Every autocommit save is a sync to disk, so one row count will do.
+		benchAsyncSave(dbFile, 1000);
+		benchShardedSave(dbFile, 10000, 4);
+	} catch (Entception& e) {
+		fprintf(stderr, "Benchmark failed:\n");
+		e.print();
+		return 1;
+	}
+
+	removeDb(dbFile);
+	return 0;
+}
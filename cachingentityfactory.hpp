@@ -0,0 +1,55 @@
+#ifndef CACHING_ENTITY_FACTORY_HPP
+#define CACHING_ENTITY_FACTORY_HPP
+/*! \file	cachingentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "cachingpersistenceapi.hpp"
+#include "entityfactory.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that caches the rows its entities load by primary key from
+ * the persistence of another factory. The entities it creates have a
+ * CachingPersistenceApi installed, wrapping the persistence of the other
+ * factory, which should not be written to directly while this factory exists.
+ *
+ * ~~~{.cpp}
+ * Sqlite3PooledEntityFactory sqlite("app.db");
+ * CachingEntityFactory factory(sqlite, 32 << 20);
+ * Country* uk = factory.create<Country>();
+ * ...
+ * uk->load(criteria);	// Only the first load of the row queries SQLite.
+ * ~~~
+ *
+ * \see	CachingPersistenceApi
+ */
+class CachingEntityFactory : public EntityFactory
+{
+public:
+	/*! Create a factory caching the persistence of another.
+	 * \param	inner		Factory whose persistence to cache. It must outlive
+	 *			this factory.
+	 * \param	maxBytes	Budget for the memory used by cached rows.
+	 * \param	shards		Number of shards to split the cache in to.
+	 */
+	explicit CachingEntityFactory(EntityFactory& inner,
+			size_t maxBytes = CachingPersistenceApi::DEFAULT_MAX_BYTES,
+			unsigned int shards = CachingPersistenceApi::DEFAULT_SHARDS)
+		: persistence_(persistenceApiOf(inner), maxBytes, shards) {}
+
+	/*! Get the cache installed in to entities, for its counters. */
+	CachingPersistenceApi& persistence() { return persistence_; }
+
+private:
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(&persistence_); }
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
+	CachingPersistenceApi persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,246 @@
+/*! \file	cachingpersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "cachingpersistenceapi.hpp"
+#include "entity.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+const size_t CachingPersistenceApi::DEFAULT_MAX_BYTES;
+const unsigned int CachingPersistenceApi::DEFAULT_SHARDS;
+
+namespace {
+
+unsigned int roundUpToPowerOfTwo(unsigned int n)
+{
+	unsigned int p = 1;
+	while ( p < n )	p <<= 1;
+	return p;
+}
+
+}	// End anon namespace
+
+/*! Invalidates the cached row of an entity once a write to it is over,
+ * whether or not the write succeeded.
+ */
+class CachingPersistenceApi::Invalidation
+{
+public:
+	Invalidation(CachingPersistenceApi& cache, const Entity& ent) : cache_(cache), ent_(ent) {}
+	~Invalidation() { cache_.invalidate(ent_); }
+
+private:
+	CachingPersistenceApi& cache_;
+	const Entity& ent_;
+};
+
+CachingPersistenceApi::CachingPersistenceApi(PersistenceApi& target, size_t maxBytes, unsigned int shards)
+	: target_(target), shards_(roundUpToPowerOfTwo(shards)), transactions_(0)
+{
+	shardBytes_ = maxBytes / shards_.size();
+}
+
+bool CachingPersistenceApi::keyOf(const Entity& ent, const AbstractPropertyCollection& criteria, PrimitiveValue& key)
+{
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	if ( props.size() != 1 )	return false;
+
+	const EntitySchema& schema = ent.schema();
+	if ( schema.primaryKey() < 0 || schema.indexOf(props[0]->propertyName()) != schema.primaryKey() ) {
+		return false;
+	}
+
+	key = PrimitiveValue::of(*props[0]);
+	return true;
+}
+
+void CachingPersistenceApi::invalidate(const Entity& ent)
+{
+	AbstractProperty* pk = ent.primaryKey();
+	if ( !pk )	return;
+
+	Key k(&ent.schema(), PrimitiveValue::of(*pk));
+	Shard& s = shardFor(k);
+
+	lock_guard<mutex> lock(s.mutex);
+	// Loads that started before now may have read the old row, so must not
+	// cache it.
+	++s.generation;
+
+	auto it = s.index.find(k);
+	if ( it == s.index.end() )	return;
+	s.bytes -= it->second->bytes;
+	s.rows.erase(it->second);
+	s.index.erase(it);
+	++s.invalidations;
+}
+
+void CachingPersistenceApi::insert(Shard& s, const Key& k, const Entity& ent, uint64_t generation)
+{
+	// Copy the row before taking the lock.
+	Row row(k);
+	Entity::PropertyList props = ent.properties();
+	row.values.reserve(props.size());
+	row.bytes = sizeof(Row) + props.size() * sizeof(PrimitiveValue) + k.key.bytes().size();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		row.values.push_back(PrimitiveValue::of(*props[i]));
+		row.bytes += row.values.back().bytes().size();
+	}
+	if ( row.bytes > shardBytes_ )	return;
+
+	lock_guard<mutex> lock(s.mutex);
+	if ( s.generation != generation || s.index.count(k) )	return;
+
+	s.bytes += row.bytes;
+	s.rows.push_front(std::move(row));
+	s.index.insert(make_pair(k, s.rows.begin()));
+
+	while ( s.bytes > shardBytes_ ) {
+		const Row& lru = s.rows.back();
+		s.bytes -= lru.bytes;
+		s.index.erase(lru.key);
+		s.rows.pop_back();
+		++s.evictions;
+	}
+}
+
+bool CachingPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	PrimitiveValue keyValue;
+	if ( !keyOf(ent, criteria, keyValue) ) {
+		return target_.load(ent, criteria);
+	}
+
+	Key k(&ent.schema(), keyValue);
+	Shard& s = shardFor(k);
+	uint64_t generation;
+	{
+		lock_guard<mutex> lock(s.mutex);
+		auto it = s.index.find(k);
+		if ( it != s.index.end() ) {
+			s.rows.splice(s.rows.begin(), s.rows, it->second);
+			const Row& row = *it->second;
+			Entity::PropertyList props = ent.properties();
+			for ( size_t i = 0; i < props.size(); ++i ) {
+				row.values[i].assignTo(*props[i]);
+			}
+			++s.hits;
+			return true;
+		}
+		++s.misses;
+		generation = s.generation;
+	}
+
+	bool cacheable = transactions_.load() == 0;
+	bool loaded = target_.load(ent, criteria);
+	if ( loaded && cacheable )	insert(s, k, ent, generation);
+	return loaded;
+}
+
+bool CachingPersistenceApi::save(const Entity& ent) throw(Entception&)
+{
+	Invalidation inv(*this, ent);
+	return target_.save(ent);
+}
+
+bool CachingPersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	bool saved;
+	try {
+		saved = target_.saveAll(ents, count);
+	} catch (Entception& e) {
+		for ( size_t i = 0; i < count; ++i )	invalidate(*ents[i]);
+		throw;
+	}
+	for ( size_t i = 0; i < count; ++i )	invalidate(*ents[i]);
+	return saved;
+}
+
+bool CachingPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	Invalidation inv(*this, ent);
+	return target_.update(ent, updates);
+}
+
+bool CachingPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	Invalidation inv(*this, ent);
+	return target_.flush(ent, dirty);
+}
+
+bool CachingPersistenceApi::del(const Entity& ent) throw(Entception&)
+{
+	Invalidation inv(*this, ent);
+	return target_.del(ent);
+}
+
+PersistenceCursor* CachingPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	return target_.openCursor(shape, criteria);
+}
+
+void CachingPersistenceApi::beginTransaction() throw(Entception&)
+{
+	// Counted first, so no load can cache a row the transaction changes.
+	++transactions_;
+	try {
+		target_.beginTransaction();
+	} catch (Entception& e) {
+		--transactions_;
+		throw;
+	}
+}
+
+void CachingPersistenceApi::commitTransaction() throw(Entception&)
+{
+	// The transaction is still open if the commit fails.
+	target_.commitTransaction();
+	--transactions_;
+}
+
+void CachingPersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	try {
+		target_.rollbackTransaction();
+	} catch (Entception& e) {
+		--transactions_;
+		throw;
+	}
+	--transactions_;
+}
+
+void CachingPersistenceApi::clear()
+{
+	for ( size_t i = 0; i < shards_.size(); ++i ) {
+		Shard& s = shards_[i];
+		lock_guard<mutex> lock(s.mutex);
+		++s.generation;
+		s.rows.clear();
+		s.index.clear();
+		s.bytes = 0;
+	}
+}
+
+CachingPersistenceApi::Stats CachingPersistenceApi::stats() const
+{
+	Stats st = {0, 0, 0, 0, 0, 0};
+	for ( size_t i = 0; i < shards_.size(); ++i ) {
+		const Shard& s = shards_[i];
+		lock_guard<mutex> lock(s.mutex);
+		st.hits += s.hits;
+		st.misses += s.misses;
+		st.evictions += s.evictions;
+		st.invalidations += s.invalidations;
+		st.entries += s.index.size();
+		st.bytes += s.bytes;
+	}
+	return st;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
@@ -0,0 +1,157 @@
+#ifndef CACHING_PERSISTENCE_API_HPP
+#define CACHING_PERSISTENCE_API_HPP
+/*! \file	cachingpersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "persistenceapi.hpp"
+#include "primitivevalue.hpp"
+
+namespace tdk {
+namespace ent {
+
+class EntitySchema;
+
+/*! Persistence that caches the rows loaded by primary key from another
+ * persistence, so loading the same row again is served from memory.
+ *
+ * Only loads whose criteria are exactly the primary key of the entity type
+ * are cached. The cache is split in to shards, each with its own lock and
+ * least recently used list, so threads loading different rows rarely contend.
+ * Once a shard is over its share of the byte budget, its least recently used
+ * rows are evicted.
+ *
+ * Saves, updates, flushes and deletes made through this persistence remove
+ * the entity's row from the cache, so later loads see them. Changes made to
+ * persistent storage by any other means are not seen, so the cache suits read
+ * mostly data such as reference tables. Rows loaded while any transaction is
+ * open are not cached, as the transaction could still be rolled back.
+ *
+ * Values are copied out of the cache in to entities, except for view
+ * properties such as Property<StringPrimitive>, which would point in to the
+ * cache. Entity types with view properties must not be loaded through it.
+ *
+ * This persistence is thread safe, but is only used from several threads at
+ * once if the wrapped persistence is also thread safe.
+ */
+class CachingPersistenceApi : public PersistenceApi
+{
+public:
+	/*! Counters of how well the cache is doing. */
+	struct Stats {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;		//!< Rows evicted to keep within the budget.
+		uint64_t invalidations;	//!< Rows removed as they were written.
+		size_t entries;
+		size_t bytes;
+	};
+
+	/*! Create a cache in front of a persistence.
+	 * \param	target		Persistence to cache. It must outlive this one.
+	 * \param	maxBytes	Budget for the memory used by cached rows, split
+	 *			evenly between the shards.
+	 * \param	shards		Number of shards, which is rounded up to a power of
+	 *			two.
+	 */
+	CachingPersistenceApi(PersistenceApi& target, size_t maxBytes = DEFAULT_MAX_BYTES,
+			unsigned int shards = DEFAULT_SHARDS);
+
+	virtual bool save(const Entity& ent) throw(Entception&);
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool del(const Entity& ent) throw(Entception&);
+
+	/*! Load from the cache if the criteria are the primary key and the row is
+	 * cached, or else from the wrapped persistence.
+	 */
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	/*! Cursors are opened on the wrapped persistence, and are not cached. */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	/*! Remove every row from the cache. */
+	void clear();
+
+	/*! Get the counters, summed over the shards. */
+	Stats stats() const;
+
+	static const size_t DEFAULT_MAX_BYTES = 64 << 20;
+	static const unsigned int DEFAULT_SHARDS = 16;
+
+private:
+	struct Key {
+		Key(const EntitySchema* s, const PrimitiveValue& k) : schema(s), key(k) {}
+		const EntitySchema* schema;
+		PrimitiveValue key;
+		bool operator == (const Key& other) const { return schema == other.schema && key == other.key; }
+	};
+
+	struct KeyHash {
+		size_t operator () (const Key& k) const {
+			return k.key.hash() ^ (reinterpret_cast<size_t>(k.schema) >> 4);
+		}
+	};
+
+	/*! A cached row, with the values of all the entity's properties. */
+	struct Row {
+		Row(const Key& k) : key(k), bytes(0) {}
+		Key key;
+		std::vector<PrimitiveValue> values;
+		size_t bytes;
+	};
+
+	typedef std::list<Row> RowList;	// Most recently used first.
+
+	struct Shard {
+		Shard() : bytes(0), generation(0), hits(0), misses(0), evictions(0), invalidations(0) {}
+		mutable std::mutex mutex;
+		RowList rows;
+		std::unordered_map<Key, RowList::iterator, KeyHash> index;
+		size_t bytes;
+		uint64_t generation;	// Bumped whenever a row is invalidated.
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		uint64_t invalidations;
+	};
+
+	Shard& shardFor(const Key& k) { return shards_[KeyHash()(k) & (shards_.size() - 1)]; }
+
+	/*! Get the cache key for a load, if its criteria are the primary key. */
+	static bool keyOf(const Entity& ent, const AbstractPropertyCollection& criteria, PrimitiveValue& key);
+
+	/*! Remove an entity's row from the cache, keyed by its primary key. */
+	void invalidate(const Entity& ent);
+
+	void insert(Shard& shard, const Key& k, const Entity& ent, uint64_t generation);
+
+	class Invalidation;
+
+	CachingPersistenceApi(const CachingPersistenceApi&);
+	CachingPersistenceApi& operator = (const CachingPersistenceApi&);
+
+	PersistenceApi& target_;
+	size_t shardBytes_;
+	std::vector<Shard> shards_;
+	std::atomic<int> transactions_;	// Transactions open on any thread.
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
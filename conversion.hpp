@@ -7,7 +7,9 @@
  * This file contains the trait class definition used for converting user types
  * to one of the primitive types that persistences need to support.
  */
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace tdk {
 namespace ent {
@@ -31,6 +33,32 @@ struct PersistenceTypeConversion<int>
 	}
 };
 
+/** Traits for converting to/from 64 bit ints */
+template <>
+struct PersistenceTypeConversion<int64_t>
+{
+	typedef int64_t PrimitiveType;
+	static PrimitiveType toPrimitive(int64_t i) {
+		return i;
+	}
+	static int64_t fromPrimitive(int64_t i) {
+		return i;
+	}
+};
+
+/** Traits for converting to/from doubles */
+template <>
+struct PersistenceTypeConversion<double>
+{
+	typedef double PrimitiveType;
+	static PrimitiveType toPrimitive(double d) {
+		return d;
+	}
+	static double fromPrimitive(double d) {
+		return d;
+	}
+};
+
 /** Traits for converting to/from std::strings */
 template <>
 struct PersistenceTypeConversion<std::string>
@@ -44,6 +72,99 @@ struct PersistenceTypeConversion<std::string>
 	}
 };
 
+/** Traits for converting to/from binary data. The data is only copied when it
+ * is converted from the primitive.
+ */
+template <>
+struct PersistenceTypeConversion<std::vector<unsigned char> >
+{
+	typedef BlobPrimitive PrimitiveType;
+	static PrimitiveType toPrimitive(const std::vector<unsigned char>& v) {
+		return BlobPrimitive(v.empty() ? NULL : &v[0], v.size());
+	}
+	static std::vector<unsigned char> fromPrimitive(const BlobPrimitive& bp) {
+		const unsigned char* data = static_cast<const unsigned char*>(bp.data());
+		return std::vector<unsigned char>(data, data + bp.len());
+	}
+};
+
+/** Traits for using a StringPrimitive directly as the type of a property. The
+ * property is a view of the string it was assigned, and does not own it.
+ *
+ * Such a property loaded by a query points directly in to the persistence's
+ * memory for the current row, so no string is allocated or copied. The view is
+ * only valid until the query moves on, and must not be used after loading the
+ * entity by Entity::load, which does not keep its row. Copy anything that needs
+ * to be kept in to a std::string.
+ *
+ * ~~~{.cpp}
+ * struct LogLine : public Entity {
+ *     Property<StringPrimitive> message;
+ *     ...
+ * };
+ * ~~~
+ */
+template <>
+struct PersistenceTypeConversion<StringPrimitive>
+{
+	typedef StringPrimitive PrimitiveType;
+	static PrimitiveType toPrimitive(const StringPrimitive& sp) {
+		return sp;
+	}
+	static StringPrimitive fromPrimitive(const StringPrimitive& sp) {
+		return sp;
+	}
+};
+
+/** Traits for using a BlobPrimitive directly as the type of a property. As with
+ * StringPrimitive, the property is a view that is only valid while its query
+ * is on the row it was loaded from.
+ */
+template <>
+struct PersistenceTypeConversion<BlobPrimitive>
+{
+	typedef BlobPrimitive PrimitiveType;
+	static PrimitiveType toPrimitive(const BlobPrimitive& bp) {
+		return bp;
+	}
+	static BlobPrimitive fromPrimitive(const BlobPrimitive& bp) {
+		return bp;
+	}
+};
+
+/** Traits class used for assigning a primitive to a user type. By default the
+ * primitive is converted to a new value which replaces the old one. Types
+ * that can reuse their storage specialise this, so that loading many rows in
+ * to the same entity does not allocate for every row.
+ */
+template <typename UserType>
+struct PersistenceTypeAssign
+{
+	template <typename Primitive>
+	static void assign(UserType& val, const Primitive& p) {
+		val = PersistenceTypeConversion<UserType>::fromPrimitive(p);
+	}
+};
+
+/** Strings reuse their buffer when assigned a shorter or equal length string. */
+template <>
+struct PersistenceTypeAssign<std::string>
+{
+	static void assign(std::string& val, const StringPrimitive& sp) {
+		val.assign(sp.data(), sp.len());
+	}
+};
+
+/** Binary data reuses its buffer when assigned smaller or equal size data. */
+template <>
+struct PersistenceTypeAssign<std::vector<unsigned char> >
+{
+	static void assign(std::vector<unsigned char>& val, const BlobPrimitive& bp) {
+		const unsigned char* data = static_cast<const unsigned char*>(bp.data());
+		val.assign(data, data + bp.len());
+	}
+};
+
 /** Enumeration helper template class which can be inherited from by your
  * trait class definition for enum types.
  *
@@ -9,9 +9,64 @@
 namespace tdk {
 namespace ent {
 
-void Entity::addProperty(AbstractProperty* p)
+void Entity::addProperty(AbstractProperty* p, PrimitiveKind kind) throw(Entception&)
 {
-	properties_.push_back(p);
+	size_t index = registered_++;
+	ptrdiff_t offset = reinterpret_cast<char*>(p) - reinterpret_cast<char*>(this);
+	if ( schema_->sealed() ) {
+		if ( index >= schema_->size() ) {
+			throw Entception("Entity has more properties than others of its type");
+		}
+		// Properties are found by the offsets in the schema, so an entity
+		// laid out differently would have the wrong memory read as them.
+		const char* name = schema_->name(index);
+		if ( schema_->offset(index) != offset || schema_->kind(index) != kind
+				|| (name != p->propertyName() && strcmp(name, p->propertyName()) != 0) ) {
+			throw Entception("Entity's properties differ from those of others of its type");
+		}
+		return;
+	}
+
+	schema_->addField(index, p->propertyName(), kind, offset);
+}
+
+void Entity::setPrimaryKey(AbstractProperty& key)
+{
+	if ( schema_->sealed() )	return;
+
+	schema_->setPrimaryKey(reinterpret_cast<char*>(&key) - reinterpret_cast<char*>(this));
+}
+
+const EntitySchema& Entity::schema() const
+{
+	// Using an entity means it has been constructed, so its type's schema is
+	// complete.
+	if ( !schema_->sealed() )	schema_->seal();
+	return *schema_;
+}
+
+AbstractProperty* Entity::primaryKey() const
+{
+	int key = schema().primaryKey();
+	return key < 0 ? NULL : properties()[key];
+}
+
+void Entity::clearDirty()
+{
+	PropertyList props = properties();
+	for ( unsigned int i=0; i<props.size(); ++i ) {
+		props[i]->clearDirty();
+	}
+}
+
+PropertyMask Entity::dirtyProperties() const
+{
+	PropertyList props = properties();
+	PropertyMask mask = 0;
+	for ( unsigned int i=0; i<props.size(); ++i ) {
+		if ( props[i]->dirty() )	mask |= PropertyMask(1) << i;
+	}
+	return mask;
 }
 
 bool Entity::save(void) throw(Entception&)
@@ -21,7 +76,9 @@ bool Entity::save(void) throw(Entception&)
 	}
 	
 	try {
-		return persistence_->save(*this);
+		bool saved = persistence_->save(*this);
+		if ( saved )	clearDirty();
+		return saved;
 	} catch (Entception& e) {
 		THROW_AGAIN(e, "Persistence failed to save.");
 	}
@@ -38,11 +95,25 @@ bool Entity::update(const AbstractPropertyCollection& updates) throw(Entception&
 	return persistence_->update(*this, updates);
 }
 
+bool Entity::flush() throw(Entception&)
+{
+	if ( !persistence_ )	return false;
+
+	PropertyMask dirty = dirtyProperties();
+	if ( !dirty )	return false;
+
+	bool flushed = persistence_->flush(*this, dirty);
+	if ( flushed )	clearDirty();
+	return flushed;
+}
+
 bool Entity::load(const AbstractPropertyCollection& criteria) throw(Entception&)
 {
 	if ( !persistence_ )	return NULL;
 	
-	return persistence_->load(*this, criteria);
+	bool loaded = persistence_->load(*this, criteria);
+	if ( loaded )	clearDirty();
+	return loaded;
 }
 
 bool Entity::del(void) throw(Entception&)
@@ -54,29 +125,33 @@ bool Entity::del(void) throw(Entception&)
 
 AbstractProperty* Entity::operator [] (const char* propName) const
 {
-	for ( unsigned int i=0; i<properties_.size(); ++i ) {
-		if ( strcmp(properties_[i]->propertyName(), propName) == 0 )	return properties_[i];
-	}
-	return NULL;
+	int i = schema().indexOf(propName);
+	return i < 0 ? NULL : properties()[i];
+}
+
+AbstractProperty* Entity::operator [] (const PropertyName& propName) const
+{
+	int i = schema().indexOf(propName);
+	return i < 0 ? NULL : properties()[i];
 }
 
-bool Entity::isSubset(const AbstractPropertyCollection& collection) const
+bool Entity::isSubset(const AbstractPropertyCollection& collection, PropertyMask* mask) const
 {
-	const PropertyDeque& prps = collection.props();
+	AbstractPropertyCollection::PropertyArray prps = collection.props();
+	const EntitySchema& s = schema();
+	PropertyMask found = 0;
 	
-	// Iterate through all the props in the collection.
+	// Iterate through all the props in the collection, and look each up in
+	// this entity's schema.
 	for ( unsigned int i = 0; i < prps.size(); ++i ) {
-	
-		// ... And check to see if it exists in this entity's properties.
-		unsigned int j;
-		for ( j = 0; j < properties_.size(); ++j ) {
-			if ( strcmp(properties_[j]->propertyName(), prps[i]->propertyName()) == 0 )	break;	// Found
-		}
-		if ( j >= properties_.size() ) {
+		int index = s.indexOf(prps[i]->propertyName());
+		if ( index < 0 ) {
 			return false;	// Property was not found in entity.
 		}
+		found |= PropertyMask(1) << index;
 	}
 	
+	if ( mask )	*mask = found;
 	return true;
 }
 
@@ -5,8 +5,8 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
-#include <deque>
 #include "abstractproperty.hpp"
+#include "entityschema.hpp"
 #include "persistenceapi.hpp"
 #include "entception.hpp"
 
@@ -26,7 +26,8 @@ public:
 	 * \param	entitytype	Name of the entity class. This must be a string literal
 	 *			and can not change during the lifetime of the class.
 	 */
-	Entity(const char* entitytype) : persistence_(NULL), entitytype_(entitytype) {}
+	Entity(const char* entitytype)
+		: persistence_(NULL), schema_(EntitySchema::forType(entitytype)), registered_(0) {}
 
 	/*! Save the entity. This calls the entities installed persistence API's save
 	 * method.
@@ -44,6 +45,21 @@ public:
 	 */
 	bool update(const AbstractPropertyCollection& updates) throw(Entception&);
 	
+	/*! Write the properties that have been modified since the entity was last
+	 * saved, loaded or flushed to persistent storage. Nothing else is written,
+	 * so this is far cheaper than an update when only a few properties of a
+	 * wide entity have changed.
+	 *
+	 * \return	Whether or not the entity was updated in persistent storage.
+	 * \retval	false	No properties have been modified.
+	 */
+	bool flush() throw(Entception&);
+
+	/*! Get the mask of the properties that have been modified since the entity
+	 * was last saved, loaded or flushed.
+	 */
+	PropertyMask dirtyProperties() const;
+
 	/*! Load an entity of this entities name, which has matching properties.
 	 * 
 	 * \return	Whether or not this entity was updated with loaded data.
@@ -62,7 +78,10 @@ public:
 	void setPersistence(PersistenceApi* p) { persistence_ = p; }
 	
 	/*! Get the name of the entity */
-	const char* entitytype() const { return entitytype_; }
+	const char* entitytype() const { return schema_->entitytype(); }
+
+	/*! Get the schema shared by all entities of this entity's type. */
+	const EntitySchema& schema() const;
 
 	/* Attempt to get a property based on it's name.
 	 * \param	propertyName	Name of the property to try and find.
@@ -70,32 +89,94 @@ public:
 	 * \retval	NULL	No property with the specified name could be found.
 	 */
 	AbstractProperty* operator [] (const char* propertyName) const;
+
+	/* Get a property by a name whose hash has been computed in advance.
+	 * \see	PropertyName
+	 */
+	AbstractProperty* operator [] (const PropertyName& propertyName) const;
 	
 	/*! Check whether or not the supplied property collection is a subset of
 	 * this entity. For this to be true, this entity must have a prop with the
 	 * same name for each property in the collection.
+	 *
+	 * \param[out]	mask	If not NULL, set to the mask of this entity's
+	 *			properties that are named in the collection.
 	 */
-	bool isSubset(const AbstractPropertyCollection& props) const;
+	bool isSubset(const AbstractPropertyCollection& props, PropertyMask* mask = NULL) const;
 	
-	typedef std::deque<AbstractProperty*> PropertyDeque;
+	/*! Get the property that uniquely identifies this entity in persistent
+	 * storage.
+	 * \retval	NULL	The entity has no primary key, so it can only be
+	 *			identified by the values of all its properties.
+	 */
+	AbstractProperty* primaryKey() const;
+
+	/*! Read only list of an entity's properties, in the order they were
+	 * constructed. The properties are found through the offsets held by the
+	 * entity type's schema, so the list is cheap to create and copy.
+	 */
+	class PropertyList
+	{
+	public:
+		size_t size() const { return schema_->size(); }
+		bool empty() const { return schema_->size() == 0; }
+		AbstractProperty* operator [] (size_t i) const {
+			return reinterpret_cast<AbstractProperty*>(base_ + schema_->offset(i));
+		}
+	private:
+		PropertyList(const Entity* ent)
+			: base_(reinterpret_cast<char*>(const_cast<Entity*>(ent))), schema_(&ent->schema()) {}
+		char* base_;
+		const EntitySchema* schema_;
+		friend class Entity;
+	};
 	
 	/*! Get access to the entity's complete set of properties. These are only
 	 * availble as read only.
 	 * If you need to write to a property, then you should have access to the
 	 * concrete entity type, and can access the properties directly.
 	 */
-	const PropertyDeque& properties() const { return properties_; }	
-	
-	/*! Add a property to this entitiy.
-	 * This is used to add arbitrary properties to an entity.
-	 * It's main use is for performing loads/searches and updating an entity.
+	PropertyList properties() const { return PropertyList(this); }
+
+	/*! Add a property to this entitiy. This is called by the constructor of
+	 * each of the entity's properties, and records the property in the
+	 * schema if it is the first entity of its type. Otherwise the property is
+	 * checked against the one at the same index in the schema.
+	 *
+	 * \param	p		Property, which must be a member of this entity.
+	 * \param	kind	Primitive kind the property's value is visited as.
+	 *
+	 * \throws	Entception	If the entity already has MAX_PROPERTIES properties,
+	 *			or its properties differ from those of other entities of its
+	 *			type, in number, name, kind or place within the entity.
 	 */
-	void addProperty(AbstractProperty* p);
+	void addProperty(AbstractProperty* p, PrimitiveKind kind) throw(Entception&);
 	
+protected:
+	/*! Designate one of this entity's properties as its primary key. This
+	 * should be done in the constructor of the concrete entity.
+	 *
+	 * Persistences use the primary key to find the entity when updating or
+	 * deleting it, rather than matching on every property. The key should
+	 * be backed by a unique index in persistent storage.
+	 */
+	void setPrimaryKey(AbstractProperty& key);
+
 private:
+	// Mark all the properties as matching persistent storage.
+	void clearDirty();
+
+	// Transactions write through the persistence, and only clear the dirty
+	// properties once the changes are committed.
+	friend class Transaction;
+
+	// Factories save batches through the persistence, then clear the dirty
+	// properties of every entity in them.
+	friend class EntityFactory;
+
 	PersistenceApi* persistence_;
-	const char* entitytype_;
-	PropertyDeque properties_;
+	EntitySchema* schema_;
+	unsigned short registered_;	// Number of properties constructed so far.
 };
 
 }	// End namespace ent
@@ -0,0 +1,261 @@
+/*! \file	entitycodec.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "entitycodec.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+const size_t FINGERPRINT_BYTES = 8;
+
+// Maps signed numbers to unsigned so that small magnitudes stay small.
+uint64_t zigzag(int64_t i)
+{
+	return (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63);
+}
+
+int64_t unzigzag(uint64_t u)
+{
+	return static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+}
+
+size_t putVarint(char* p, uint64_t v)
+{
+	size_t n = 0;
+	while ( v >= 0x80 ) {
+		p[n++] = static_cast<char>(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = static_cast<char>(v);
+	return n;
+}
+
+void putFixed(char* p, uint64_t v)
+{
+	for ( size_t i = 0; i < 8; ++i ) {
+		p[i] = static_cast<char>(v >> (8 * i));
+	}
+}
+
+uint64_t getFixed(const unsigned char* p)
+{
+	uint64_t v = 0;
+	for ( size_t i = 0; i < 8; ++i ) {
+		v |= static_cast<uint64_t>(p[i]) << (8 * i);
+	}
+	return v;
+}
+
+}	// End anon namespace
+
+/*! Appends the value of each property it visits. The string is grown ahead
+ * of the values, which are then written straight in to it.
+ */
+class EntityCodec::Encoder : public ReadVisitor
+{
+public:
+	Encoder(string& out) : out_(out), used_(out.size()) {}
+
+	virtual bool visit(const bool& b) { return integer(b); }
+	virtual bool visit(const char& c) { return integer(c); }
+	virtual bool visit(const int& i) { return integer(i); }
+	virtual bool visit(const int64_t& i) { return integer(i); }
+
+	virtual bool visit(const unsigned int& ui) {
+		used_ += putVarint(room(MAX_VARINT_BYTES), ui);
+		return true;
+	}
+
+	virtual bool visit(const double& d) {
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		fixed(bits);
+		return true;
+	}
+
+	virtual bool visit(const StringPrimitive& str) { return bytes(str.data(), str.len()); }
+	virtual bool visit(const BlobPrimitive& blob) { return bytes(blob.data(), blob.len()); }
+
+	void fixed(uint64_t v) {
+		putFixed(room(8), v);
+		used_ += 8;
+	}
+
+	void byte(uint8_t b) {
+		*room(1) = static_cast<char>(b);
+		++used_;
+	}
+
+	/*! Trim the string to what was written. */
+	void finish() { out_.resize(used_); }
+
+private:
+	static const size_t MAX_VARINT_BYTES = 10;
+
+	char* room(size_t n) {
+		if ( out_.size() - used_ < n ) {
+			out_.resize(std::max(out_.size() * 2, used_ + n + 64));
+		}
+		return &out_[used_];
+	}
+
+	bool integer(int64_t i) {
+		used_ += putVarint(room(MAX_VARINT_BYTES), zigzag(i));
+		return true;
+	}
+
+	bool bytes(const void* data, size_t len) {
+		char* p = room(MAX_VARINT_BYTES + len);
+		size_t n = putVarint(p, len);
+		if ( len )	memcpy(p + n, data, len);
+		used_ += n + len;
+		return true;
+	}
+
+	string& out_;
+	size_t used_;
+};
+
+/*! Assigns each property it visits the next value, and notes whether the
+ * bytes ran out.
+ */
+class EntityCodec::Decoder : public WriteVisitor
+{
+public:
+	Decoder(const unsigned char* p, const unsigned char* end) : p_(p), end_(end), ok_(true) {}
+
+	virtual void visit(bool& b) { b = unzigzag(varint()) != 0; }
+	virtual void visit(char& c) { c = static_cast<char>(unzigzag(varint())); }
+	virtual void visit(int& i) { i = static_cast<int>(unzigzag(varint())); }
+	virtual void visit(unsigned int& ui) { ui = static_cast<unsigned int>(varint()); }
+	virtual void visit(int64_t& i) { i = unzigzag(varint()); }
+
+	virtual void visit(double& d) {
+		if ( !need(8) )	return;
+		uint64_t bits = getFixed(p_);
+		memcpy(&d, &bits, sizeof(d));
+		p_ += 8;
+	}
+
+	virtual void visit(StringPrimitive& str) {
+		size_t len = 0;
+		const char* data = static_cast<const char*>(bytes(len));
+		if ( ok_ )	str = StringPrimitive(data, len);
+	}
+
+	virtual void visit(BlobPrimitive& blob) {
+		size_t len = 0;
+		const void* data = bytes(len);
+		if ( ok_ )	blob = BlobPrimitive(data, len);
+	}
+
+	/*! Step over the next value, of a property of some kind, without
+	 * assigning it anywhere.
+	 */
+	void skip(PrimitiveKind kind) {
+		size_t len = 0;
+		switch ( kind ) {
+		case PRIMITIVE_DOUBLE:
+			if ( need(8) )	p_ += 8;
+			break;
+		case PRIMITIVE_STRING:
+		case PRIMITIVE_BLOB:
+			bytes(len);
+			break;
+		default:
+			varint();
+			break;
+		}
+	}
+
+	bool ok() const { return ok_; }
+	const unsigned char* position() const { return p_; }
+
+private:
+	bool need(size_t n) {
+		if ( ok_ && static_cast<size_t>(end_ - p_) < n )	ok_ = false;
+		return ok_;
+	}
+
+	uint64_t varint() {
+		uint64_t v = 0;
+		for ( unsigned int shift = 0; shift < 64; shift += 7 ) {
+			if ( !need(1) )	return 0;
+			unsigned char b = *p_++;
+			v |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if ( !(b & 0x80) )	return v;
+		}
+		ok_ = false;
+		return 0;
+	}
+
+	const void* bytes(size_t& len) {
+		len = varint();
+		if ( !need(len) )	return NULL;
+		const void* data = p_;
+		p_ += len;
+		return data;
+	}
+
+	const unsigned char* p_;
+	const unsigned char* end_;
+	bool ok_;
+};
+
+void EntityCodec::encode(const Entity& ent, string& out)
+{
+	Encoder encoder(out);
+	encoder.byte(VERSION);
+	encoder.fixed(ent.schema().fingerprint());
+
+	Entity::PropertyList props = ent.properties();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		props[i]->acceptReader(encoder);
+	}
+	encoder.finish();
+}
+
+size_t EntityCodec::decode(Entity& ent, const void* data, size_t len) throw(Entception&)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	if ( len < 1 + FINGERPRINT_BYTES ) {
+		throw LoadEntception(&ent, "The encoded entity is cut short.");
+	}
+	if ( p[0] != VERSION ) {
+		throw LoadEntception(&ent, "The entity was encoded with an unsupported version of the format.");
+	}
+	if ( getFixed(p + 1) != ent.schema().fingerprint() ) {
+		throw LoadEntception(&ent, "The entity was encoded from an entity type with different properties.");
+	}
+
+	// Check every value is there before assigning any, so a bad encoding
+	// leaves the entity as it was.
+	const EntitySchema& schema = ent.schema();
+	Decoder check(p + 1 + FINGERPRINT_BYTES, p + len);
+	for ( size_t i = 0; i < schema.size() && check.ok(); ++i ) {
+		check.skip(schema.kind(i));
+	}
+	if ( !check.ok() ) {
+		throw LoadEntception(&ent, "The encoded entity is cut short.");
+	}
+
+	Decoder decoder(p + 1 + FINGERPRINT_BYTES, p + len);
+	Entity::PropertyList props = ent.properties();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		props[i]->acceptWriter(decoder);
+	}
+	return decoder.position() - p;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
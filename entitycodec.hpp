@@ -0,0 +1,66 @@
+#ifndef ENTITY_CODEC_HPP
+#define ENTITY_CODEC_HPP
+/*! \file	entitycodec.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "entity.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Compact binary encoding of the values of an entity's properties, for
+ * caching, passing entities between processes and snapshots.
+ *
+ * An encoding starts with the version of the format and the fingerprint of
+ * the entity type's schema, so it can only be decoded in to an entity with
+ * the same properties, of the same kinds, in the same order. The values
+ * follow, in the order of the properties:
+ *
+ * - bool, char, int and int64_t as zigzag varints, and unsigned int as a
+ *   varint, so small numbers take a byte.
+ * - double as 8 bytes, little endian.
+ * - Strings and blobs as a varint length followed by the bytes.
+ *
+ * ~~~{.cpp}
+ * std::string bytes;
+ * EntityCodec::encode(person, bytes);
+ * ...
+ * EntityCodec::decode(copy, bytes.data(), bytes.size());
+ * ~~~
+ */
+class EntityCodec
+{
+public:
+	/*! Version of the format written by encode. */
+	static const uint8_t VERSION = 1;
+
+	/*! Append the encoding of an entity to a string. */
+	static void encode(const Entity& ent, std::string& out);
+
+	/*! Decode an entity from the start of some bytes. As with a load, the
+	 * properties are not marked as dirty. View properties such as
+	 * Property<StringPrimitive> point in to the bytes, so must not outlive
+	 * them.
+	 *
+	 * \return	The number of bytes decoded, so encodings that were appended
+	 *			one after another can be decoded in turn.
+	 * \throws	LoadEntception	If the bytes are of another version or entity
+	 *			type, or are cut short. The entity is then left unchanged.
+	 */
+	static size_t decode(Entity& ent, const void* data, size_t len) throw(Entception&);
+
+private:
+	class Encoder;
+	class Decoder;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
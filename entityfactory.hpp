@@ -5,8 +5,12 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
+#include <vector>
+
 #include "entity.hpp"
+#include "entitypool.hpp"
 #include "persistenceapi.hpp"
+#include "query.hpp"
 
 namespace tdk {
 namespace ent {
@@ -31,6 +35,83 @@ public:
 		return ent;
 	}
 
+	/*! Create an entity of the templated entity type in memory from a pool.
+	 * This entity will have a persistence API installed in to it, and is given
+	 * back to the pool when the returned handle is destroyed.
+	 *
+	 * \tparam	Ent		Entity type to create.
+	 *
+	 * \param	pool	Pool to create the entity from.
+	 *
+	 * \result	Handle owning the new entity.
+	 */
+	template <typename Ent>
+	PooledEntity<Ent> createPooled(EntityPool<Ent>& pool) {
+		PooledEntity<Ent> ent(pool.construct(), EntityPoolDeleter<Ent>(&pool));
+		installPersistenceApi(ent.get());
+		return ent;
+	}
+
+	/*! Save a range of entities in one batch. This calls the factory's
+	 * persistence API's saveAll method, which is able to save the entities
+	 * far more cheaply than calling save on each of them. As with save, if
+	 * the whole batch is saved, every entity's properties are marked as
+	 * matching persistent storage.
+	 *
+	 * \tparam	Iter	Iterator over pointers to entities created by this
+	 *			factory.
+	 *
+	 * \return	Whether or not all the entities were saved.
+	 */
+	template <typename Iter>
+	bool saveAll(Iter first, Iter last) throw(Entception&) {
+		std::vector<Entity*> ents(first, last);
+		if ( ents.empty() )	return true;
+
+		bool saved = false;
+		try {
+			saved = persistenceApi().saveAll(&ents[0], ents.size());
+		} catch (Entception& e) {
+			THROW_AGAIN(e, "Persistence failed to save a batch.");
+		}
+
+		if ( saved ) {
+			for ( size_t i = 0; i < ents.size(); ++i ) {
+				ents[i]->clearDirty();
+			}
+		}
+		return saved;
+	}
+
+	/*! Query for all the entities of the templated type that match some
+	 * criteria. The entities are loaded lazily as the query is iterated.
+	 *
+	 * \tparam	Ent		Entity type to query for.
+	 *
+	 * \param	criteria	Collection of properties the entities must match.
+	 *
+	 * \result	Query over the matching entities.
+	 */
+	template <typename Ent>
+	Query<Ent> query(const AbstractPropertyCollection& criteria) throw(Entception&) {
+		Ent* ent = create<Ent>();
+		PersistenceCursor* cursor = NULL;
+		try {
+			cursor = persistenceApi().openCursor(*ent, criteria);
+		} catch (Entception& e) {
+			delete ent;
+			THROW_AGAIN(e, "Persistence failed to open a query.");
+		}
+		return Query<Ent>(ent, cursor);
+	}
+
+	/*! Query for all the entities of the templated type. */
+	template <typename Ent>
+	Query<Ent> query() throw(Entception&) {
+		struct NoCriteria : public AbstractPropertyCollection {} none;
+		return query<Ent>(none);
+	}
+
 	virtual ~EntityFactory() {}
 
 protected:
@@ -43,6 +124,24 @@ protected:
 	 * \param	e	Entity to install the persistence in to.
 	 */
 	virtual void installPersistenceApi(Entity* e) = 0;
+
+	/*! Get the persistence API that this factory installs in to entities. It
+	 * is used for operations that span multiple entities.
+	 */
+	virtual PersistenceApi& persistenceApi() = 0;
+
+	/*! Get the persistence API of another factory, for factories that wrap
+	 * it in a persistence of their own.
+	 */
+	static PersistenceApi& persistenceApiOf(EntityFactory& factory) { return factory.persistenceApi(); }
+
+	/*! Install another factory's persistence in to an entity, for factories
+	 * that hand some entities to the factory they wrap.
+	 */
+	static void installPersistenceApiOf(EntityFactory& factory, Entity* e) { factory.installPersistenceApi(e); }
+
+	// Transactions are run on the factory's persistence API.
+	friend class Transaction;
 };
 
 }	// End namespace ent
@@ -0,0 +1,180 @@
+#ifndef ENTITY_FIELDS_HPP
+#define ENTITY_FIELDS_HPP
+/*! \file	entityfields.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ *
+ * Visiting the properties of an entity through ReadVisitor and WriteVisitor
+ * costs two virtual calls per property, which the compiler can not inline.
+ * Entity types that describe their properties at compile time can instead be
+ * visited statically, with every call known to the compiler.
+ */
+
+#include "entity.hpp"
+#include "property.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Traits class describing the properties of an entity type at compile time.
+ * Entity types are not described by default, and are visited through the
+ * virtual interface.
+ *
+ * To describe an entity type, specialise this class with described set to
+ * true, and an apply method calling a function object on each property, in
+ * the order they are declared in the entity.
+ *
+ * ~~~{.cpp}
+ * template <>
+ * struct EntityFields<Person>
+ * {
+ *     static const bool described = true;
+ *     template <typename P, typename F>
+ *     static void apply(P& p, F& f) { f(p.id); f(p.name); f(p.age); }
+ * };
+ * ~~~
+ *
+ * apply is called with both const and non-const entities.
+ */
+template <typename Ent>
+struct EntityFields
+{
+	static const bool described = false;
+};
+
+/*! Adapts a visitor that has non-virtual visit methods to the ReadVisitor
+ * interface, so it can be used on entities that are not described.
+ */
+template <typename Visitor>
+class ReadVisitorAdaptor : public ReadVisitor
+{
+public:
+	ReadVisitorAdaptor(Visitor& v) : v_(v) {}
+	virtual bool visit(const bool& b) { return v_.visit(b); }
+	virtual bool visit(const char& c) { return v_.visit(c); }
+	virtual bool visit(const int& i) { return v_.visit(i); }
+	virtual bool visit(const unsigned int& ui) { return v_.visit(ui); }
+	virtual bool visit(const double& d) { return v_.visit(d); }
+	virtual bool visit(const StringPrimitive& str) { return v_.visit(str); }
+	virtual bool visit(const int64_t& i) { return v_.visit(i); }
+	virtual bool visit(const BlobPrimitive& blob) { return v_.visit(blob); }
+private:
+	Visitor& v_;
+};
+
+/*! Adapts a visitor that has non-virtual visit methods to the WriteVisitor
+ * interface, so it can be used on entities that are not described.
+ */
+template <typename Visitor>
+class WriteVisitorAdaptor : public WriteVisitor
+{
+public:
+	WriteVisitorAdaptor(Visitor& v) : v_(v) {}
+	virtual void visit(bool& b) { v_.visit(b); }
+	virtual void visit(char& c) { v_.visit(c); }
+	virtual void visit(int& i) { v_.visit(i); }
+	virtual void visit(unsigned int& ui) { v_.visit(ui); }
+	virtual void visit(double& d) { v_.visit(d); }
+	virtual void visit(StringPrimitive& str) { v_.visit(str); }
+	virtual void visit(int64_t& i) { v_.visit(i); }
+	virtual void visit(BlobPrimitive& blob) { v_.visit(blob); }
+private:
+	Visitor& v_;
+};
+
+/*! Dispatches visitors over the properties of an entity, statically if the
+ * entity type is described, and through the virtual interface if not. Use
+ * forEachProperty and forEachPropertyWrite rather than this directly.
+ */
+template <typename Ent, bool Described = EntityFields<Ent>::described>
+struct PropertyDispatch
+{
+	template <typename Visitor>
+	static bool read(const Ent& ent, Visitor& v) {
+		ReadVisitorAdaptor<Visitor> adaptor(v);
+		Entity::PropertyList props = ent.properties();
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			if ( !props[i]->acceptReader(adaptor) )	return false;
+		}
+		return true;
+	}
+
+	template <typename Visitor>
+	static void write(Ent& ent, Visitor& v) {
+		WriteVisitorAdaptor<Visitor> adaptor(v);
+		Entity::PropertyList props = ent.properties();
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			props[i]->acceptWriter(adaptor);
+		}
+	}
+};
+
+template <typename Ent>
+struct PropertyDispatch<Ent, true>
+{
+	template <typename Visitor>
+	struct Reader {
+		Reader(Visitor& visitor) : v(visitor), ok(true) {}
+		template <typename T>
+		void operator () (const Property<T>& p) { if ( ok )	ok = p.readWith(v); }
+		Visitor& v;
+		bool ok;
+	};
+
+	template <typename Visitor>
+	struct Writer {
+		Writer(Visitor& visitor) : v(visitor) {}
+		template <typename T>
+		void operator () (Property<T>& p) { p.writeWith(v); }
+		Visitor& v;
+	};
+
+	template <typename Visitor>
+	static bool read(const Ent& ent, Visitor& v) {
+		Reader<Visitor> r(v);
+		EntityFields<Ent>::apply(ent, r);
+		return r.ok;
+	}
+
+	template <typename Visitor>
+	static void write(Ent& ent, Visitor& v) {
+		Writer<Visitor> w(v);
+		EntityFields<Ent>::apply(ent, w);
+	}
+};
+
+/*! Read every property of an entity with a visitor, in the order of
+ * Entity::properties(). The visitor needs a visit method taking each
+ * primitive type by const reference and returning a bool, like ReadVisitor,
+ * but they need not be virtual.
+ *
+ * If the entity type is described by EntityFields the visit methods are
+ * called directly, and can be inlined. Otherwise they are called through the
+ * virtual interface.
+ *
+ * \return	Whether or not every visit returned true. Visiting stops at the
+ *			first visit to return false.
+ */
+template <typename Ent, typename Visitor>
+bool forEachProperty(const Ent& ent, Visitor& v)
+{
+	return PropertyDispatch<Ent>::read(ent, v);
+}
+
+/*! Assign every property of an entity with a visitor, in the order of
+ * Entity::properties(). The visitor needs a visit method taking each
+ * primitive type by reference, like WriteVisitor, but they need not be
+ * virtual. The properties are not marked as dirty.
+ *
+ * \see	forEachProperty
+ */
+template <typename Ent, typename Visitor>
+void forEachPropertyWrite(Ent& ent, Visitor& v)
+{
+	PropertyDispatch<Ent>::write(ent, v);
+}
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef ENTITY_POOL_HPP
+#define ENTITY_POOL_HPP
+/*! \file	entitypool.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace tdk {
+namespace ent {
+
+template <typename Ent> class EntityPool;
+
+/*! Deleter that gives an entity back to the pool it was created from. */
+template <typename Ent>
+struct EntityPoolDeleter
+{
+	EntityPoolDeleter() : pool(NULL) {}
+	EntityPoolDeleter(EntityPool<Ent>* p) : pool(p) {}
+
+	void operator () (Ent* ent) const { pool->destroy(ent); }
+
+	EntityPool<Ent>* pool;
+};
+
+/*! Owning handle to an entity created from a pool. The entity is given back
+ * to the pool when the handle is destroyed or reset.
+ */
+template <typename Ent>
+using PooledEntity = std::unique_ptr<Ent, EntityPoolDeleter<Ent> >;
+
+/*! A pool of memory for entities of a single type. Memory is allocated in slabs
+ * of several entities at a time, and memory given back by destroyed entities
+ * is kept on a free list for the next entity to be created. Once a pool has
+ * grown to the number of entities in use at once, creating and destroying
+ * entities no longer touches the heap.
+ *
+ * Pools are used through EntityFactory::createPooled.
+ *
+ * ~~~{.cpp}
+ * EntityPool<Person> pool;
+ * PooledEntity<Person> p = factory.createPooled(pool);
+ * p->name = "Bob";
+ * p->save();
+ * ~~~
+ *
+ * Pools are not thread safe, and must outlive all the entities created from
+ * them. Memory is only given back to the heap when the pool is destroyed.
+ *
+ * \tparam	Ent		Entity type to pool. Only entities of exactly this type can
+ *			be created from the pool.
+ */
+template <typename Ent>
+class EntityPool
+{
+public:
+	/*! Create an empty pool.
+	 * \param	entitiesPerSlab	Number of entities to allocate memory for at once.
+	 */
+	explicit EntityPool(size_t entitiesPerSlab = 64)
+		: free_(NULL), perSlab_(entitiesPerSlab ? entitiesPerSlab : 1), live_(0) {}
+
+	/*! Free all the slabs. No entities created from the pool may be alive. */
+	~EntityPool() {
+		for ( size_t i = 0; i < slabs_.size(); ++i ) {
+			::operator delete(slabs_[i]);
+		}
+	}
+
+	/*! Construct an entity in memory from the pool.
+	 * \throws	std::bad_alloc	If a new slab could not be allocated.
+	 */
+	Ent* construct() {
+		Slot* s = take();
+		try {
+			Ent* ent = new (&s->storage) Ent;
+			++live_;
+			return ent;
+		} catch (...) {
+			give(s);
+			throw;
+		}
+	}
+
+	/*! Destroy an entity created from this pool, giving its memory back. */
+	void destroy(Ent* ent) {
+		if ( !ent )	return;
+
+		ent->~Ent();
+		--live_;
+		give(reinterpret_cast<Slot*>(ent));
+	}
+
+	/*! Get the number of entities created from the pool that are alive. */
+	size_t live() const { return live_; }
+
+	/*! Get the number of entities the pool has memory for. */
+	size_t capacity() const { return slabs_.size() * perSlab_; }
+
+private:
+	// Memory for one entity, which holds the next free slot while unused.
+	union Slot {
+		Slot* next;
+		typename std::aligned_storage<sizeof(Ent), alignof(Ent)>::type storage;
+	};
+
+	Slot* take() {
+		if ( !free_ ) {
+			slabs_.reserve(slabs_.size() + 1);
+			Slot* slab = static_cast<Slot*>(::operator new(perSlab_ * sizeof(Slot)));
+			slabs_.push_back(slab);
+
+			// Thread the new slots on to the free list, lowest address first.
+			for ( size_t i = perSlab_; i-- > 0; ) {
+				slab[i].next = free_;
+				free_ = &slab[i];
+			}
+		}
+
+		Slot* s = free_;
+		free_ = s->next;
+		return s;
+	}
+
+	void give(Slot* s) {
+		s->next = free_;
+		free_ = s;
+	}
+
+	EntityPool(const EntityPool&);
+	EntityPool& operator = (const EntityPool&);
+
+	Slot* free_;
+	std::vector<Slot*> slabs_;
+	size_t perSlab_;
+	size_t live_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
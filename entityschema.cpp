@@ -0,0 +1,136 @@
+/*! \file	entityschema.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "entityschema.hpp"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+struct NameLess {
+	bool operator () (const char* a, const char* b) const { return strcmp(a, b) < 0; }
+};
+
+typedef std::map<const char*, EntitySchema*, NameLess> SchemaRegistry;
+
+// Guards the registry, and the building of every schema that is not sealed.
+std::mutex& registryMutex()
+{
+	static std::mutex m;
+	return m;
+}
+
+SchemaRegistry& registry()
+{
+	static SchemaRegistry r;
+	return r;
+}
+
+}	// End anon namespace
+
+EntitySchema* EntitySchema::forType(const char* entitytype)
+{
+	// Entities of a type are usually constructed one after another, passing
+	// the same string literal, so remember the last schema each thread used.
+	static thread_local const char* lastType = NULL;
+	static thread_local EntitySchema* lastSchema = NULL;
+	if ( entitytype == lastType )	return lastSchema;
+
+	std::lock_guard<std::mutex> lock(registryMutex());
+	SchemaRegistry& r = registry();
+	SchemaRegistry::iterator it = r.find(entitytype);
+	if ( it == r.end() ) {
+		it = r.insert(SchemaRegistry::value_type(entitytype, new EntitySchema(entitytype))).first;
+	}
+
+	lastType = entitytype;
+	lastSchema = it->second;
+	return it->second;
+}
+
+int EntitySchema::indexOf(const char* name, uint32_t hash) const
+{
+	if ( slots_.empty() )	return -1;
+
+	size_t mask = slots_.size() - 1;
+	for ( size_t slot = hash & mask; slots_[slot] != 0; slot = (slot + 1) & mask ) {
+		const Field& f = fields_[slots_[slot] - 1];
+		if ( f.hash == hash && strcmp(f.name, name) == 0 )	return slots_[slot] - 1;
+	}
+	return -1;
+}
+
+void EntitySchema::seal()
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+	if ( sealed() )	return;
+
+	// Keep the table at most half full, so probe sequences stay short.
+	size_t size = 1;
+	while ( size < fields_.size() * 2 )	size <<= 1;
+	slots_.assign(size, 0);
+
+	for ( size_t i = 0; i < fields_.size(); ++i ) {
+		size_t slot = fields_[i].hash & (size - 1);
+		while ( slots_[slot] != 0 )	slot = (slot + 1) & (size - 1);
+		slots_[slot] = i + 1;
+	}
+
+	// FNV-1a over each name, including its terminator, and kind.
+	uint64_t hash = 14695981039346656037ull;
+	for ( size_t i = 0; i < fields_.size(); ++i ) {
+		const char* name = fields_[i].name;
+		do {
+			hash = (hash ^ static_cast<unsigned char>(*name)) * 1099511628211ull;
+		} while ( *name++ );
+		hash = (hash ^ static_cast<unsigned char>(fields_[i].kind)) * 1099511628211ull;
+	}
+	fingerprint_ = hash;
+
+	sealed_.store(true, std::memory_order_release);
+}
+
+void EntitySchema::addField(size_t index, const char* name, PrimitiveKind kind, ptrdiff_t offset) throw(Entception&)
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+
+	// Another instance being constructed at the same time may have got here
+	// first, in which case its property must be the same.
+	if ( index < fields_.size() ) {
+		const Field& f = fields_[index];
+		if ( f.offset != offset || f.kind != kind || strcmp(f.name, name) != 0 ) {
+			throw Entception("Entity's properties differ from those of others of its type");
+		}
+		return;
+	}
+
+	if ( index >= MAX_PROPERTIES ) {
+		throw Entception("Entity has too many properties");
+	}
+
+	Field f;
+	f.name = name;
+	f.hash = propertyNameHash(name);
+	f.kind = kind;
+	f.offset = offset;
+	fields_.push_back(f);
+}
+
+void EntitySchema::setPrimaryKey(ptrdiff_t offset)
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+
+	for ( size_t i = 0; i < fields_.size(); ++i ) {
+		if ( fields_[i].offset == offset )	key_ = i;
+	}
+}
+
+}	// End namespace ent
+}	// End namespace tdk
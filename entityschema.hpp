@@ -0,0 +1,155 @@
+#ifndef ENTITY_SCHEMA_HPP
+#define ENTITY_SCHEMA_HPP
+/*! \file	entityschema.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "abstractproperty.hpp"
+#include "entception.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! FNV-1a hash of a property name. This can be evaluated at compile time, so
+ * the hash of a name that is known in advance costs nothing at run time.
+ */
+constexpr uint32_t propertyNameHash(const char* name, uint32_t hash = 2166136261u)
+{
+	return *name ? propertyNameHash(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 16777619u) : hash;
+}
+
+/*! A property name along with its hash. Declaring these as constexpr has the
+ * hash computed at compile time, for the fastest lookups by name.
+ *
+ * ~~~{.cpp}
+ * static constexpr PropertyName AGE("age");
+ * AbstractProperty* age = ent[AGE];
+ * ~~~
+ */
+struct PropertyName
+{
+	constexpr PropertyName(const char* n) : name(n), hash(propertyNameHash(n)) {}
+	const char* name;
+	uint32_t hash;
+};
+
+/*! The schema of an entity type holds everything about its properties that is
+ * the same for every instance: their names, primitive kinds, and where each
+ * property lives within the entity object. Entities only hold the values of
+ * their properties, and a pointer to the schema of their type.
+ *
+ * There is one schema per entity type, which is built by the first instance
+ * of the type to be constructed, as its properties register themselves.
+ * It is sealed once any instance is used after construction, after which
+ * constructing further instances does not touch it. All entities with the
+ * same entity type name must therefore have the same properties, constructed
+ * in the same order.
+ *
+ * Schemas live until the end of the program.
+ */
+class EntitySchema
+{
+public:
+	/*! Get the schema of an entity type, creating an empty one if the type has
+	 * not been seen before.
+	 *
+	 * \param	entitytype	Name of the entity type. This must be valid for the
+	 *			life of the program, so string literals are recommended.
+	 */
+	static EntitySchema* forType(const char* entitytype);
+
+	/*! Get the name of the entity type. */
+	const char* entitytype() const { return entitytype_; }
+
+	/*! Get the number of properties of the entity type. */
+	size_t size() const { return fields_.size(); }
+
+	/*! Get the name of the property at an index. */
+	const char* name(size_t i) const { return fields_[i].name; }
+
+	/*! Get the primitive kind the property at an index is visited as. */
+	PrimitiveKind kind(size_t i) const { return fields_[i].kind; }
+
+	/*! Get the offset of the property at an index from the start of the
+	 * Entity base of the entity object.
+	 */
+	ptrdiff_t offset(size_t i) const { return fields_[i].offset; }
+
+	/*! Get the index of the entity's primary key.
+	 * \retval	-1	The entity type has no primary key.
+	 */
+	int primaryKey() const { return key_; }
+
+	/*! Get the index of the property with the given name. The names are
+	 * indexed by hash when the schema is sealed, so this costs one hash of
+	 * the name and usually a single comparison.
+	 * \retval	-1	No property has the name.
+	 */
+	int indexOf(const char* name) const { return indexOf(name, propertyNameHash(name)); }
+	int indexOf(const PropertyName& pn) const { return indexOf(pn.name, pn.hash); }
+	int indexOf(const char* name, uint32_t hash) const;
+
+	/*! Get a hash of the names and primitive kinds of the properties, in
+	 * order. Entity types with the same properties have the same fingerprint,
+	 * whatever their names. Only valid once the schema is sealed.
+	 */
+	uint64_t fingerprint() const { return fingerprint_; }
+
+	/*! Whether or not the schema is complete. */
+	bool sealed() const { return sealed_.load(std::memory_order_acquire); }
+
+private:
+	struct Field {
+		const char* name;
+		uint32_t hash;
+		PrimitiveKind kind;
+		ptrdiff_t offset;
+	};
+
+	EntitySchema(const char* entitytype) : entitytype_(entitytype), key_(-1), fingerprint_(0), sealed_(false) {}
+
+	/*! Record the property at an index, if it has not been recorded by another
+	 * instance already. Only called while the schema is not sealed.
+	 * \throws	Entception	If the entity type has too many properties, or
+	 *			another instance recorded a different property at the index.
+	 */
+	void addField(size_t index, const char* name, PrimitiveKind kind, ptrdiff_t offset) throw(Entception&);
+
+	/*! Record the index of the primary key. Only called while the schema is
+	 * not sealed.
+	 */
+	void setPrimaryKey(ptrdiff_t offset);
+
+	/*! Mark the schema as complete, build the index of the property names
+	 * and compute the fingerprint.
+	 * Called once an instance of the entity type is known to be fully
+	 * constructed.
+	 */
+	void seal();
+
+	EntitySchema(const EntitySchema&);
+	EntitySchema& operator = (const EntitySchema&);
+
+	const char* entitytype_;
+	std::vector<Field> fields_;
+	// Open addressed hash table of the names. Each slot holds a field index
+	// plus one, with zero for an empty slot. The size is a power of two.
+	std::vector<unsigned char> slots_;
+	int key_;
+	uint64_t fingerprint_;
+	std::atomic<bool> sealed_;
+
+	// The schema is built by entities as they are constructed.
+	friend class Entity;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
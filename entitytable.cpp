@@ -0,0 +1,699 @@
+/*! \file	entitytable.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <limits>
+
+#include "entitytable.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ENT_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+/*! Compare values a row at a time, for the columns and the rows that are not
+ * compared with SSE2.
+ */
+template <typename T, typename V>
+void compareValues(const T* col, size_t n, Comparison op, V v, uint8_t* out)
+{
+	switch ( op ) {
+	case COMPARE_EQ:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] == v;	break;
+	case COMPARE_NE:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] != v;	break;
+	case COMPARE_LT:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] < v;	break;
+	case COMPARE_LE:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] <= v;	break;
+	case COMPARE_GT:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] > v;	break;
+	case COMPARE_GE:	for ( size_t i = 0; i < n; ++i )	out[i] = col[i] >= v;	break;
+	}
+}
+
+template <typename T, typename V>
+void betweenValues(const T* col, size_t n, V low, V high, uint8_t* out)
+{
+	for ( size_t i = 0; i < n; ++i ) {
+		out[i] = (col[i] >= low) & (col[i] <= high);
+	}
+}
+
+template <typename T, typename Sum>
+void aggregateValues(const T* col, size_t n, const uint8_t* mask, Sum& sum, T& min, T& max, size_t& count)
+{
+	for ( size_t i = 0; i < n; ++i ) {
+		if ( mask && !mask[i] )	continue;
+		T x = col[i];
+		sum += x;
+		min = x < min ? x : min;
+		max = x > max ? x : max;
+		++count;
+	}
+}
+
+/*! Get an int equal to a number, if there is one. */
+bool asInt(int64_t v, int& i)
+{
+	if ( v < INT_MIN || v > INT_MAX )	return false;
+	i = static_cast<int>(v);
+	return true;
+}
+
+bool asInt(double d, int& i)
+{
+	if ( !(d >= INT_MIN && d <= INT_MAX) || d != floor(d) )	return false;
+	i = static_cast<int>(d);
+	return true;
+}
+
+#ifdef ENT_TABLE_SSE2
+
+/*! Narrow 16 int32 lanes of all ones or all zeros to 16 bytes of 1 or 0. */
+inline void storeMask(uint8_t* out, __m128i a, __m128i b, __m128i c, __m128i d, bool negate)
+{
+	__m128i m = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+	__m128i one = _mm_set1_epi8(1);
+	m = negate ? _mm_andnot_si128(m, one) : _mm_and_si128(m, one);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), m);
+}
+
+/*! Narrow the 64 bit lanes of two comparisons of doubles to four int32 lanes. */
+inline __m128i narrow(__m128d a, __m128d b)
+{
+	return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(a), _mm_castpd_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+inline __m128i load(const int* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+/*! Widen 4 bytes of a mask to int32 lanes of all ones or all zeros. */
+inline __m128i laneMask32(const uint8_t* mask)
+{
+	int32_t bytes;
+	memcpy(&bytes, mask, sizeof(bytes));
+	__m128i m = _mm_cvtsi32_si128(bytes);
+	m = _mm_unpacklo_epi8(m, m);
+	m = _mm_unpacklo_epi16(m, m);
+	return _mm_cmpgt_epi32(m, _mm_setzero_si128());
+}
+
+/*! Widen 2 bytes of a mask to 64 bit lanes of all ones or all zeros. */
+inline __m128i laneMask64(const uint8_t* mask)
+{
+	__m128i m = _mm_cvtsi32_si128(mask[0] | (mask[1] << 8));
+	m = _mm_unpacklo_epi8(m, m);
+	m = _mm_unpacklo_epi16(m, m);
+	m = _mm_unpacklo_epi32(m, m);
+	return _mm_cmpgt_epi32(m, _mm_setzero_si128());
+}
+
+struct IntEq { static __m128i cmp(__m128i x, __m128i v) { return _mm_cmpeq_epi32(x, v); } };
+struct IntLt { static __m128i cmp(__m128i x, __m128i v) { return _mm_cmplt_epi32(x, v); } };
+struct IntGt { static __m128i cmp(__m128i x, __m128i v) { return _mm_cmpgt_epi32(x, v); } };
+
+template <typename Cmp>
+size_t compareInts(const int* col, size_t n, int v, bool negate, uint8_t* out)
+{
+	__m128i vv = _mm_set1_epi32(v);
+	size_t i = 0;
+	for ( ; i + 16 <= n; i += 16 ) {
+		storeMask(out + i, Cmp::cmp(load(col + i), vv), Cmp::cmp(load(col + i + 4), vv),
+				Cmp::cmp(load(col + i + 8), vv), Cmp::cmp(load(col + i + 12), vv), negate);
+	}
+	return i;
+}
+
+/*! Compare the ints of a column 16 at a time.
+ * \return	The number of rows compared, leaving fewer than 16.
+ */
+size_t compareInts(const int* col, size_t n, Comparison op, int v, uint8_t* out)
+{
+	// NE, LE and GE are the inverse of EQ, GT and LT.
+	switch ( op ) {
+	case COMPARE_EQ:	return compareInts<IntEq>(col, n, v, false, out);
+	case COMPARE_NE:	return compareInts<IntEq>(col, n, v, true, out);
+	case COMPARE_LT:	return compareInts<IntLt>(col, n, v, false, out);
+	case COMPARE_LE:	return compareInts<IntGt>(col, n, v, true, out);
+	case COMPARE_GT:	return compareInts<IntGt>(col, n, v, false, out);
+	case COMPARE_GE:	return compareInts<IntLt>(col, n, v, true, out);
+	}
+	return 0;
+}
+
+size_t betweenInts(const int* col, size_t n, int low, int high, uint8_t* out)
+{
+	__m128i lo = _mm_set1_epi32(low);
+	__m128i hi = _mm_set1_epi32(high);
+	size_t i = 0;
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128i outside[4];
+		for ( int j = 0; j < 4; ++j ) {
+			__m128i x = load(col + i + j * 4);
+			outside[j] = _mm_or_si128(_mm_cmplt_epi32(x, lo), _mm_cmpgt_epi32(x, hi));
+		}
+		storeMask(out + i, outside[0], outside[1], outside[2], outside[3], true);
+	}
+	return i;
+}
+
+struct DoubleEq { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmpeq_pd(x, v); } };
+struct DoubleNe { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmpneq_pd(x, v); } };
+struct DoubleLt { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmplt_pd(x, v); } };
+struct DoubleLe { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmple_pd(x, v); } };
+struct DoubleGt { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmpgt_pd(x, v); } };
+struct DoubleGe { static __m128d cmp(__m128d x, __m128d v) { return _mm_cmpge_pd(x, v); } };
+
+template <typename Cmp>
+size_t compareDoubles(const double* col, size_t n, double v, uint8_t* out)
+{
+	__m128d vv = _mm_set1_pd(v);
+	size_t i = 0;
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128i lanes[4];
+		for ( int j = 0; j < 4; ++j ) {
+			const double* p = col + i + j * 4;
+			lanes[j] = narrow(Cmp::cmp(_mm_loadu_pd(p), vv), Cmp::cmp(_mm_loadu_pd(p + 2), vv));
+		}
+		storeMask(out + i, lanes[0], lanes[1], lanes[2], lanes[3], false);
+	}
+	return i;
+}
+
+/*! Compare the doubles of a column 16 at a time. Unlike ints, NE, LE and GE
+ * are not the inverse of other comparisons, as nothing compares to NaN.
+ * \return	The number of rows compared, leaving fewer than 16.
+ */
+size_t compareDoubles(const double* col, size_t n, Comparison op, double v, uint8_t* out)
+{
+	switch ( op ) {
+	case COMPARE_EQ:	return compareDoubles<DoubleEq>(col, n, v, out);
+	case COMPARE_NE:	return compareDoubles<DoubleNe>(col, n, v, out);
+	case COMPARE_LT:	return compareDoubles<DoubleLt>(col, n, v, out);
+	case COMPARE_LE:	return compareDoubles<DoubleLe>(col, n, v, out);
+	case COMPARE_GT:	return compareDoubles<DoubleGt>(col, n, v, out);
+	case COMPARE_GE:	return compareDoubles<DoubleGe>(col, n, v, out);
+	}
+	return 0;
+}
+
+size_t betweenDoubles(const double* col, size_t n, double low, double high, uint8_t* out)
+{
+	__m128d lo = _mm_set1_pd(low);
+	__m128d hi = _mm_set1_pd(high);
+	size_t i = 0;
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128i lanes[4];
+		for ( int j = 0; j < 4; ++j ) {
+			__m128d a = _mm_loadu_pd(col + i + j * 4);
+			__m128d b = _mm_loadu_pd(col + i + j * 4 + 2);
+			lanes[j] = narrow(_mm_and_pd(_mm_cmpge_pd(a, lo), _mm_cmple_pd(a, hi)),
+					_mm_and_pd(_mm_cmpge_pd(b, lo), _mm_cmple_pd(b, hi)));
+		}
+		storeMask(out + i, lanes[0], lanes[1], lanes[2], lanes[3], false);
+	}
+	return i;
+}
+
+/*! Aggregate the ints of a column 4 at a time.
+ * \return	The number of rows aggregated, leaving fewer than 4.
+ */
+size_t aggregateInts(const int* col, size_t n, const uint8_t* mask, int64_t& sum, int& min, int& max, size_t& count)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i all = _mm_set1_epi32(-1);
+	__m128i intMax = _mm_set1_epi32(INT_MAX);
+	__m128i intMin = _mm_set1_epi32(INT_MIN);
+	__m128i vsum = zero;
+	__m128i vmin = intMax;
+	__m128i vmax = intMin;
+	__m128i vcount = zero;
+
+	size_t i = 0;
+	for ( ; i + 4 <= n; i += 4 ) {
+		__m128i sel = mask ? laneMask32(mask + i) : all;
+		__m128i x = _mm_and_si128(load(col + i), sel);
+
+		// Sign extend to 64 bits to sum.
+		__m128i sign = _mm_cmpgt_epi32(zero, x);
+		vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(x, sign));
+		vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(x, sign));
+
+		// Rows that are not selected take the value that changes nothing.
+		__m128i lo = _mm_or_si128(x, _mm_andnot_si128(sel, intMax));
+		__m128i lt = _mm_cmplt_epi32(lo, vmin);
+		vmin = _mm_or_si128(_mm_and_si128(lt, lo), _mm_andnot_si128(lt, vmin));
+		__m128i hi = _mm_or_si128(x, _mm_andnot_si128(sel, intMin));
+		__m128i gt = _mm_cmpgt_epi32(hi, vmax);
+		vmax = _mm_or_si128(_mm_and_si128(gt, hi), _mm_andnot_si128(gt, vmax));
+
+		vcount = _mm_sub_epi32(vcount, sel);
+	}
+
+	int64_t sums[2];
+	int mins[4], maxs[4], counts[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), vsum);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(counts), vcount);
+	sum += sums[0] + sums[1];
+	for ( int j = 0; j < 4; ++j ) {
+		min = mins[j] < min ? mins[j] : min;
+		max = maxs[j] > max ? maxs[j] : max;
+		count += static_cast<unsigned int>(counts[j]);
+	}
+	return i;
+}
+
+/*! Aggregate the doubles of a column 2 at a time.
+ * \return	The number of rows aggregated, leaving fewer than 2.
+ */
+size_t aggregateDoubles(const double* col, size_t n, const uint8_t* mask, double& sum, double& min, double& max, size_t& count)
+{
+	__m128i all = _mm_set1_epi32(-1);
+	__m128d inf = _mm_set1_pd(numeric_limits<double>::infinity());
+	__m128d negInf = _mm_set1_pd(-numeric_limits<double>::infinity());
+	__m128d vsum = _mm_setzero_pd();
+	__m128d vmin = inf;
+	__m128d vmax = negInf;
+	__m128i vcount = _mm_setzero_si128();
+
+	size_t i = 0;
+	for ( ; i + 2 <= n; i += 2 ) {
+		__m128i sel = mask ? laneMask64(mask + i) : all;
+		__m128d selpd = _mm_castsi128_pd(sel);
+		__m128d x = _mm_and_pd(_mm_loadu_pd(col + i), selpd);
+		vsum = _mm_add_pd(vsum, x);
+		vmin = _mm_min_pd(_mm_or_pd(x, _mm_andnot_pd(selpd, inf)), vmin);
+		vmax = _mm_max_pd(_mm_or_pd(x, _mm_andnot_pd(selpd, negInf)), vmax);
+		vcount = _mm_sub_epi64(vcount, sel);
+	}
+
+	double sums[2], mins[2], maxs[2];
+	int64_t counts[2];
+	_mm_storeu_pd(sums, vsum);
+	_mm_storeu_pd(mins, vmin);
+	_mm_storeu_pd(maxs, vmax);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(counts), vcount);
+	sum += sums[0] + sums[1];
+	for ( int j = 0; j < 2; ++j ) {
+		min = mins[j] < min ? mins[j] : min;
+		max = maxs[j] > max ? maxs[j] : max;
+		count += counts[j];
+	}
+	return i;
+}
+
+#else
+
+size_t compareInts(const int*, size_t, Comparison, int, uint8_t*) { return 0; }
+size_t betweenInts(const int*, size_t, int, int, uint8_t*) { return 0; }
+size_t compareDoubles(const double*, size_t, Comparison, double, uint8_t*) { return 0; }
+size_t betweenDoubles(const double*, size_t, double, double, uint8_t*) { return 0; }
+
+size_t aggregateInts(const int*, size_t, const uint8_t*, int64_t&, int&, int&, size_t&) { return 0; }
+size_t aggregateDoubles(const double*, size_t, const uint8_t*, double&, double&, double&, size_t&) { return 0; }
+
+#endif
+
+/*! Filters a column by comparing it with a number. */
+template <typename V>
+struct CompareKernel
+{
+	CompareKernel(size_t rows, Comparison c, V value, uint8_t* mask) : n(rows), op(c), v(value), out(mask) {}
+
+	template <typename T>
+	void operator () (const T* col) { compareValues(col, n, op, v, out); }
+
+	void operator () (const int* col) {
+		int i;
+		if ( !asInt(v, i) ) {
+			compareValues(col, n, op, v, out);
+			return;
+		}
+		size_t done = compareInts(col, n, op, i, out);
+		compareValues(col + done, n - done, op, i, out + done);
+	}
+
+	void operator () (const double* col) {
+		double d = static_cast<double>(v);
+		size_t done = compareDoubles(col, n, op, d, out);
+		compareValues(col + done, n - done, op, d, out + done);
+	}
+
+	size_t n;
+	Comparison op;
+	V v;
+	uint8_t* out;
+};
+
+/*! Filters a column by whether it is between two numbers. */
+template <typename V>
+struct BetweenKernel
+{
+	BetweenKernel(size_t rows, V l, V h, uint8_t* mask) : n(rows), low(l), high(h), out(mask) {}
+
+	template <typename T>
+	void operator () (const T* col) { betweenValues(col, n, low, high, out); }
+
+	void operator () (const int* col) {
+		int lo, hi;
+		if ( !asInt(low, lo) || !asInt(high, hi) ) {
+			betweenValues(col, n, low, high, out);
+			return;
+		}
+		size_t done = betweenInts(col, n, lo, hi, out);
+		betweenValues(col + done, n - done, lo, hi, out + done);
+	}
+
+	void operator () (const double* col) {
+		double lo = static_cast<double>(low), hi = static_cast<double>(high);
+		size_t done = betweenDoubles(col, n, lo, hi, out);
+		betweenValues(col + done, n - done, lo, hi, out + done);
+	}
+
+	size_t n;
+	V low;
+	V high;
+	uint8_t* out;
+};
+
+struct AggregateKernel
+{
+	AggregateKernel(size_t rows, const uint8_t* m) : n(rows), mask(m) {
+		result.count = 0;
+		result.sum = 0;
+		result.min = 0;
+		result.max = 0;
+	}
+
+	template <typename T>
+	void operator () (const T* col) {
+		int64_t sum = 0;
+		T min = numeric_limits<T>::max(), max = numeric_limits<T>::lowest();
+		aggregateValues(col, n, mask, sum, min, max, result.count);
+		done(static_cast<double>(sum), min, max);
+	}
+
+	void operator () (const int* col) {
+		int64_t sum = 0;
+		int min = INT_MAX, max = INT_MIN;
+		size_t i = aggregateInts(col, n, mask, sum, min, max, result.count);
+		aggregateValues(col + i, n - i, mask ? mask + i : NULL, sum, min, max, result.count);
+		done(static_cast<double>(sum), min, max);
+	}
+
+	void operator () (const double* col) {
+		double sum = 0;
+		double min = numeric_limits<double>::infinity(), max = -numeric_limits<double>::infinity();
+		size_t i = aggregateDoubles(col, n, mask, sum, min, max, result.count);
+		aggregateValues(col + i, n - i, mask ? mask + i : NULL, sum, min, max, result.count);
+		done(sum, min, max);
+	}
+
+	template <typename T>
+	void done(double sum, T min, T max) {
+		result.sum = sum;
+		if ( result.count ) {
+			result.min = static_cast<double>(min);
+			result.max = static_cast<double>(max);
+		}
+	}
+
+	size_t n;
+	const uint8_t* mask;
+	ColumnAggregate result;
+};
+
+}	// End anon namespace
+
+template <typename Kernel>
+bool ColumnTable::dispatch(const Column& col, Kernel& k)
+{
+	switch ( col.kind ) {
+	case PRIMITIVE_BOOL:
+	case PRIMITIVE_CHAR:	k(static_cast<const TypedColumn<char>&>(col).values.data());			return true;
+	case PRIMITIVE_INT:		k(static_cast<const TypedColumn<int>&>(col).values.data());				return true;
+	case PRIMITIVE_UINT:	k(static_cast<const TypedColumn<unsigned int>&>(col).values.data());	return true;
+	case PRIMITIVE_INT64:	k(static_cast<const TypedColumn<int64_t>&>(col).values.data());			return true;
+	case PRIMITIVE_DOUBLE:	k(static_cast<const TypedColumn<double>&>(col).values.data());			return true;
+	case PRIMITIVE_STRING:
+	case PRIMITIVE_BLOB:
+		break;
+	}
+	return false;
+}
+
+RowMask& RowMask::operator &= (const RowMask& other)
+{
+	size_t n = rows_.size() < other.rows_.size() ? rows_.size() : other.rows_.size();
+	uint8_t* a = rows_.data();
+	const uint8_t* b = other.rows_.data();
+	size_t i = 0;
+#ifdef ENT_TABLE_SSE2
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128i* p = reinterpret_cast<__m128i*>(a + i);
+		_mm_storeu_si128(p, _mm_and_si128(_mm_loadu_si128(p), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+	}
+#endif
+	for ( ; i < n; ++i ) {
+		a[i] &= b[i];
+	}
+	return *this;
+}
+
+RowMask& RowMask::operator |= (const RowMask& other)
+{
+	size_t n = rows_.size() < other.rows_.size() ? rows_.size() : other.rows_.size();
+	uint8_t* a = rows_.data();
+	const uint8_t* b = other.rows_.data();
+	size_t i = 0;
+#ifdef ENT_TABLE_SSE2
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128i* p = reinterpret_cast<__m128i*>(a + i);
+		_mm_storeu_si128(p, _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+	}
+#endif
+	for ( ; i < n; ++i ) {
+		a[i] |= b[i];
+	}
+	return *this;
+}
+
+RowMask& RowMask::invert()
+{
+	for ( size_t i = 0; i < rows_.size(); ++i ) {
+		rows_[i] ^= 1;
+	}
+	return *this;
+}
+
+size_t RowMask::count() const
+{
+	const uint8_t* a = rows_.data();
+	size_t n = rows_.size();
+	size_t count = 0;
+	size_t i = 0;
+#ifdef ENT_TABLE_SSE2
+	// Sum the bytes 16 at a time in to two 64 bit lanes.
+	__m128i sums = _mm_setzero_si128();
+	for ( ; i + 16 <= n; i += 16 ) {
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_setzero_si128()));
+	}
+	int64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+	count = lanes[0] + lanes[1];
+#endif
+	for ( ; i < n; ++i ) {
+		count += a[i];
+	}
+	return count;
+}
+
+void RowMask::selected(std::vector<size_t>& rows) const
+{
+	for ( size_t i = 0; i < rows_.size(); ++i ) {
+		if ( rows_[i] )	rows.push_back(i);
+	}
+}
+
+ColumnTable::ColumnTable(const EntitySchema& schema) : schema_(schema), rows_(0)
+{
+	columns_.reserve(schema.size());
+	for ( size_t i = 0; i < schema.size(); ++i ) {
+		switch ( schema.kind(i) ) {
+		case PRIMITIVE_BOOL:
+		case PRIMITIVE_CHAR:	columns_.push_back(new TypedColumn<char>());			break;
+		case PRIMITIVE_INT:		columns_.push_back(new TypedColumn<int>());				break;
+		case PRIMITIVE_UINT:	columns_.push_back(new TypedColumn<unsigned int>());	break;
+		case PRIMITIVE_INT64:	columns_.push_back(new TypedColumn<int64_t>());			break;
+		case PRIMITIVE_DOUBLE:	columns_.push_back(new TypedColumn<double>());			break;
+		case PRIMITIVE_STRING:
+		case PRIMITIVE_BLOB:	columns_.push_back(new BytesColumn(schema.kind(i)));	break;
+		}
+	}
+}
+
+ColumnTable::~ColumnTable()
+{
+	for ( size_t i = 0; i < columns_.size(); ++i ) {
+		delete columns_[i];
+	}
+}
+
+void ColumnTable::reserve(size_t rows)
+{
+	for ( size_t i = 0; i < columns_.size(); ++i ) {
+		columns_[i]->reserve(rows);
+	}
+}
+
+void ColumnTable::clear()
+{
+	for ( size_t i = 0; i < columns_.size(); ++i ) {
+		columns_[i]->clear();
+	}
+	rows_ = 0;
+}
+
+void ColumnTable::append(const Entity& ent) throw(Entception&)
+{
+	// The columns are cast to the types of the schema's properties.
+	if ( &ent.schema() != &schema_ ) {
+		throw Entception("Can not append an entity of another type to a table.");
+	}
+
+	Appender a(columns_.data());
+	forEachProperty(ent, a);
+	appended();
+}
+
+void ColumnTable::read(size_t row, Entity& ent) const throw(Entception&)
+{
+	if ( &ent.schema() != &schema_ ) {
+		throw Entception("Can not read a row in to an entity of another type.");
+	}
+	if ( row >= rows_ ) {
+		throw Entception("The row is past the end of the table.");
+	}
+
+	Loader l(columns_.data(), row);
+	forEachPropertyWrite(ent, l);
+}
+
+PrimitiveValue ColumnTable::value(size_t row, const char* property) const throw(Entception&)
+{
+	const Column& col = column(property);
+	if ( row >= rows_ ) {
+		throw Entception("The row is past the end of the table.");
+	}
+
+	PrimitiveKind kind = schema_.kind(schema_.indexOf(property));
+	switch ( col.kind ) {
+	case PRIMITIVE_BOOL:
+	case PRIMITIVE_CHAR:	return PrimitiveValue::ofInteger(kind, static_cast<const TypedColumn<char>&>(col).values[row]);
+	case PRIMITIVE_INT:		return PrimitiveValue::ofInteger(kind, static_cast<const TypedColumn<int>&>(col).values[row]);
+	case PRIMITIVE_UINT:	return PrimitiveValue::ofInteger(kind, static_cast<const TypedColumn<unsigned int>&>(col).values[row]);
+	case PRIMITIVE_INT64:	return PrimitiveValue::ofInteger(kind, static_cast<const TypedColumn<int64_t>&>(col).values[row]);
+	case PRIMITIVE_DOUBLE:	return PrimitiveValue::ofDouble(static_cast<const TypedColumn<double>&>(col).values[row]);
+	case PRIMITIVE_STRING:
+	case PRIMITIVE_BLOB:
+		break;
+	}
+
+	const BytesColumn& bytes = static_cast<const BytesColumn&>(col);
+	size_t begin = bytes.begin(row);
+	return PrimitiveValue::ofBytes(kind, bytes.bytes.data() + begin, bytes.ends[row] - begin);
+}
+
+RowMask ColumnTable::where(const char* property, Comparison op, int64_t value) const throw(Entception&)
+{
+	RowMask mask(rows_, false);
+	CompareKernel<int64_t> k(rows_, op, value, mask.data());
+	if ( !dispatch(column(property), k) )
+		throw Entception(string("Property ") + property + " is not a number.");
+	return mask;
+}
+
+RowMask ColumnTable::where(const char* property, Comparison op, double value) const throw(Entception&)
+{
+	RowMask mask(rows_, false);
+	CompareKernel<double> k(rows_, op, value, mask.data());
+	if ( !dispatch(column(property), k) )
+		throw Entception(string("Property ") + property + " is not a number.");
+	return mask;
+}
+
+RowMask ColumnTable::where(const char* property, Comparison op, const std::string& value) const throw(Entception&)
+{
+	const Column& col = column(property);
+	if ( col.kind != PRIMITIVE_STRING && col.kind != PRIMITIVE_BLOB )
+		throw Entception(string("Property ") + property + " is not a string or a blob.");
+
+	const BytesColumn& bytes = static_cast<const BytesColumn&>(col);
+	RowMask mask(rows_, false);
+	uint8_t* out = mask.data();
+	size_t begin = 0;
+	for ( size_t i = 0; i < rows_; ++i ) {
+		size_t len = bytes.ends[i] - begin;
+		int c = memcmp(bytes.bytes.data() + begin, value.data(), len < value.size() ? len : value.size());
+		if ( c == 0 )	c = len < value.size() ? -1 : len > value.size();
+		begin = bytes.ends[i];
+
+		switch ( op ) {
+		case COMPARE_EQ:	out[i] = c == 0;	break;
+		case COMPARE_NE:	out[i] = c != 0;	break;
+		case COMPARE_LT:	out[i] = c < 0;		break;
+		case COMPARE_LE:	out[i] = c <= 0;	break;
+		case COMPARE_GT:	out[i] = c > 0;		break;
+		case COMPARE_GE:	out[i] = c >= 0;	break;
+		}
+	}
+	return mask;
+}
+
+RowMask ColumnTable::between(const char* property, int64_t low, int64_t high) const throw(Entception&)
+{
+	RowMask mask(rows_, false);
+	BetweenKernel<int64_t> k(rows_, low, high, mask.data());
+	if ( !dispatch(column(property), k) )
+		throw Entception(string("Property ") + property + " is not a number.");
+	return mask;
+}
+
+RowMask ColumnTable::between(const char* property, double low, double high) const throw(Entception&)
+{
+	RowMask mask(rows_, false);
+	BetweenKernel<double> k(rows_, low, high, mask.data());
+	if ( !dispatch(column(property), k) )
+		throw Entception(string("Property ") + property + " is not a number.");
+	return mask;
+}
+
+ColumnAggregate ColumnTable::aggregate(const char* property, const RowMask* mask) const throw(Entception&)
+{
+	if ( mask && mask->size() != rows_ )
+		throw Entception("The mask is not over the rows of the table.");
+
+	AggregateKernel k(rows_, mask ? mask->data() : NULL);
+	if ( !dispatch(column(property), k) )
+		throw Entception(string("Property ") + property + " is not a number.");
+	return k.result;
+}
+
+const ColumnTable::Column& ColumnTable::column(const char* property) const throw(Entception&)
+{
+	int i = schema_.indexOf(property);
+	if ( i < 0 )
+		throw Entception(string("No property named ") + schema_.entitytype() + "." + property);
+	return *columns_[i];
+}
+
+}	// End namespace ent
+}	// End namespace tdk
@@ -0,0 +1,371 @@
+#ifndef ENTITY_TABLE_HPP
+#define ENTITY_TABLE_HPP
+/*! \file	entitytable.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "entity.hpp"
+#include "entityfields.hpp"
+#include "primitivevalue.hpp"
+#include "query.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Comparisons a filter can make between the values of a column and a value. */
+typedef enum {
+	COMPARE_EQ,
+	COMPARE_NE,
+	COMPARE_LT,
+	COMPARE_LE,
+	COMPARE_GT,
+	COMPARE_GE,
+} Comparison;
+
+/*! The rows of a table selected by a filter, as one byte per row that is 1 if
+ * the row is selected and 0 if not. Masks from filters over the same table
+ * can be combined with &= and |=.
+ */
+class RowMask
+{
+public:
+	RowMask() {}
+
+	/*! Create a mask over a number of rows, all selected or none. */
+	explicit RowMask(size_t rows, bool selected = true) : rows_(rows, selected ? 1 : 0) {}
+
+	size_t size() const { return rows_.size(); }
+
+	bool operator [] (size_t row) const { return rows_[row] != 0; }
+
+	const uint8_t* data() const { return rows_.data(); }
+	uint8_t* data() { return rows_.data(); }
+
+	/*! Keep only the rows that are also selected by another mask of the same
+	 * size.
+	 */
+	RowMask& operator &= (const RowMask& other);
+
+	/*! Add the rows that are selected by another mask of the same size. */
+	RowMask& operator |= (const RowMask& other);
+
+	/*! Select the rows that are not selected, and deselect those that are. */
+	RowMask& invert();
+
+	/*! Get the number of selected rows. */
+	size_t count() const;
+
+	/*! Append the index of every selected row to a vector, in order. */
+	void selected(std::vector<size_t>& rows) const;
+
+private:
+	std::vector<uint8_t> rows_;
+};
+
+/*! The result of aggregating a column. min and max are 0 if no rows were
+ * aggregated.
+ */
+struct ColumnAggregate
+{
+	size_t count;
+	double sum;
+	double min;
+	double max;
+};
+
+/*! Entities stored a column at a time, for scanning and aggregating many
+ * entities of one type in memory.
+ *
+ * Each property is stored as an array of its primitive values, one after
+ * another, so a filter over a property reads nothing but that property's
+ * values. Properties of enum types are stored as their int values. Strings
+ * and blobs are stored end to end in a single buffer per column.
+ *
+ * Filters over int and double columns, which include enums, compare several
+ * values at once with SSE2 where it is available, as do aggregates over those
+ * columns. Other columns are filtered and aggregated a value at a time.
+ *
+ * ~~~{.cpp}
+ * ColumnTable people(Person().schema());
+ * RowMask adults = people.where("age", COMPARE_GE, 18);
+ * adults &= people.where("gender", COMPARE_EQ, FEMALE);
+ * ColumnAggregate income = people.aggregate("income", &adults);
+ * ~~~
+ *
+ * EntityTable adds loading and appending entities of a particular type.
+ *
+ * Tables are not thread safe, although filters and aggregates do not change
+ * the table, so can be run from several threads at once.
+ */
+class ColumnTable
+{
+public:
+	/*! Create an empty table for entities with a schema. */
+	explicit ColumnTable(const EntitySchema& schema);
+	virtual ~ColumnTable();
+
+	const EntitySchema& schema() const { return schema_; }
+
+	/*! Get the number of rows. */
+	size_t size() const { return rows_; }
+
+	/*! Make room for a number of rows without reallocating the columns. */
+	void reserve(size_t rows);
+
+	/*! Remove every row. */
+	void clear();
+
+	/*! Append the values of an entity's properties as a new row.
+	 * \throws	Entception	If the entity does not have the schema of the table.
+	 */
+	void append(const Entity& ent) throw(Entception&);
+
+	/*! Assign the values of a row to an entity's properties. As with a load,
+	 * the properties are not marked as dirty. View properties such as
+	 * Property<StringPrimitive> point in to the table, and are valid until
+	 * it is next changed.
+	 * \throws	Entception	If the entity does not have the schema of the table,
+	 *			or the row is past the end of it.
+	 */
+	void read(size_t row, Entity& ent) const throw(Entception&);
+
+	/*! Get the value of a property in a row.
+	 * \throws	Entception	If there is no such property, or the row is past the
+	 *			end of the table.
+	 */
+	PrimitiveValue value(size_t row, const char* property) const throw(Entception&);
+
+	/*! Get the values of an int, unsigned int, int64_t or double column, one
+	 * per row. Bool columns are stored as char. The pointer is valid until
+	 * the table is next changed.
+	 * \throws	Entception	If there is no such property, or it is stored as
+	 *			another type.
+	 */
+	template <typename T>
+	const T* values(const char* property) const throw(Entception&) {
+		const Column& col = column(property);
+		if ( col.kind != PrimitiveKindOf<T>::value )
+			throw Entception("The column is not stored as the requested type.");
+		return static_cast<const TypedColumn<T>&>(col).values.data();
+	}
+
+	/*! Select the rows whose value of a property compares to a number.
+	 * Numbers are compared by value, whatever the type of the column.
+	 * \throws	Entception	If there is no such property, or it is a string or
+	 *			a blob.
+	 */
+	RowMask where(const char* property, Comparison op, int value) const throw(Entception&) {
+		return where(property, op, static_cast<int64_t>(value));
+	}
+	RowMask where(const char* property, Comparison op, int64_t value) const throw(Entception&);
+	RowMask where(const char* property, Comparison op, double value) const throw(Entception&);
+
+	/*! Select the rows whose value of a string or blob property compares to
+	 * some bytes, in the order of memcmp.
+	 * \throws	Entception	If there is no such property, or it is a number.
+	 */
+	RowMask where(const char* property, Comparison op, const std::string& value) const throw(Entception&);
+
+	/*! Select the rows whose value of a property is between two numbers,
+	 * inclusive.
+	 */
+	RowMask between(const char* property, int low, int high) const throw(Entception&) {
+		return between(property, static_cast<int64_t>(low), static_cast<int64_t>(high));
+	}
+	RowMask between(const char* property, int64_t low, int64_t high) const throw(Entception&);
+	RowMask between(const char* property, double low, double high) const throw(Entception&);
+
+	/*! Count, sum and find the smallest and largest values of a number
+	 * property, over every row or the rows selected by a mask.
+	 * \throws	Entception	If there is no such property, or it is a string or
+	 *			a blob, or the mask is of another size.
+	 */
+	ColumnAggregate aggregate(const char* property, const RowMask* mask = NULL) const throw(Entception&);
+
+protected:
+	/*! The values of a property. */
+	struct Column {
+		Column(PrimitiveKind k) : kind(k) {}
+		virtual ~Column() {}
+		virtual void reserve(size_t rows) = 0;
+		virtual void clear() = 0;
+		PrimitiveKind kind;	// Kind the values are stored as, which is char for bools.
+	};
+
+	template <typename T>
+	struct TypedColumn : public Column {
+		TypedColumn() : Column(PrimitiveKindOf<T>::value) {}
+		virtual void reserve(size_t rows) { values.reserve(rows); }
+		virtual void clear() { values.clear(); }
+		std::vector<T> values;
+	};
+
+	/*! Strings or blobs, stored end to end. */
+	struct BytesColumn : public Column {
+		BytesColumn(PrimitiveKind k) : Column(k) {}
+		virtual void reserve(size_t rows) { ends.reserve(rows); }
+		virtual void clear() { bytes.clear(); ends.clear(); }
+
+		void push(const void* data, size_t len) {
+			if ( len )	bytes.append(static_cast<const char*>(data), len);
+			ends.push_back(bytes.size());
+		}
+
+		size_t begin(size_t row) const { return row ? ends[row - 1] : 0; }
+
+		std::string bytes;
+		std::vector<size_t> ends;	// End of each row's value in bytes.
+	};
+
+	/*! Appends the values of an entity's properties to the columns. */
+	struct Appender {
+		Appender(Column* const* c) : col(c) {}
+
+		bool visit(const bool& b) { return push(static_cast<char>(b)); }
+		bool visit(const StringPrimitive& str) { return bytes(str.data(), str.len()); }
+		bool visit(const BlobPrimitive& blob) { return bytes(blob.data(), blob.len()); }
+
+		template <typename T>
+		bool visit(const T& v) { return push(v); }
+
+		template <typename T>
+		bool push(const T& v) {
+			static_cast<TypedColumn<T>*>(*col++)->values.push_back(v);
+			return true;
+		}
+
+		bool bytes(const void* data, size_t len) {
+			static_cast<BytesColumn*>(*col++)->push(data, len);
+			return true;
+		}
+
+		Column* const* col;
+	};
+
+	/*! Assigns the values of a row to an entity's properties. */
+	struct Loader {
+		Loader(Column* const* c, size_t r) : col(c), row(r) {}
+
+		void visit(bool& b) { b = get<char>() != 0; }
+		void visit(StringPrimitive& str) {
+			const BytesColumn& c = bytes();
+			str = StringPrimitive(c.bytes.data() + c.begin(row), c.ends[row] - c.begin(row));
+		}
+		void visit(BlobPrimitive& blob) {
+			const BytesColumn& c = bytes();
+			blob = BlobPrimitive(c.bytes.data() + c.begin(row), c.ends[row] - c.begin(row));
+		}
+
+		template <typename T>
+		void visit(T& v) { v = get<T>(); }
+
+		template <typename T>
+		T get() { return static_cast<const TypedColumn<T>*>(*col++)->values[row]; }
+
+		const BytesColumn& bytes() { return *static_cast<const BytesColumn*>(*col++); }
+
+		Column* const* col;
+		size_t row;
+	};
+
+	/*! Count the row most recently added to the columns. */
+	void appended() { ++rows_; }
+
+	Column* const* columns() const { return columns_.data(); }
+
+private:
+	const Column& column(const char* property) const throw(Entception&);
+
+	/*! Call a kernel with the values of a number column.
+	 * \return	Whether or not the column holds numbers.
+	 */
+	template <typename Kernel>
+	static bool dispatch(const Column& col, Kernel& k);
+
+	ColumnTable(const ColumnTable&);
+	ColumnTable& operator = (const ColumnTable&);
+
+	const EntitySchema& schema_;
+	std::vector<Column*> columns_;
+	size_t rows_;
+};
+
+/*! A ColumnTable of entities of a single type, which can be filled from a
+ * query or a cursor and read back in to entities. Entity types described by
+ * EntityFields are appended and read without virtual calls.
+ *
+ * ~~~{.cpp}
+ * EntityTable<Person> people;
+ * Query<Person> q = factory.query<Person>(criteria);
+ * people.load(q);
+ * RowMask adults = people.where("age", COMPARE_GE, 18);
+ * ~~~
+ *
+ * \tparam	Ent		Entity type to store. It must be default constructible.
+ */
+template <typename Ent>
+class EntityTable : public ColumnTable
+{
+public:
+	EntityTable() : ColumnTable(schemaOf()) {}
+
+	/*! Append the values of an entity's properties as a new row. */
+	void append(const Ent& ent) {
+		Appender a(columns());
+		forEachProperty(ent, a);
+		appended();
+	}
+
+	/*! Append every remaining entity of a query.
+	 * \return	The number of rows appended.
+	 */
+	size_t load(Query<Ent>& query) throw(Entception&) {
+		size_t n = 0;
+		for ( ; query.next(); ++n ) {
+			append(query.entity());
+		}
+		return n;
+	}
+
+	/*! Append every remaining row of a cursor opened with an entity of this
+	 * type.
+	 * \return	The number of rows appended.
+	 */
+	size_t load(PersistenceCursor& cursor) throw(Entception&) {
+		Ent ent;
+		size_t n = 0;
+		for ( ; cursor.step(); ++n ) {
+			cursor.read(ent);
+			append(ent);
+		}
+		return n;
+	}
+
+	/*! Assign the values of a row to an entity.
+	 * \see	ColumnTable::read
+	 */
+	void read(size_t row, Ent& ent) const throw(Entception&) {
+		if ( row >= size() ) {
+			throw Entception("The row is past the end of the table.");
+		}
+		Loader l(columns(), row);
+		forEachPropertyWrite(ent, l);
+	}
+
+private:
+	static const EntitySchema& schemaOf() {
+		Ent ent;
+		return ent.schema();
+	}
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
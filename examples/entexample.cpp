@@ -86,6 +86,8 @@ private:
 	virtual void installPersistenceApi(Entity* e) {
 		e->setPersistence(&pers);
 	}
+
+	virtual PersistenceApi& persistenceApi() { return pers; }
 	
 	FlatFilePersistenceApi pers;
 };
@@ -0,0 +1,42 @@
+#ifndef LOG_ENTITY_FACTORY_HPP
+#define LOG_ENTITY_FACTORY_HPP
+/*! \file	logentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "entities/entityfactory.hpp"
+#include "entities/factories/logpersistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that installs a log file persistence API in to the entities
+ * it creates.
+ *
+ * \see	LogPersistenceApi
+ */
+class LogEntityFactory : public EntityFactory
+{
+public:
+	/*! Open a log file entity factory.
+	 * \see	LogPersistenceApi::LogPersistenceApi
+	 * \throw	Entception	If the log file can not be opened.
+	 */
+	LogEntityFactory(const char* logFile, bool syncWrites = false,
+			double garbageRatio = LogPersistenceApi::DEFAULT_GARBAGE_RATIO) throw(Entception&)
+		: persistence_(logFile, syncWrites, garbageRatio) {}
+
+	/*! Get the persistence, to compact it or get its stats. */
+	LogPersistenceApi& persistence() { return persistence_; }
+
+private:
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(&persistence_); }
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
+	LogPersistenceApi persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,1006 @@
+/*! \file	logpersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "logpersistenceapi.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+/* The log starts with a magic number, followed by records of:
+ *
+ *     u32 body length, u32 checksum of the body
+ *     u8 op, u8 flags
+ *     u16 entity type length, entity type
+ *     value of the primary key
+ *     for OP_PUT only: u16 column count, value of each column
+ *
+ * A COMMIT record has only the op and flags. Values are a u8 PrimitiveKind,
+ * then 8 bytes for numbers, or a u32 length and the bytes for strings and
+ * blobs. Everything is little endian.
+ */
+namespace {
+
+const char MAGIC[] = "ENTLOG1\n";
+const size_t MAGIC_BYTES = 8;
+const size_t HEADER_BYTES = 8;
+
+enum {
+	OP_PUT = 1,
+	OP_DEL = 2,
+	OP_COMMIT = 3,
+};
+
+const uint8_t FLAG_PENDING = 1;	// Written in a transaction, so only applied once a COMMIT follows.
+
+const size_t COPY_BUFFER_BYTES = 1 << 20;
+
+uint32_t checksum(const char* p, size_t n)
+{
+	uint32_t hash = 2166136261u;
+	for ( size_t i = 0; i < n; ++i ) {
+		hash = (hash ^ static_cast<unsigned char>(p[i])) * 16777619u;
+	}
+	return hash;
+}
+
+void putUint(string& out, uint64_t v, size_t bytes)
+{
+	for ( size_t i = 0; i < bytes; ++i ) {
+		out.push_back(static_cast<char>(v >> (8 * i)));
+	}
+}
+
+uint64_t getUint(const char* p, size_t bytes)
+{
+	uint64_t v = 0;
+	for ( size_t i = 0; i < bytes; ++i ) {
+		v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+	}
+	return v;
+}
+
+void setUint32(string& out, size_t at, uint32_t v)
+{
+	for ( size_t i = 0; i < 4; ++i ) {
+		out[at + i] = static_cast<char>(v >> (8 * i));
+	}
+}
+
+void putValue(string& out, const PrimitiveValue& v)
+{
+	out.push_back(static_cast<char>(v.kind()));
+	switch ( v.kind() ) {
+		case PRIMITIVE_DOUBLE: {
+			double d = v.asDouble();
+			uint64_t bits;
+			memcpy(&bits, &d, sizeof(bits));
+			putUint(out, bits, 8);
+			break;
+		}
+		case PRIMITIVE_STRING:
+		case PRIMITIVE_BLOB:
+			putUint(out, v.bytes().size(), 4);
+			out.append(v.bytes());
+			break;
+		default:
+			putUint(out, static_cast<uint64_t>(v.asInt64()), 8);
+			break;
+	}
+}
+
+/*! Reads the fields of a record body, failing rather than reading past its
+ * end.
+ */
+struct Reader
+{
+	Reader(const char* b, const char* e) : p(b), end(e), ok(true) {}
+
+	bool need(size_t n) {
+		if ( ok && static_cast<size_t>(end - p) < n )	ok = false;
+		return ok;
+	}
+
+	uint64_t uint(size_t bytes) {
+		if ( !need(bytes) )	return 0;
+		uint64_t v = getUint(p, bytes);
+		p += bytes;
+		return v;
+	}
+
+	const char* bytes(size_t n) {
+		if ( !need(n) )	return NULL;
+		const char* b = p;
+		p += n;
+		return b;
+	}
+
+	PrimitiveValue value() {
+		PrimitiveKind kind = static_cast<PrimitiveKind>(uint(1));
+		if ( !ok )	return PrimitiveValue();
+
+		switch ( kind ) {
+			case PRIMITIVE_DOUBLE: {
+				uint64_t bits = uint(8);
+				double d;
+				memcpy(&d, &bits, sizeof(d));
+				return PrimitiveValue::ofDouble(d);
+			}
+			case PRIMITIVE_STRING:
+			case PRIMITIVE_BLOB: {
+				size_t n = uint(4);
+				const char* b = bytes(n);
+				return ok ? PrimitiveValue::ofBytes(kind, b, n) : PrimitiveValue();
+			}
+			case PRIMITIVE_BOOL:
+			case PRIMITIVE_CHAR:
+			case PRIMITIVE_INT:
+			case PRIMITIVE_UINT:
+			case PRIMITIVE_INT64:
+				return PrimitiveValue::ofInteger(kind, static_cast<int64_t>(uint(8)));
+		}
+		ok = false;
+		return PrimitiveValue();
+	}
+
+	void skipValue() {
+		PrimitiveKind kind = static_cast<PrimitiveKind>(uint(1));
+		if ( kind == PRIMITIVE_STRING || kind == PRIMITIVE_BLOB ) {
+			bytes(uint(4));
+		} else {
+			bytes(8);
+		}
+	}
+
+	const char* p;
+	const char* end;
+	bool ok;
+};
+
+struct Record {
+	uint8_t op;
+	uint8_t flags;
+	string entitytype;
+	PrimitiveValue key;
+};
+
+/*! Parse the record at the start of some bytes.
+ * \return	The length of the record, or 0 if it is torn or corrupt.
+ */
+uint32_t parseRecord(const char* p, uint64_t avail, Record& r)
+{
+	if ( avail < HEADER_BYTES )	return 0;
+	uint64_t length = getUint(p, 4);
+	if ( length < 2 || length > avail - HEADER_BYTES )	return 0;
+	if ( checksum(p + HEADER_BYTES, length) != getUint(p + 4, 4) )	return 0;
+
+	Reader in(p + HEADER_BYTES, p + HEADER_BYTES + length);
+	r.op = in.uint(1);
+	r.flags = in.uint(1);
+	if ( r.op == OP_COMMIT )	return HEADER_BYTES + length;
+	if ( r.op != OP_PUT && r.op != OP_DEL )	return 0;
+
+	size_t n = in.uint(2);
+	const char* type = in.bytes(n);
+	r.key = in.value();
+	if ( !in.ok )	return 0;
+	r.entitytype.assign(type, n);
+	return HEADER_BYTES + length;
+}
+
+bool writeAll(int fd, const char* p, size_t n)
+{
+	while ( n > 0 ) {
+		ssize_t written = ::write(fd, p, n);
+		if ( written < 0 ) {
+			if ( errno == EINTR )	continue;
+			return false;
+		}
+		p += written;
+		n -= written;
+	}
+	return true;
+}
+
+bool matches(const vector<PrimitiveValue>& row, const vector< pair<size_t, PrimitiveValue> >& criteria)
+{
+	for ( size_t i = 0; i < criteria.size(); ++i ) {
+		if ( criteria[i].first >= row.size() || row[criteria[i].first] != criteria[i].second )	return false;
+	}
+	return true;
+}
+
+void assignRow(const vector<PrimitiveValue>& row, Entity& ent)
+{
+	Entity::PropertyList props = ent.properties();
+	if ( row.size() != props.size() ) {
+		throw LoadEntception(&ent, "The stored row does not have the properties of the entity type.");
+	}
+	for ( size_t i = 0; i < row.size(); ++i ) {
+		row[i].assignTo(*props[i]);
+	}
+}
+
+}	// End anon namespace
+
+
+/*! Cursor over a snapshot of the keys of the matching rows, which loads each
+ * row as it is stepped to and checks that it still matches.
+ */
+class LogPersistenceApi::Cursor : public PersistenceCursor
+{
+public:
+	Cursor(LogPersistenceApi& api, Table& t, vector<PrimitiveValue>& keys, const Criteria& criteria)
+		: api_(api), table_(t), criteria_(criteria), next_(0), onRow_(false) {
+		keys_.swap(keys);
+	}
+
+	virtual bool step() throw(Entception&) {
+		lock_guard<mutex> lock(api_.mutex_);
+		onRow_ = false;
+		while ( next_ < keys_.size() ) {
+			Table::const_iterator it = table_.find(keys_[next_++]);
+			if ( it == table_.end() )	continue;
+
+			api_.readRow(it->second, row_);
+			if ( matches(row_, criteria_) ) {
+				onRow_ = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual void read(Entity& ent) throw(Entception&) {
+		if ( !onRow_ ) {
+			throw LoadEntception(&ent, "The cursor is not on a row.");
+		}
+		assignRow(row_, ent);
+	}
+
+private:
+	LogPersistenceApi& api_;
+	Table& table_;
+	vector<PrimitiveValue> keys_;
+	Criteria criteria_;
+	size_t next_;
+	bool onRow_;
+	vector<PrimitiveValue> row_;
+};
+
+LogPersistenceApi::LogPersistenceApi(const char* logFile, bool syncWrites, double garbageRatio) throw(Entception&)
+	: path_(logFile), syncWrites_(syncWrites), garbageRatio_(garbageRatio),
+	fd_(-1), fileSize_(0), map_(NULL), mapped_(0), liveBytes_(0), rows_(0),
+	compacting_(false), compactWanted_(false), stop_(false), compactions_(0)
+{
+	fd_ = open(logFile, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if ( fd_ < 0 ) {
+		throw Entception(string("Could not open log ") + logFile + ": " + strerror(errno));
+	}
+
+	try {
+		recover();
+	} catch (Entception& e) {
+		unmap();
+		close(fd_);
+		throw;
+	}
+
+	if ( garbageRatio_ > 0 ) {
+		compactor_ = thread(&LogPersistenceApi::compactor, this);
+	}
+}
+
+LogPersistenceApi::~LogPersistenceApi()
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		stop_ = true;
+	}
+	compactSignal_.notify_one();
+	if ( compactor_.joinable() ) {
+		compactor_.join();
+	}
+
+	unmap();
+	close(fd_);
+}
+
+void LogPersistenceApi::recover() throw(Entception&)
+{
+	struct stat st;
+	if ( fstat(fd_, &st) != 0 ) {
+		throw Entception(path_ + ": " + strerror(errno));
+	}
+	fileSize_ = st.st_size;
+
+	if ( fileSize_ == 0 ) {
+		out_.assign(MAGIC, MAGIC_BYTES);
+		write();
+		return;
+	}
+
+	if ( fileSize_ >= MAGIC_BYTES )	mapTo(fileSize_);
+	if ( fileSize_ < MAGIC_BYTES || memcmp(map_, MAGIC, MAGIC_BYTES) != 0 ) {
+		throw Entception(path_ + " is not an entity log");
+	}
+
+	// Records of a transaction are held back until its COMMIT is read.
+	struct Pending {
+		Record record;
+		Slot slot;
+	};
+	vector<Pending> pending;
+
+	uint64_t pos = MAGIC_BYTES;
+	uint64_t good = pos;
+	Record r;
+	while ( pos < fileSize_ ) {
+		uint32_t length = parseRecord(map_ + pos, fileSize_ - pos, r);
+		if ( length == 0 )	break;
+
+		Slot slot = { pos, length };
+		pos += length;
+		if ( r.op != OP_COMMIT && (r.flags & FLAG_PENDING) ) {
+			pending.push_back(Pending());
+			pending.back().record = r;
+			pending.back().slot = slot;
+			continue;
+		}
+		if ( r.op != OP_COMMIT && !pending.empty() )	break;
+
+		if ( r.op != OP_COMMIT ) {
+			pending.push_back(Pending());
+			pending.back().record = r;
+			pending.back().slot = slot;
+		}
+		for ( size_t i = 0; i < pending.size(); ++i ) {
+			const Record& p = pending[i].record;
+			Table& t = tables_[p.entitytype];
+			if ( p.op == OP_PUT ) {
+				setRow(t, p.key, pending[i].slot);
+			} else {
+				removeRow(t, p.key);
+			}
+		}
+		pending.clear();
+		good = pos;
+	}
+
+	if ( good < fileSize_ ) {
+		// Torn by a crash, or a transaction that never committed.
+		if ( ftruncate(fd_, good) != 0 ) {
+			throw Entception(path_ + ": " + strerror(errno));
+		}
+		unmap();
+		fileSize_ = good;
+	}
+}
+
+void LogPersistenceApi::mapTo(uint64_t end) throw(Entception&)
+{
+	if ( end <= mapped_ )	return;
+
+	unmap();
+	void* m = mmap(NULL, fileSize_, PROT_READ, MAP_SHARED, fd_, 0);
+	if ( m == MAP_FAILED ) {
+		throw Entception(string("Could not map log ") + path_ + ": " + strerror(errno));
+	}
+	map_ = static_cast<const char*>(m);
+	mapped_ = fileSize_;
+}
+
+void LogPersistenceApi::unmap()
+{
+	if ( map_ ) {
+		munmap(const_cast<char*>(map_), mapped_);
+	}
+	map_ = NULL;
+	mapped_ = 0;
+}
+
+void LogPersistenceApi::readRow(const Slot& slot, vector<PrimitiveValue>& row) throw(Entception&)
+{
+	const char* p;
+	if ( slot.offset >= fileSize_ ) {
+		// Written in a transaction, and still in the output buffer.
+		p = out_.data() + (slot.offset - fileSize_);
+	} else {
+		mapTo(slot.offset + slot.length);
+		p = map_ + slot.offset;
+	}
+	Reader in(p + HEADER_BYTES, p + slot.length);
+	in.uint(1);
+	in.uint(1);
+	in.bytes(in.uint(2));
+	in.skipValue();
+
+	size_t columns = in.uint(2);
+	row.resize(columns);
+	for ( size_t i = 0; i < columns && in.ok; ++i ) {
+		row[i] = in.value();
+	}
+	if ( !in.ok ) {
+		throw Entception(path_ + " has a corrupt record");
+	}
+}
+
+LogPersistenceApi::Slot LogPersistenceApi::encode(uint8_t op, bool pending, const string& entitytype,
+		const PrimitiveValue& key, const vector<PrimitiveValue>* values)
+{
+	size_t start = out_.size();
+	Slot slot;
+	slot.offset = fileSize_ + start;
+
+	out_.append(HEADER_BYTES, '\0');
+	putUint(out_, op, 1);
+	putUint(out_, pending ? FLAG_PENDING : 0, 1);
+	if ( op != OP_COMMIT ) {
+		putUint(out_, entitytype.size(), 2);
+		out_.append(entitytype);
+		putValue(out_, key);
+	}
+	if ( values ) {
+		putUint(out_, values->size(), 2);
+		for ( size_t i = 0; i < values->size(); ++i ) {
+			putValue(out_, (*values)[i]);
+		}
+	}
+
+	size_t length = out_.size() - start - HEADER_BYTES;
+	setUint32(out_, start, length);
+	setUint32(out_, start + 4, checksum(out_.data() + start + HEADER_BYTES, length));
+	slot.length = HEADER_BYTES + length;
+	return slot;
+}
+
+void LogPersistenceApi::write() throw(Entception&)
+{
+	if ( !writeAll(fd_, out_.data(), out_.size()) ) {
+		string error = strerror(errno);
+		out_.clear();
+		// Drop whatever part was written, so the log does not end in a torn record.
+		if ( ftruncate(fd_, fileSize_) != 0 ) {
+			// The torn record is dropped when the log is next opened instead.
+		}
+		throw Entception(string("Could not write to log ") + path_ + ": " + error);
+	}
+	fileSize_ += out_.size();
+	out_.clear();
+
+	if ( syncWrites_ && savepoints_.empty() && fdatasync(fd_) != 0 ) {
+		throw Entception(string("Could not sync log ") + path_ + ": " + strerror(errno));
+	}
+}
+
+void LogPersistenceApi::append() throw(Entception&)
+{
+	if ( savepoints_.empty() || out_.size() >= WRITE_BUFFER_BYTES ) {
+		write();
+	}
+}
+
+LogPersistenceApi::Table& LogPersistenceApi::tableFor(const Entity& ent) throw(Entception&)
+{
+	const EntitySchema& schema = ent.schema();
+	if ( schema.primaryKey() < 0 ) {
+		throw Entception(string("Entity type ") + schema.entitytype() + " has no primary key to index the log by");
+	}
+	return tables_[schema.entitytype()];
+}
+
+void LogPersistenceApi::logUndo(Table& t, const PrimitiveValue& key)
+{
+	if ( savepoints_.empty() )	return;
+
+	undo_.push_back(Undo());
+	Undo& u = undo_.back();
+	u.table = &t;
+	u.key = key;
+	Table::const_iterator it = t.find(key);
+	u.existed = it != t.end();
+	if ( u.existed )	u.old = it->second;
+}
+
+void LogPersistenceApi::setRow(Table& t, const PrimitiveValue& key, const Slot& slot)
+{
+	logUndo(t, key);
+	pair<Table::iterator, bool> inserted = t.insert(make_pair(key, slot));
+	if ( inserted.second ) {
+		++rows_;
+	} else {
+		liveBytes_ -= inserted.first->second.length;
+		inserted.first->second = slot;
+	}
+	liveBytes_ += slot.length;
+}
+
+void LogPersistenceApi::removeRow(Table& t, const PrimitiveValue& key)
+{
+	Table::iterator it = t.find(key);
+	if ( it == t.end() )	return;
+
+	logUndo(t, key);
+	liveBytes_ -= it->second.length;
+	--rows_;
+	t.erase(it);
+}
+
+bool LogPersistenceApi::save(const Entity& ent) throw(Entception&)
+{
+	lock_guard<mutex> lock(mutex_);
+	return saveRow(ent);
+}
+
+bool LogPersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	// Save the batch as a transaction, so it is written to the log at once.
+	lock_guard<mutex> lock(mutex_);
+	Savepoint sp = { undo_.size(), fileSize_ + out_.size() };
+	savepoints_.push_back(sp);
+	try {
+		for ( size_t i = 0; i < count; ++i ) {
+			saveRow(*ents[i]);
+		}
+	} catch (Entception& e) {
+		savepoints_.pop_back();
+		rollbackTo(sp);
+		throw;
+	}
+	commit();
+	return true;
+}
+
+bool LogPersistenceApi::saveRow(const Entity& ent) throw(Entception&)
+{
+	Entity::PropertyList props = ent.properties();
+	vector<PrimitiveValue> values;
+	values.reserve(props.size());
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		values.push_back(PrimitiveValue::of(*props[i]));
+	}
+
+	Table& t = tableFor(ent);
+	const EntitySchema& schema = ent.schema();
+	const PrimitiveValue& key = values[schema.primaryKey()];
+	if ( t.count(key) ) {
+		throw SaveEntception(&ent, string("UNIQUE constraint failed: ") + schema.entitytype() + "." + schema.name(schema.primaryKey()));
+	}
+
+	Slot slot = encode(OP_PUT, !savepoints_.empty(), schema.entitytype(), key, &values);
+	append();
+	setRow(t, key, slot);
+	checkGarbage();
+	return true;
+}
+
+bool LogPersistenceApi::writeRow(Table& t, const Entity& ent, const PrimitiveValue& key, const vector<PrimitiveValue>& values) throw(Entception&)
+{
+	const EntitySchema& schema = ent.schema();
+	const PrimitiveValue& newKey = values[schema.primaryKey()];
+
+	if ( newKey == key ) {
+		Slot slot = encode(OP_PUT, !savepoints_.empty(), schema.entitytype(), key, &values);
+		append();
+		setRow(t, key, slot);
+	} else {
+		if ( t.count(newKey) ) {
+			throw UpdateEntception(&ent, string("UNIQUE constraint failed: ") + schema.entitytype() + "." + schema.name(schema.primaryKey()));
+		}
+
+		// Moving the row is a delete and a put, which must both be applied.
+		encode(OP_DEL, true, schema.entitytype(), key, NULL);
+		Slot slot = encode(OP_PUT, true, schema.entitytype(), newKey, &values);
+		if ( savepoints_.empty() ) {
+			encode(OP_COMMIT, false, string(), key, NULL);
+		}
+		append();
+		removeRow(t, key);
+		setRow(t, newKey, slot);
+	}
+
+	checkGarbage();
+	return true;
+}
+
+bool LogPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	if ( !ent.isSubset(updates) ) {
+		throw UpdateEntception(&ent, "Updates are not a valid subset.");
+	}
+
+	AbstractPropertyCollection::PropertyArray props = updates.props();
+	if ( props.size() == 0 ) {
+		return false;
+	}
+
+	lock_guard<mutex> lock(mutex_);
+	Table& t = tableFor(ent);
+	PrimitiveValue key = PrimitiveValue::of(*ent.primaryKey());
+	Table::const_iterator it = t.find(key);
+	if ( it == t.end() ) {
+		return false;
+	}
+
+	const EntitySchema& schema = ent.schema();
+	vector<PrimitiveValue> values;
+	readRow(it->second, values);
+	if ( values.size() != schema.size() ) {
+		throw UpdateEntception(&ent, "The stored row does not have the properties of the entity type.");
+	}
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		values[schema.indexOf(props[i]->propertyName())] = PrimitiveValue::of(*props[i]);
+	}
+	return writeRow(t, ent, key, values);
+}
+
+bool LogPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	const AbstractProperty* pk = ent.primaryKey();
+	if ( pk && pk->dirty() ) {
+		throw UpdateEntception(&ent, "The primary key has been modified, so the entity can not be found.");
+	}
+
+	Entity::PropertyList props = ent.properties();
+	if ( props.size() < sizeof(PropertyMask) * 8 ) {
+		dirty &= (PropertyMask(1) << props.size()) - 1;
+	}
+	if ( !dirty ) {
+		return false;
+	}
+
+	lock_guard<mutex> lock(mutex_);
+	Table& t = tableFor(ent);
+	PrimitiveValue key = PrimitiveValue::of(*pk);
+	Table::const_iterator it = t.find(key);
+	if ( it == t.end() ) {
+		return false;
+	}
+
+	vector<PrimitiveValue> values;
+	readRow(it->second, values);
+	if ( values.size() != props.size() ) {
+		throw UpdateEntception(&ent, "The stored row does not have the properties of the entity type.");
+	}
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( dirty & (PropertyMask(1) << i) )	values[i] = PrimitiveValue::of(*props[i]);
+	}
+	return writeRow(t, ent, key, values);
+}
+
+bool LogPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( !ent.isSubset(criteria) ) {
+		throw LoadEntception(&ent, "Load criteria are not a valid subset.");
+	}
+
+	const EntitySchema& schema = ent.schema();
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	Criteria match;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		match.push_back(make_pair(size_t(schema.indexOf(props[i]->propertyName())), PrimitiveValue::of(*props[i])));
+	}
+
+	// View properties point in to the row, so each thread loads in to its
+	// own, and a load on one thread does not move another thread's views.
+	static thread_local vector<PrimitiveValue> row;
+
+	lock_guard<mutex> lock(mutex_);
+	Table& t = tableFor(ent);
+	if ( match.size() == 1 && match[0].first == size_t(schema.primaryKey()) ) {
+		Table::const_iterator it = t.find(match[0].second);
+		if ( it == t.end() ) {
+			return false;
+		}
+		readRow(it->second, row);
+		assignRow(row, ent);
+		return true;
+	}
+
+	for ( Table::const_iterator it = t.begin(); it != t.end(); ++it ) {
+		readRow(it->second, row);
+		if ( matches(row, match) ) {
+			assignRow(row, ent);
+			return true;
+		}
+	}
+	return false;
+}
+
+PersistenceCursor* LogPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( !shape.isSubset(criteria) ) {
+		throw LoadEntception(&shape, "Query criteria are not a valid subset.");
+	}
+
+	const EntitySchema& schema = shape.schema();
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	Criteria match;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		match.push_back(make_pair(size_t(schema.indexOf(props[i]->propertyName())), PrimitiveValue::of(*props[i])));
+	}
+
+	lock_guard<mutex> lock(mutex_);
+	Table& t = tableFor(shape);
+
+	// Step through the rows in the order they were written.
+	vector< pair<uint64_t, const PrimitiveValue*> > order;
+	order.reserve(t.size());
+	for ( Table::const_iterator it = t.begin(); it != t.end(); ++it ) {
+		order.push_back(make_pair(it->second.offset, &it->first));
+	}
+	sort(order.begin(), order.end());
+
+	vector<PrimitiveValue> keys;
+	keys.reserve(order.size());
+	for ( size_t i = 0; i < order.size(); ++i ) {
+		keys.push_back(*order[i].second);
+	}
+	return new Cursor(*this, t, keys, match);
+}
+
+bool LogPersistenceApi::del(const Entity& ent) throw(Entception&)
+{
+	PrimitiveValue key;
+	if ( ent.primaryKey() )	key = PrimitiveValue::of(*ent.primaryKey());
+
+	lock_guard<mutex> lock(mutex_);
+	Table& t = tableFor(ent);
+	if ( !t.count(key) ) {
+		return false;
+	}
+
+	encode(OP_DEL, !savepoints_.empty(), ent.schema().entitytype(), key, NULL);
+	append();
+	removeRow(t, key);
+	checkGarbage();
+	return true;
+}
+
+void LogPersistenceApi::beginTransaction() throw(Entception&)
+{
+	lock_guard<mutex> lock(mutex_);
+	Savepoint sp = { undo_.size(), fileSize_ + out_.size() };
+	savepoints_.push_back(sp);
+}
+
+void LogPersistenceApi::commitTransaction() throw(Entception&)
+{
+	lock_guard<mutex> lock(mutex_);
+	if ( savepoints_.empty() ) {
+		throw Entception("No transaction to commit");
+	}
+	commit();
+}
+
+void LogPersistenceApi::commit() throw(Entception&)
+{
+	Savepoint sp = savepoints_.back();
+	savepoints_.pop_back();
+	if ( !savepoints_.empty() ) {
+		// The changes now belong to the enclosing transaction.
+		return;
+	}
+
+	if ( fileSize_ + out_.size() > sp.end ) {
+		try {
+			encode(OP_COMMIT, false, string(), PrimitiveValue(), NULL);
+			write();
+		} catch (Entception& e) {
+			rollbackTo(sp);
+			throw;
+		}
+	}
+	undo_.clear();
+	checkGarbage();
+}
+
+void LogPersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	lock_guard<mutex> lock(mutex_);
+	if ( savepoints_.empty() ) {
+		throw Entception("No transaction to roll back");
+	}
+
+	Savepoint sp = savepoints_.back();
+	savepoints_.pop_back();
+	rollbackTo(sp);
+}
+
+void LogPersistenceApi::rollbackTo(const Savepoint& sp) throw(Entception&)
+{
+	while ( undo_.size() > sp.undo ) {
+		Undo& u = undo_.back();
+		Table::iterator it = u.table->find(u.key);
+		if ( it != u.table->end() ) {
+			liveBytes_ -= it->second.length;
+			--rows_;
+			u.table->erase(it);
+		}
+		if ( u.existed ) {
+			u.table->insert(make_pair(u.key, u.old));
+			liveBytes_ += u.old.length;
+			++rows_;
+		}
+		undo_.pop_back();
+	}
+
+	if ( sp.end >= fileSize_ ) {
+		out_.resize(min<uint64_t>(out_.size(), sp.end - fileSize_));
+	} else {
+		out_.clear();
+		unmap();
+		if ( ftruncate(fd_, sp.end) != 0 ) {
+			throw Entception(string("Could not truncate log ") + path_ + ": " + strerror(errno));
+		}
+		fileSize_ = sp.end;
+	}
+}
+
+void LogPersistenceApi::checkGarbage()
+{
+	if ( garbageRatio_ <= 0 || compacting_ || compactWanted_ || !savepoints_.empty() )	return;
+	if ( fileSize_ < MIN_COMPACT_BYTES )	return;
+
+	uint64_t garbage = fileSize_ - MAGIC_BYTES - liveBytes_;
+	if ( garbage > garbageRatio_ * fileSize_ ) {
+		compactWanted_ = true;
+		compactSignal_.notify_one();
+	}
+}
+
+void LogPersistenceApi::compactor()
+{
+	unique_lock<mutex> lock(mutex_);
+	for ( ;; ) {
+		while ( !stop_ && !compactWanted_ ) {
+			compactSignal_.wait(lock);
+		}
+		if ( stop_ )	return;
+
+		compactWanted_ = false;
+		try {
+			compact(lock);
+		} catch (Entception& e) {
+			// The log is left as it was, and compaction is tried again once
+			// there is more garbage.
+		}
+	}
+}
+
+bool LogPersistenceApi::compact() throw(Entception&)
+{
+	unique_lock<mutex> lock(mutex_);
+	return compact(lock);
+}
+
+bool LogPersistenceApi::compact(unique_lock<mutex>& lock) throw(Entception&)
+{
+	if ( compacting_ || !savepoints_.empty() ) {
+		return false;
+	}
+
+	// Records before the current end of the log never change, so the live
+	// ones can be copied without holding the lock, from a mapping of our own.
+	vector<Slot> live;
+	live.reserve(rows_);
+	for ( auto t = tables_.begin(); t != tables_.end(); ++t ) {
+		for ( Table::const_iterator it = t->second.begin(); it != t->second.end(); ++it ) {
+			live.push_back(it->second);
+		}
+	}
+	sort(live.begin(), live.end(), [](const Slot& a, const Slot& b) { return a.offset < b.offset; });
+
+	uint64_t end = fileSize_;
+	void* m = mmap(NULL, end, PROT_READ, MAP_SHARED, fd_, 0);
+	if ( m == MAP_FAILED ) {
+		throw Entception(string("Could not map log ") + path_ + ": " + strerror(errno));
+	}
+	const char* old = static_cast<const char*>(m);
+
+	string tmpPath = path_ + ".compact";
+	int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if ( fd < 0 ) {
+		string error = strerror(errno);
+		munmap(m, end);
+		throw Entception(string("Could not create ") + tmpPath + ": " + error);
+	}
+
+	compacting_ = true;
+	lock.unlock();
+
+	unordered_map<uint64_t, uint64_t> moved;
+	moved.reserve(live.size());
+	string buf(MAGIC, MAGIC_BYTES);
+	uint64_t written = 0;
+	bool ok = true;
+	for ( size_t i = 0; i < live.size() && ok; ++i ) {
+		moved[live[i].offset] = written + buf.size();
+
+		size_t start = buf.size();
+		buf.append(old + live[i].offset, live[i].length);
+		// Every live record is committed, so it no longer waits for a COMMIT.
+		if ( buf[start + HEADER_BYTES + 1] & FLAG_PENDING ) {
+			buf[start + HEADER_BYTES + 1] &= ~FLAG_PENDING;
+			setUint32(buf, start + 4, checksum(buf.data() + start + HEADER_BYTES, live[i].length - HEADER_BYTES));
+		}
+
+		if ( buf.size() >= COPY_BUFFER_BYTES ) {
+			ok = writeAll(fd, buf.data(), buf.size());
+			written += buf.size();
+			buf.clear();
+		}
+	}
+	int error = ok ? 0 : errno;
+
+	lock.lock();
+	compacting_ = false;
+
+	// Copy whatever was written while the live records were being copied.
+	uint64_t tail = written + buf.size();
+	if ( ok && savepoints_.empty() ) {
+		try {
+			mapTo(fileSize_);
+		} catch (Entception& e) {
+			munmap(m, end);
+			close(fd);
+			unlink(tmpPath.c_str());
+			throw;
+		}
+		buf.append(map_ + end, fileSize_ - end);
+		ok = writeAll(fd, buf.data(), buf.size()) && fdatasync(fd) == 0 && rename(tmpPath.c_str(), path_.c_str()) == 0;
+		written += buf.size();
+		error = ok ? 0 : errno;
+	}
+	munmap(m, end);
+
+	if ( !ok || !savepoints_.empty() ) {
+		close(fd);
+		unlink(tmpPath.c_str());
+		if ( ok ) {
+			// A transaction began while copying, and may yet be rolled back.
+			return false;
+		}
+		throw Entception(string("Could not compact log ") + path_ + ": " + strerror(error));
+	}
+
+	unmap();
+	close(fd_);
+	fd_ = fd;
+	fileSize_ = written;
+
+	for ( auto t = tables_.begin(); t != tables_.end(); ++t ) {
+		for ( Table::iterator it = t->second.begin(); it != t->second.end(); ++it ) {
+			Slot& slot = it->second;
+			slot.offset = slot.offset < end ? moved[slot.offset] : slot.offset - end + tail;
+		}
+	}
+	++compactions_;
+	return true;
+}
+
+LogPersistenceApi::Stats LogPersistenceApi::stats() const
+{
+	lock_guard<mutex> lock(mutex_);
+	Stats s;
+	s.fileBytes = fileSize_;
+	s.liveBytes = liveBytes_;
+	s.rows = rows_;
+	s.compactions = compactions_;
+	return s;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
@@ -0,0 +1,231 @@
+#ifndef LOG_PERSISTENCE_API_HPP
+#define LOG_PERSISTENCE_API_HPP
+/*! \file	logpersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "entities/entity.hpp"
+#include "entities/primitivevalue.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Persistence that appends every change to a log file, for entity types that
+ * are written far more than they are read, such as events.
+ *
+ * Saves, updates and deletes are appended to the end of the file as binary
+ * records, so writing never seeks. The file is memory mapped for reading, and
+ * an index in memory maps the primary key of every entity to the offset of
+ * its latest record. Every entity type stored must have a primary key. Loads
+ * by primary key are a lookup in the index; loads and cursors by any other
+ * criteria scan every row of the entity type.
+ *
+ * Updates and deletes leave the records they replace in the file. Once more
+ * than a given share of the file is replaced records, a background thread
+ * compacts it: the live records are copied to a new file, which then replaces
+ * the log. Writes carry on while the copy is made, and only wait for the
+ * final swap.
+ *
+ * When the log is opened, the index is rebuilt by reading it from start to
+ * end. Each record has a checksum, and a record torn by a crash, along with
+ * everything after it, is discarded.
+ *
+ * Transactions are supported, and nest. Their records are buffered and
+ * written to the log in large blocks, marked as pending until the outermost
+ * transaction commits, so a crash part way through a transaction loses all of
+ * it. Rolling back drops the buffer and truncates the log. The log is not
+ * compacted while a transaction is open.
+ *
+ * Loaded values are copied out of the log, except for view properties such as
+ * Property<StringPrimitive>, which point in to memory that is valid until the
+ * next load on the same thread, through any log persistence, or the next step
+ * of the cursor they were read from.
+ *
+ * The persistence can be used from several threads at once, although, as
+ * with a single SQLite connection, a transaction covers every thread's
+ * changes.
+ */
+class LogPersistenceApi : public PersistenceApi
+{
+public:
+	/*! Counters of the state of the log. */
+	struct Stats {
+		uint64_t fileBytes;
+		uint64_t liveBytes;		//!< Bytes of the latest record of each row.
+		size_t rows;
+		uint64_t compactions;
+	};
+
+	/*! Open a log, creating it if it does not exist, and index its rows.
+	 * \param	logFile			Name of the log file.
+	 * \param	syncWrites		Whether or not to sync the log to disk after
+	 *			each change outside a transaction, and each commit. Without
+	 *			this, a power loss can lose recent changes, but never corrupts
+	 *			the log.
+	 * \param	garbageRatio	Share of the file that must be replaced records
+	 *			before it is compacted in the background. 0 turns background
+	 *			compaction off.
+	 * \throws	Entception	If the file can not be opened, or is not a log.
+	 */
+	LogPersistenceApi(const char* logFile, bool syncWrites = false,
+			double garbageRatio = DEFAULT_GARBAGE_RATIO) throw(Entception&);
+	virtual ~LogPersistenceApi();
+
+	/*! Append a new row.
+	 * \throws	SaveEntception	If a row with the same key exists.
+	 * \throws	Entception		If the entity type has no primary key, as for
+	 *			every other method.
+	 */
+	virtual bool save(const Entity& ent) throw(Entception&);
+
+	/*! Append a batch of new rows, all written to the log at once. */
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+	virtual bool del(const Entity& ent) throw(Entception&);
+
+	/*! Open a cursor over the matching rows, in the order they were last
+	 * written. Rows written while the cursor is open are not stepped to.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	/*! Compact the log now, on this thread.
+	 * \return	Whether or not the log was compacted. It is not while a
+	 *			transaction is open, or while it is being compacted in the
+	 *			background.
+	 * \throws	Entception	If the compacted log could not be written.
+	 */
+	bool compact() throw(Entception&);
+
+	Stats stats() const;
+
+	static constexpr double DEFAULT_GARBAGE_RATIO = 0.5;
+
+	/*! Logs smaller than this are not compacted in the background. */
+	static const uint64_t MIN_COMPACT_BYTES = 1 << 20;
+
+	/*! Records written in a transaction are buffered up to this size. */
+	static const size_t WRITE_BUFFER_BYTES = 64 << 10;
+
+private:
+	/*! Where the latest record of a row is in the log. */
+	struct Slot {
+		uint64_t offset;
+		uint32_t length;
+	};
+
+	typedef std::unordered_map<PrimitiveValue, Slot, PrimitiveValue::Hash> Table;
+
+	/*! Property values that rows must have, by column. */
+	typedef std::vector< std::pair<size_t, PrimitiveValue> > Criteria;
+
+	/*! A change to the index to undo if its transaction is rolled back. */
+	struct Undo {
+		Table* table;
+		PrimitiveValue key;
+		bool existed;
+		Slot old;
+	};
+
+	struct Savepoint {
+		size_t undo;
+		uint64_t end;	// End of the log, including output not yet written.
+	};
+
+	class Cursor;
+
+	Table& tableFor(const Entity& ent) throw(Entception&);
+
+	/*! Read and index every record, and truncate anything torn at the end. */
+	void recover() throw(Entception&);
+
+	/*! Make sure the mapping covers the file up to an offset. */
+	void mapTo(uint64_t end) throw(Entception&);
+	void unmap();
+
+	/*! Decode the values of a row's record in to a vector. */
+	void readRow(const Slot& slot, std::vector<PrimitiveValue>& row) throw(Entception&);
+
+	/*! Encode a record on to the end of the pending output.
+	 * \return	Where the record will be in the log.
+	 */
+	Slot encode(uint8_t op, bool pending, const std::string& entitytype, const PrimitiveValue& key,
+			const std::vector<PrimitiveValue>* values);
+
+	/*! Append the pending output to the log. */
+	void write() throw(Entception&);
+
+	/*! Write the pending output, unless a transaction is open and there is
+	 * not much of it yet.
+	 */
+	void append() throw(Entception&);
+
+	bool saveRow(const Entity& ent) throw(Entception&);
+
+	/*! Write a row's new values, moving it if its key has changed. */
+	bool writeRow(Table& t, const Entity& ent, const PrimitiveValue& key, const std::vector<PrimitiveValue>& values) throw(Entception&);
+
+	void setRow(Table& t, const PrimitiveValue& key, const Slot& slot);
+	void removeRow(Table& t, const PrimitiveValue& key);
+	void logUndo(Table& t, const PrimitiveValue& key);
+	/*! Commit the innermost transaction, writing the log if it is the
+	 * outermost.
+	 */
+	void commit() throw(Entception&);
+	void rollbackTo(const Savepoint& sp) throw(Entception&);
+
+	/*! Wake the compaction thread if the log is due to be compacted. */
+	void checkGarbage();
+
+	bool compact(std::unique_lock<std::mutex>& lock) throw(Entception&);
+	void compactor();
+
+	LogPersistenceApi(const LogPersistenceApi&);
+	LogPersistenceApi& operator = (const LogPersistenceApi&);
+
+	std::string path_;
+	bool syncWrites_;
+	double garbageRatio_;
+
+	mutable std::mutex mutex_;
+	int fd_;
+	uint64_t fileSize_;
+	const char* map_;
+	uint64_t mapped_;
+
+	std::unordered_map<std::string, Table> tables_;
+	uint64_t liveBytes_;
+	size_t rows_;
+	std::string out_;			// Records waiting to be written.
+
+	std::vector<Undo> undo_;
+	std::vector<Savepoint> savepoints_;
+
+	bool compacting_;
+	bool compactWanted_;
+	bool stop_;
+	uint64_t compactions_;
+	std::condition_variable compactSignal_;
+	std::thread compactor_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MEMORY_ENTITY_FACTORY_HPP
+#define MEMORY_ENTITY_FACTORY_HPP
+/*! \file	memoryentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "entities/entityfactory.hpp"
+#include "entities/factories/memorypersistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that keeps its entities in memory, for tests and for data
+ * that does not need to outlive the process.
+ *
+ * \see	MemoryPersistenceApi
+ */
+class MemoryEntityFactory : public EntityFactory
+{
+public:
+	MemoryEntityFactory() {}
+
+	/*! Get the persistence, to add indexes to it. */
+	MemoryPersistenceApi& persistence() { return persistence_; }
+
+private:
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(&persistence_); }
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
+	MemoryPersistenceApi persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
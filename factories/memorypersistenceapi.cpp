@@ -0,0 +1,655 @@
+/*! \file	memorypersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "memorypersistenceapi.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+typedef vector<PrimitiveValue> Values;
+
+/*! Remove the entry of one slot from a multimap of values to slots. */
+template <typename Map>
+void eraseSlot(Map& m, const PrimitiveValue& v, size_t slot)
+{
+	pair<typename Map::iterator, typename Map::iterator> range = m.equal_range(v);
+	for ( typename Map::iterator it = range.first; it != range.second; ++it ) {
+		if ( it->second == slot ) {
+			m.erase(it);
+			return;
+		}
+	}
+}
+
+/*! Whether a multimap of values to slots has a value in any slot but one. */
+template <typename Map>
+bool hasOtherSlot(const Map& m, const PrimitiveValue& v, size_t slot)
+{
+	pair<typename Map::const_iterator, typename Map::const_iterator> range = m.equal_range(v);
+	for ( typename Map::const_iterator it = range.first; it != range.second; ++it ) {
+		if ( it->second != slot )	return true;
+	}
+	return false;
+}
+
+template <typename Map>
+void appendSlots(const Map& m, const PrimitiveValue& v, vector<size_t>& slots)
+{
+	pair<typename Map::const_iterator, typename Map::const_iterator> range = m.equal_range(v);
+	for ( typename Map::const_iterator it = range.first; it != range.second; ++it ) {
+		slots.push_back(it->second);
+	}
+}
+
+const size_t NO_SLOT = static_cast<size_t>(-1);
+
+}	// End anon namespace
+
+
+/*! An index from the values of one column to the slots of the rows that have
+ * them.
+ */
+struct MemoryPersistenceApi::Index
+{
+	Index(size_t c, bool o, bool u) : column(c), ordered(o), unique(u) {}
+
+	void insert(const PrimitiveValue& v, size_t slot) {
+		if ( ordered )	tree.insert(make_pair(v, slot));
+		else			hash.insert(make_pair(v, slot));
+	}
+
+	void erase(const PrimitiveValue& v, size_t slot) {
+		if ( ordered )	eraseSlot(tree, v, slot);
+		else			eraseSlot(hash, v, slot);
+	}
+
+	/*! Whether any row other than the one in a slot has a value. */
+	bool conflicts(const PrimitiveValue& v, size_t slot) const {
+		return ordered ? hasOtherSlot(tree, v, slot) : hasOtherSlot(hash, v, slot);
+	}
+
+	void find(const PrimitiveValue& v, vector<size_t>& slots) const {
+		if ( ordered )	appendSlots(tree, v, slots);
+		else			appendSlots(hash, v, slots);
+	}
+
+	size_t column;
+	bool ordered;
+	bool unique;
+	unordered_multimap<PrimitiveValue, size_t, PrimitiveValue::Hash> hash;
+	multimap<PrimitiveValue, size_t> tree;
+};
+
+/*! The rows of one entity type. Row values are stored contiguously, a row of
+ * columns values per slot.
+ */
+struct MemoryPersistenceApi::Table
+{
+	Table(const EntitySchema& s) : schema(s), columns(s.size()), live(0) {}
+
+	~Table() {
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			delete indexes[i];
+		}
+	}
+
+	PrimitiveValue* row(size_t slot) { return &cells[slot * columns]; }
+	size_t slots() const { return alive.size(); }
+
+	Index* indexOn(size_t column, bool ordered) const {
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			if ( indexes[i]->column == column && indexes[i]->ordered == ordered )	return indexes[i];
+		}
+		return NULL;
+	}
+
+	/*! Find the column whose unique index already has a value in the
+	 * criteria, for a row other than the one in a slot.
+	 * \retval	NULL	There is no conflict.
+	 */
+	const char* uniqueConflict(const Criteria& values, size_t slot) const {
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			if ( !indexes[i]->unique )	continue;
+			for ( size_t v = 0; v < values.size(); ++v ) {
+				if ( values[v].first == indexes[i]->column && indexes[i]->conflicts(values[v].second, slot) ) {
+					return schema.name(indexes[i]->column);
+				}
+			}
+		}
+		return NULL;
+	}
+
+	size_t insert(Values& values) {
+		size_t slot;
+		if ( !free.empty() ) {
+			slot = free.back();
+			free.pop_back();
+			alive[slot] = true;
+		} else {
+			slot = alive.size();
+			alive.push_back(true);
+			cells.resize(cells.size() + columns);
+		}
+
+		PrimitiveValue* r = row(slot);
+		for ( size_t c = 0; c < columns; ++c ) {
+			swap(r[c], values[c]);
+		}
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			indexes[i]->insert(r[indexes[i]->column], slot);
+		}
+		++live;
+		return slot;
+	}
+
+	/*! Put a deleted row back in the same slot. */
+	void restore(size_t slot, Values& values) {
+		free.erase(find(free.begin(), free.end(), slot));
+		alive[slot] = true;
+		PrimitiveValue* r = row(slot);
+		for ( size_t c = 0; c < columns; ++c ) {
+			swap(r[c], values[c]);
+		}
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			indexes[i]->insert(r[indexes[i]->column], slot);
+		}
+		++live;
+	}
+
+	void remove(size_t slot) {
+		PrimitiveValue* r = row(slot);
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			indexes[i]->erase(r[indexes[i]->column], slot);
+		}
+		for ( size_t c = 0; c < columns; ++c ) {
+			r[c] = PrimitiveValue();
+		}
+		alive[slot] = false;
+		free.push_back(slot);
+		--live;
+	}
+
+	void set(size_t slot, size_t column, const PrimitiveValue& v) {
+		PrimitiveValue& cell = row(slot)[column];
+		for ( size_t i = 0; i < indexes.size(); ++i ) {
+			if ( indexes[i]->column != column )	continue;
+			indexes[i]->erase(cell, slot);
+			indexes[i]->insert(v, slot);
+		}
+		cell = v;
+	}
+
+	bool matches(size_t slot, const Criteria& criteria) {
+		if ( !alive[slot] )	return false;
+		const PrimitiveValue* r = row(slot);
+		for ( size_t i = 0; i < criteria.size(); ++i ) {
+			if ( r[criteria[i].first] != criteria[i].second )	return false;
+		}
+		return true;
+	}
+
+	/*! Get the slots that could match the criteria from an index on one of
+	 * their columns.
+	 * \return	Whether an index was used. If not, every slot must be scanned.
+	 */
+	bool candidates(const Criteria& criteria, vector<size_t>& slots) const {
+		for ( size_t i = 0; i < criteria.size(); ++i ) {
+			Index* index = indexOn(criteria[i].first, false);
+			if ( !index )	index = indexOn(criteria[i].first, true);
+			if ( index ) {
+				index->find(criteria[i].second, slots);
+				// Match in the order the rows were saved, as a scan would.
+				sort(slots.begin(), slots.end());
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*! Get every slot matching the criteria. */
+	void findAll(const Criteria& criteria, vector<size_t>& found) {
+		vector<size_t> slots;
+		if ( candidates(criteria, slots) ) {
+			for ( size_t i = 0; i < slots.size(); ++i ) {
+				if ( matches(slots[i], criteria) )	found.push_back(slots[i]);
+			}
+		} else {
+			for ( size_t s = 0; s < alive.size(); ++s ) {
+				if ( matches(s, criteria) )	found.push_back(s);
+			}
+		}
+	}
+
+	size_t findFirst(const Criteria& criteria) {
+		vector<size_t> slots;
+		if ( candidates(criteria, slots) ) {
+			for ( size_t i = 0; i < slots.size(); ++i ) {
+				if ( matches(slots[i], criteria) )	return slots[i];
+			}
+		} else {
+			for ( size_t s = 0; s < alive.size(); ++s ) {
+				if ( matches(s, criteria) )	return s;
+			}
+		}
+		return NO_SLOT;
+	}
+
+	void read(size_t slot, Entity& ent) {
+		const PrimitiveValue* r = row(slot);
+		Entity::PropertyList props = ent.properties();
+		for ( size_t c = 0; c < columns; ++c ) {
+			r[c].assignTo(*props[c]);
+		}
+	}
+
+	const EntitySchema& schema;
+	size_t columns;
+	Values cells;
+	vector<bool> alive;
+	vector<size_t> free;
+	size_t live;
+	vector<Index*> indexes;
+};
+
+/*! Cursor over a list of candidate slots, or every slot of a table, which
+ * checks that each row still matches as it is stepped to.
+ */
+class MemoryPersistenceApi::Cursor : public PersistenceCursor
+{
+public:
+	Cursor(Table& t, const Criteria& criteria)
+		: table_(t), criteria_(criteria), scan_(false), next_(0), current_(NO_SLOT), ranged_(false) {
+		scan_ = !t.candidates(criteria_, slots_);
+	}
+
+	Cursor(Table& t, size_t column, const PrimitiveValue& low, const PrimitiveValue& high, const vector<size_t>& slots)
+		: table_(t), scan_(false), slots_(slots), next_(0), current_(NO_SLOT),
+		ranged_(true), column_(column), low_(low), high_(high) {}
+
+	virtual bool step() throw(Entception&) {
+		size_t end = scan_ ? table_.slots() : slots_.size();
+		while ( next_ < end ) {
+			size_t slot = scan_ ? next_ : slots_[next_];
+			++next_;
+			if ( matches(slot) ) {
+				current_ = slot;
+				return true;
+			}
+		}
+		current_ = NO_SLOT;
+		return false;
+	}
+
+	virtual void read(Entity& ent) throw(Entception&) {
+		if ( ent.properties().size() != table_.columns ) {
+			throw LoadEntception(&ent, "Entity does not match the shape of the cursor.");
+		}
+		if ( current_ == NO_SLOT || !table_.alive[current_] ) {
+			throw LoadEntception(&ent, "The cursor is not on a row.");
+		}
+		table_.read(current_, ent);
+	}
+
+private:
+	bool matches(size_t slot) {
+		if ( !table_.matches(slot, criteria_) )	return false;
+		if ( !ranged_ )	return true;
+		const PrimitiveValue& v = table_.row(slot)[column_];
+		return !(v < low_) && !(high_ < v);
+	}
+
+	Table& table_;
+	Criteria criteria_;
+	bool scan_;
+	vector<size_t> slots_;
+	size_t next_;
+	size_t current_;
+
+	bool ranged_;
+	size_t column_;
+	PrimitiveValue low_;
+	PrimitiveValue high_;
+};
+
+MemoryPersistenceApi::~MemoryPersistenceApi()
+{
+	for ( auto it = tables_.begin(); it != tables_.end(); ++it ) {
+		delete it->second;
+	}
+}
+
+MemoryPersistenceApi::Table& MemoryPersistenceApi::tableFor(const Entity& ent) throw(Entception&)
+{
+	const EntitySchema& schema = ent.schema();
+	auto it = tables_.find(&schema);
+	if ( it != tables_.end() )	return *it->second;
+
+	Table* t = new Table(schema);
+	try {
+		if ( schema.primaryKey() >= 0 ) {
+			t->indexes.push_back(new Index(schema.primaryKey(), false, true));
+		}
+		const vector<IndexSpec>& specs = indexSpecs_[&schema];
+		for ( size_t i = 0; i < specs.size(); ++i ) {
+			buildIndex(*t, specs[i]);
+		}
+	} catch (Entception& e) {
+		delete t;
+		throw;
+	}
+
+	tables_[&schema] = t;
+	return *t;
+}
+
+void MemoryPersistenceApi::buildIndex(Table& t, const IndexSpec& spec) throw(Entception&)
+{
+	int column = t.schema.indexOf(spec.property.c_str());
+	if ( column < 0 ) {
+		throw Entception(string("No property to index named ") + t.schema.entitytype() + "." + spec.property);
+	}
+	if ( t.indexOn(column, spec.ordered) )	return;
+
+	Index* index = new Index(column, spec.ordered, false);
+	for ( size_t s = 0; s < t.slots(); ++s ) {
+		if ( t.alive[s] )	index->insert(t.row(s)[column], s);
+	}
+	t.indexes.push_back(index);
+}
+
+void MemoryPersistenceApi::addIndex(const char* entitytype, const char* property, bool ordered) throw(Entception&)
+{
+	const EntitySchema* schema = EntitySchema::forType(entitytype);
+	IndexSpec spec;
+	spec.property = property;
+	spec.ordered = ordered;
+
+	auto it = tables_.find(schema);
+	if ( it != tables_.end() ) {
+		buildIndex(*it->second, spec);
+	}
+	indexSpecs_[schema].push_back(spec);
+}
+
+void MemoryPersistenceApi::addHashIndex(const char* entitytype, const char* property) throw(Entception&)
+{
+	addIndex(entitytype, property, false);
+}
+
+void MemoryPersistenceApi::addOrderedIndex(const char* entitytype, const char* property) throw(Entception&)
+{
+	addIndex(entitytype, property, true);
+}
+
+MemoryPersistenceApi::Criteria MemoryPersistenceApi::matchCriteria(const Entity& ent, PropertyMask mask)
+{
+	Entity::PropertyList props = ent.properties();
+	int key = ent.schema().primaryKey();
+
+	Criteria match;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		bool wanted = key >= 0 ? static_cast<int>(i) == key : (mask & (PropertyMask(1) << i)) != 0;
+		if ( wanted )	match.push_back(make_pair(i, PrimitiveValue::of(*props[i])));
+	}
+	return match;
+}
+
+void MemoryPersistenceApi::logUndo(Table& t, Undo::Operation op, size_t slot)
+{
+	if ( savepoints_.empty() )	return;
+
+	undo_.push_back(Undo());
+	Undo& u = undo_.back();
+	u.table = &t;
+	u.op = op;
+	u.slot = slot;
+	if ( op != Undo::INSERTED ) {
+		const PrimitiveValue* r = t.row(slot);
+		u.old.assign(r, r + t.columns);
+	}
+}
+
+bool MemoryPersistenceApi::save(const Entity& ent) throw(Entception&)
+{
+	Table& t = tableFor(ent);
+	Entity::PropertyList props = ent.properties();
+
+	Values values;
+	values.reserve(props.size());
+	Criteria unique;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		values.push_back(PrimitiveValue::of(*props[i]));
+	}
+	if ( t.schema.primaryKey() >= 0 ) {
+		unique.push_back(make_pair(size_t(t.schema.primaryKey()), values[t.schema.primaryKey()]));
+	}
+
+	if ( const char* column = t.uniqueConflict(unique, NO_SLOT) ) {
+		throw SaveEntception(&ent, string("UNIQUE constraint failed: ") + t.schema.entitytype() + "." + column);
+	}
+
+	size_t slot = t.insert(values);
+	logUndo(t, Undo::INSERTED, slot);
+	return true;
+}
+
+size_t MemoryPersistenceApi::updateRows(Table& t, const Criteria& match, const Criteria& values, const Entity& ent) throw(Entception&)
+{
+	vector<size_t> slots;
+	t.findAll(match, slots);
+
+	// Check every row before changing any, so a failed update changes nothing.
+	for ( size_t i = 0; i < slots.size(); ++i ) {
+		const char* column = t.uniqueConflict(values, slots[i]);
+		if ( !column && slots.size() > 1 ) {
+			for ( size_t v = 0; v < values.size() && !column; ++v ) {
+				Index* index = t.indexOn(values[v].first, false);
+				if ( index && index->unique )	column = t.schema.name(index->column);
+			}
+		}
+		if ( column ) {
+			throw UpdateEntception(&ent, string("UNIQUE constraint failed: ") + t.schema.entitytype() + "." + column);
+		}
+	}
+
+	for ( size_t i = 0; i < slots.size(); ++i ) {
+		logUndo(t, Undo::UPDATED, slots[i]);
+		for ( size_t v = 0; v < values.size(); ++v ) {
+			t.set(slots[i], values[v].first, values[v].second);
+		}
+	}
+	return slots.size();
+}
+
+bool MemoryPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	if ( !ent.isSubset(updates) ) {
+		throw UpdateEntception(&ent, "Updates are not a valid subset.");
+	}
+
+	AbstractPropertyCollection::PropertyArray props = updates.props();
+	if ( props.empty() ) {
+		return false;
+	}
+
+	Table& t = tableFor(ent);
+	Criteria values;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		values.push_back(make_pair(size_t(t.schema.indexOf(props[i]->propertyName())), PrimitiveValue::of(*props[i])));
+	}
+
+	return updateRows(t, matchCriteria(ent, ~PropertyMask(0)), values, ent) > 0;
+}
+
+bool MemoryPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	// Without a key, the unmodified properties could match other rows too.
+	const AbstractProperty* pk = ent.primaryKey();
+	if ( !pk ) {
+		throw UpdateEntception(&ent, "The entity type has no primary key, so the entity can not be found.");
+	}
+	if ( pk->dirty() ) {
+		throw UpdateEntception(&ent, "The primary key has been modified, so the entity can not be found.");
+	}
+
+	Entity::PropertyList props = ent.properties();
+	Criteria values;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( dirty & (PropertyMask(1) << i) ) {
+			values.push_back(make_pair(i, PrimitiveValue::of(*props[i])));
+		}
+	}
+	if ( values.empty() ) {
+		return false;
+	}
+
+	return updateRows(tableFor(ent), matchCriteria(ent, 0), values, ent) > 0;
+}
+
+bool MemoryPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( !ent.isSubset(criteria) ) {
+		throw LoadEntception(&ent, "Load criteria are not a valid subset.");
+	}
+
+	Table& t = tableFor(ent);
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	Criteria match;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		match.push_back(make_pair(size_t(t.schema.indexOf(props[i]->propertyName())), PrimitiveValue::of(*props[i])));
+	}
+
+	size_t slot = t.findFirst(match);
+	if ( slot == NO_SLOT ) {
+		return false;
+	}
+	t.read(slot, ent);
+	return true;
+}
+
+PersistenceCursor* MemoryPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( !shape.isSubset(criteria) ) {
+		throw LoadEntception(&shape, "Query criteria are not a valid subset.");
+	}
+
+	Table& t = tableFor(shape);
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	Criteria match;
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		match.push_back(make_pair(size_t(t.schema.indexOf(props[i]->propertyName())), PrimitiveValue::of(*props[i])));
+	}
+	return new Cursor(t, match);
+}
+
+PersistenceCursor* MemoryPersistenceApi::openRangeCursor(const Entity& shape, const char* property,
+		const PrimitiveValue& low, const PrimitiveValue& high) throw(Entception&)
+{
+	Table& t = tableFor(shape);
+	int column = t.schema.indexOf(property);
+	Index* index = column < 0 ? NULL : t.indexOn(column, true);
+	if ( !index ) {
+		throw LoadEntception(&shape, string("No ordered index on ") + property);
+	}
+
+	vector<size_t> slots;
+	if ( !(high < low) ) {
+		auto end = index->tree.upper_bound(high);
+		for ( auto it = index->tree.lower_bound(low); it != end; ++it ) {
+			slots.push_back(it->second);
+		}
+	}
+	return new Cursor(t, column, low, high, slots);
+}
+
+bool MemoryPersistenceApi::del(const Entity& ent) throw(Entception&)
+{
+	Criteria match = matchCriteria(ent, ~PropertyMask(0));
+	if ( match.empty() ) {
+		// Without criteria every entity of this type would be deleted.
+		throw DelEntception(&ent, "Entity has no properties to match on");
+	}
+
+	Table& t = tableFor(ent);
+	vector<size_t> slots;
+	t.findAll(match, slots);
+	for ( size_t i = 0; i < slots.size(); ++i ) {
+		logUndo(t, Undo::DELETED, slots[i]);
+		t.remove(slots[i]);
+	}
+	return !slots.empty();
+}
+
+void MemoryPersistenceApi::beginTransaction() throw(Entception&)
+{
+	savepoints_.push_back(undo_.size());
+}
+
+void MemoryPersistenceApi::commitTransaction() throw(Entception&)
+{
+	if ( savepoints_.empty() ) {
+		throw Entception("No transaction to commit");
+	}
+
+	// The changes now belong to the enclosing transaction, if any.
+	savepoints_.pop_back();
+	if ( savepoints_.empty() )	undo_.clear();
+}
+
+void MemoryPersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	if ( savepoints_.empty() ) {
+		throw Entception("No transaction to roll back");
+	}
+
+	size_t mark = savepoints_.back();
+	savepoints_.pop_back();
+
+	while ( undo_.size() > mark ) {
+		Undo& u = undo_.back();
+		Table& t = *u.table;
+		switch ( u.op ) {
+			case Undo::INSERTED:
+				t.remove(u.slot);
+				break;
+			case Undo::DELETED:
+				t.restore(u.slot, u.old);
+				break;
+			case Undo::UPDATED:
+				for ( size_t c = 0; c < t.columns; ++c ) {
+					t.set(u.slot, c, u.old[c]);
+				}
+				break;
+		}
+		undo_.pop_back();
+	}
+}
+
+size_t MemoryPersistenceApi::count(const char* entitytype) const
+{
+	auto it = tables_.find(EntitySchema::forType(entitytype));
+	return it == tables_.end() ? 0 : it->second->live;
+}
+
+void MemoryPersistenceApi::clear()
+{
+	for ( auto it = tables_.begin(); it != tables_.end(); ++it ) {
+		Table& t = *it->second;
+		for ( size_t s = 0; s < t.slots(); ++s ) {
+			if ( t.alive[s] )	t.remove(s);
+		}
+	}
+	undo_.clear();
+}
+
+}	// End namespace ent
+}	// End namespace tdk
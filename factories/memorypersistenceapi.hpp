@@ -0,0 +1,141 @@
+#ifndef MEMORY_PERSISTENCE_HPP
+#define MEMORY_PERSISTENCE_HPP
+/*! \file	memorypersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "entities/entity.hpp"
+#include "entities/primitivevalue.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Persistence that keeps entities in memory, with the same behaviour as the
+ * SQLite persistence.
+ *
+ * There is a table per entity type, created when the type is first used. Rows
+ * are stored one after another in a single array of values, with the slots of
+ * deleted rows reused by later saves. Loads, queries, updates and deletes scan
+ * the table, unless one of their properties is indexed.
+ *
+ * The primary key of an entity type always has a unique hash index. Further
+ * indexes can be added on any property: hash indexes for loading by equal
+ * values, and ordered indexes, which can also be iterated over a range of
+ * values with openRangeCursor.
+ *
+ * ~~~{.cpp}
+ * MemoryPersistenceApi memory;
+ * memory.addHashIndex("person", "email");
+ * memory.addOrderedIndex("person", "age");
+ * ~~~
+ *
+ * Transactions are supported, and nest, using an undo log. As with SQLite,
+ * view properties loaded from this persistence point in to its storage, and
+ * are valid until the table is next changed.
+ *
+ * This persistence is not thread safe.
+ */
+class MemoryPersistenceApi : public PersistenceApi
+{
+public:
+	MemoryPersistenceApi() {}
+	virtual ~MemoryPersistenceApi();
+
+	/*! Save an entity as a new row.
+	 * \throws	SaveEntception	If a row with the same primary key exists.
+	 */
+	virtual bool save(const Entity& ent) throw(Entception&);
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+	virtual bool del(const Entity& ent) throw(Entception&);
+
+	/*! Open a cursor over the matching rows. Rows saved while the cursor is
+	 * open may or may not be stepped to.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	/*! Add a hash index on a property of an entity type. If the entity type
+	 * has no table yet, the index is built when it does.
+	 * \throws	Entception	If the entity type has no such property.
+	 */
+	void addHashIndex(const char* entitytype, const char* property) throw(Entception&);
+
+	/*! Add an ordered index on a property of an entity type. */
+	void addOrderedIndex(const char* entitytype, const char* property) throw(Entception&);
+
+	/*! Open a cursor over the rows whose value of a property is between two
+	 * values, inclusive, in ascending order of that value.
+	 * \throws	LoadEntception	If the property has no ordered index.
+	 */
+	PersistenceCursor* openRangeCursor(const Entity& shape, const char* property,
+			const PrimitiveValue& low, const PrimitiveValue& high) throw(Entception&);
+
+	/*! Get the number of rows of an entity type. */
+	size_t count(const char* entitytype) const;
+
+	/*! Delete every row of every entity type. Indexes are kept. */
+	void clear();
+
+private:
+	struct Index;
+	struct Table;
+	class Cursor;
+
+	/*! Property values that rows must have, by column. */
+	typedef std::vector< std::pair<size_t, PrimitiveValue> > Criteria;
+
+	struct IndexSpec {
+		std::string property;
+		bool ordered;
+	};
+
+	/*! A change to undo if the transaction it was made in is rolled back. */
+	struct Undo {
+		typedef enum {
+			INSERTED,
+			DELETED,
+			UPDATED,
+		} Operation;
+
+		Table* table;
+		Operation op;
+		size_t slot;
+		std::vector<PrimitiveValue> old;	// The row before it was deleted or updated.
+	};
+
+	Table& tableFor(const Entity& ent) throw(Entception&);
+	void addIndex(const char* entitytype, const char* property, bool ordered) throw(Entception&);
+	void buildIndex(Table& t, const IndexSpec& spec) throw(Entception&);
+
+	// Criteria matching the entity's row, by its key or the properties in a mask.
+	static Criteria matchCriteria(const Entity& ent, PropertyMask mask);
+
+	// Apply new values to every row matching the criteria.
+	size_t updateRows(Table& t, const Criteria& match, const Criteria& values, const Entity& ent) throw(Entception&);
+
+	void logUndo(Table& t, Undo::Operation op, size_t slot);
+
+	MemoryPersistenceApi(const MemoryPersistenceApi&);
+	MemoryPersistenceApi& operator = (const MemoryPersistenceApi&);
+
+	std::unordered_map<const EntitySchema*, Table*> tables_;
+	std::unordered_map<const EntitySchema*, std::vector<IndexSpec> > indexSpecs_;
+	std::vector<Undo> undo_;
+	std::vector<size_t> savepoints_;	// Size of the undo log as each transaction began.
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
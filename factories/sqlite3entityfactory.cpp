@@ -11,20 +11,19 @@ namespace tdk {
 namespace ent {
 
 
-Sqlite3EntityFactory::Sqlite3EntityFactory(const char* dbFile) throw(Entception&)
+Sqlite3EntityFactory::Sqlite3EntityFactory(const char* dbFile, const Sqlite3Options& options) throw(Entception&)
 {
 	// Attempt to open the database.
-	int res = sqlite3_open(dbFile, &db_);
-	
-	if ( res != SQLITE_OK ) {
-		throw Entception("Failed to open database file");
-	}
+	db_ = openSqlite3(dbFile, options);
 
 	persistence_.setDb(db_);
 }
 
 Sqlite3EntityFactory::~Sqlite3EntityFactory()
 {
+	// Cached statements would keep the connection from closing.
+	persistence_.clearStatementCache();
+
 	int res = sqlite3_close(db_);
 	
 	if ( res != SQLITE_OK ) {
@@ -6,6 +6,7 @@
  */
 
 #include "entities/entityfactory.hpp"
+#include "entities/factories/sqlite3options.hpp"
 #include "entities/factories/sqlite3persistenceapi.hpp"
 
 struct sqlite3;
@@ -15,6 +16,10 @@ namespace ent {
 
 /*! Entity factory that installs an SQLite3 persistence API in to the entities
  * it creates.
+ *
+ * All the entities share a single connection, so the factory and its entities
+ * must only be used from one thread at a time. Use Sqlite3PooledEntityFactory
+ * to share a database between threads.
  */
 class Sqlite3EntityFactory : public EntityFactory
 {
@@ -22,15 +27,19 @@ public:
 	/*! Create an SQLite3 entitiy factory.
 	 *
 	 * \param	dbFile	Name of the database file to open and operate on.
+	 * \param	options	Options to open the database with, such as one of the
+	 *			Sqlite3Options presets.
 	 *
-	 * \throw	std::runtime_exception	If the database file can not be opened.
+	 * \throw	Entception	If the database file can not be opened, or the
+	 *			options can not be applied.
 	 */
-	Sqlite3EntityFactory(const char* dbFile) throw(Entception&);
+	Sqlite3EntityFactory(const char* dbFile, const Sqlite3Options& options = Sqlite3Options()) throw(Entception&);
 
 	~Sqlite3EntityFactory();
 	
 private:
 	virtual void installPersistenceApi(Entity* e);
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
 	Sqlite3PersistenceApi persistence_;
 	sqlite3* db_;
 };
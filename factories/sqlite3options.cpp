@@ -0,0 +1,173 @@
+/*! \file	sqlite3options.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "sqlite3options.hpp"
+
+using namespace std;
+using namespace tdk::ent;
+
+namespace {
+
+const char* journalModeName(Sqlite3Options::JournalMode mode)
+{
+	switch ( mode ) {
+		case Sqlite3Options::JOURNAL_DELETE:	return "delete";
+		case Sqlite3Options::JOURNAL_TRUNCATE:	return "truncate";
+		case Sqlite3Options::JOURNAL_PERSIST:	return "persist";
+		case Sqlite3Options::JOURNAL_MEMORY:	return "memory";
+		case Sqlite3Options::JOURNAL_WAL:		return "wal";
+		case Sqlite3Options::JOURNAL_OFF:		return "off";
+		default:								return NULL;
+	}
+}
+
+void pragma(sqlite3* db, const string& sql) throw(Entception&)
+{
+	char* sqliteErr = NULL;
+	if ( sqlite3_exec(db, sql.c_str(), NULL, NULL, &sqliteErr) != SQLITE_OK ) {
+		string msg(sql);
+		msg += " failed: ";
+		msg += sqliteErr ? sqliteErr : sqlite3_errmsg(db);
+		sqlite3_free(sqliteErr);
+		throw Entception(msg);
+	}
+}
+
+/*! Change the journal mode. The pragma returns the mode now in effect, which
+ * differs from the one asked for if it could not be changed, such as WAL on an
+ * in memory database.
+ */
+void setJournalMode(sqlite3* db, const char* mode) throw(Entception&)
+{
+	string sql("PRAGMA journal_mode=");
+	sql += mode;
+
+	sqlite3_stmt* stmt = NULL;
+	if ( sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK ) {
+		sqlite3_finalize(stmt);
+		throw Entception(sql + " failed: " + sqlite3_errmsg(db));
+	}
+
+	bool changed = sqlite3_step(stmt) == SQLITE_ROW
+		&& strcmp(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), mode) == 0;
+	sqlite3_finalize(stmt);
+
+	if ( !changed ) {
+		throw Entception(sql + " failed: the journal mode could not be changed");
+	}
+}
+
+}	// End anon namespace
+
+
+namespace tdk {
+namespace ent {
+
+Sqlite3Options::Sqlite3Options()
+	: journalMode(JOURNAL_DEFAULT), synchronous(SYNCHRONOUS_DEFAULT), tempStore(TEMP_STORE_DEFAULT),
+	mmapSize(-1), cacheSize(0), busyTimeoutMs(0), readOnly(false), create(true), noMutex(false)
+{
+}
+
+Sqlite3Options Sqlite3Options::durable()
+{
+	Sqlite3Options o;
+	o.journalMode = JOURNAL_WAL;
+	o.synchronous = SYNCHRONOUS_FULL;
+	o.busyTimeoutMs = 5000;
+	return o;
+}
+
+Sqlite3Options Sqlite3Options::throughput()
+{
+	Sqlite3Options o;
+	o.journalMode = JOURNAL_WAL;
+	o.synchronous = SYNCHRONOUS_NORMAL;
+	o.tempStore = TEMP_STORE_MEMORY;
+	o.mmapSize = 256 << 20;
+	o.cacheSize = -64 * 1024;	// 64MB, as negative sizes are in KB.
+	o.busyTimeoutMs = 5000;
+	o.noMutex = true;
+	return o;
+}
+
+Sqlite3Options Sqlite3Options::readOnlyMmap()
+{
+	Sqlite3Options o;
+	o.tempStore = TEMP_STORE_MEMORY;
+	o.mmapSize = int64_t(1) << 30;
+	o.cacheSize = -16 * 1024;
+	o.busyTimeoutMs = 5000;
+	o.readOnly = true;
+	o.create = false;
+	o.noMutex = true;
+	return o;
+}
+
+int Sqlite3Options::openFlags() const
+{
+	int flags = readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+	if ( create && !readOnly )	flags |= SQLITE_OPEN_CREATE;
+	if ( noMutex )	flags |= SQLITE_OPEN_NOMUTEX;
+	return flags;
+}
+
+void Sqlite3Options::apply(sqlite3* db) const throw(Entception&)
+{
+	if ( busyTimeoutMs > 0 ) {
+		sqlite3_busy_timeout(db, busyTimeoutMs);
+	}
+
+	// The journal mode goes first, as it takes a lock that waits on the
+	// busy timeout.
+	if ( const char* mode = journalModeName(journalMode) ) {
+		setJournalMode(db, mode);
+	}
+
+	stringstream sql;
+	if ( synchronous != SYNCHRONOUS_DEFAULT ) {
+		sql << "PRAGMA synchronous=" << static_cast<int>(synchronous) << ';';
+	}
+	if ( tempStore != TEMP_STORE_DEFAULT ) {
+		sql << "PRAGMA temp_store=" << static_cast<int>(tempStore) << ';';
+	}
+	if ( mmapSize >= 0 ) {
+		sql << "PRAGMA mmap_size=" << mmapSize << ';';
+	}
+	if ( cacheSize != 0 ) {
+		sql << "PRAGMA cache_size=" << cacheSize << ';';
+	}
+
+	if ( !sql.str().empty() ) {
+		pragma(db, sql.str());
+	}
+}
+
+sqlite3* openSqlite3(const char* dbFile, const Sqlite3Options& options) throw(Entception&)
+{
+	sqlite3* db = NULL;
+	if ( sqlite3_open_v2(dbFile, &db, options.openFlags(), NULL) != SQLITE_OK ) {
+		string msg("Failed to open database file: ");
+		msg += db ? sqlite3_errmsg(db) : "out of memory";
+		sqlite3_close(db);
+		throw Entception(msg);
+	}
+
+	try {
+		options.apply(db);
+	} catch (Entception& e) {
+		sqlite3_close(db);
+		throw;
+	}
+	return db;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
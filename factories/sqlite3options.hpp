@@ -0,0 +1,105 @@
+#ifndef SQLITE3_OPTIONS_HPP
+#define SQLITE3_OPTIONS_HPP
+/*! \file	sqlite3options.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stdint.h>
+
+#include "entities/entception.hpp"
+
+// Forward declaration.
+struct sqlite3;
+
+namespace tdk {
+namespace ent {
+
+/*! Options applied to SQLite3 connections when they are opened. Anything left
+ * at its default keeps SQLite's own default, or that of the database file.
+ *
+ * There are presets for common uses, which can be adjusted further:
+ *
+ * ~~~{.cpp}
+ * Sqlite3Options opts = Sqlite3Options::throughput();
+ * opts.mmapSize = 1 << 30;
+ * Sqlite3EntityFactory factory("app.db", opts);
+ * ~~~
+ */
+struct Sqlite3Options
+{
+	typedef enum {
+		JOURNAL_DEFAULT,
+		JOURNAL_DELETE,
+		JOURNAL_TRUNCATE,
+		JOURNAL_PERSIST,
+		JOURNAL_MEMORY,
+		JOURNAL_WAL,
+		JOURNAL_OFF,
+	} JournalMode;
+
+	typedef enum {
+		SYNCHRONOUS_DEFAULT = -1,
+		SYNCHRONOUS_OFF = 0,
+		SYNCHRONOUS_NORMAL = 1,
+		SYNCHRONOUS_FULL = 2,
+		SYNCHRONOUS_EXTRA = 3,
+	} Synchronous;
+
+	typedef enum {
+		TEMP_STORE_DEFAULT = 0,
+		TEMP_STORE_FILE = 1,
+		TEMP_STORE_MEMORY = 2,
+	} TempStore;
+
+	/*! Options that leave everything at SQLite's defaults. */
+	Sqlite3Options();
+
+	/*! Preset for data that must survive a power loss once committed. WAL
+	 * journal, with a sync on every commit.
+	 */
+	static Sqlite3Options durable();
+
+	/*! Preset for the most writes and reads per second. WAL journal, synced
+	 * at checkpoints only, with a large page cache, memory mapped I/O and
+	 * temporary tables in memory. A power loss can lose the most recent
+	 * commits, but never corrupts the database.
+	 */
+	static Sqlite3Options throughput();
+
+	/*! Preset for read only access to a database, such as a reader in a
+	 * connection pool, with the whole file memory mapped.
+	 */
+	static Sqlite3Options readOnlyMmap();
+
+	/*! Get the flags to pass to sqlite3_open_v2. */
+	int openFlags() const;
+
+	/*! Apply the options that are set with pragmas to an open connection.
+	 * \throws	Entception	If an option could not be applied, including if
+	 *			the journal mode could not be changed to the one asked for.
+	 */
+	void apply(sqlite3* db) const throw(Entception&);
+
+	JournalMode journalMode;
+	Synchronous synchronous;
+	TempStore tempStore;
+	int64_t mmapSize;	//!< Bytes of the file to memory map, or -1 for the default.
+	int cacheSize;		//!< Page cache size as for PRAGMA cache_size, or 0 for the default.
+	int busyTimeoutMs;	//!< Milliseconds to retry a locked database for, or 0 to fail at once.
+	bool readOnly;		//!< Open the database read only.
+	bool create;		//!< Create the database file if it does not exist.
+	bool noMutex;		//!< Open without SQLite's connection mutex. The connection
+						//!< must then only be used by one thread at a time.
+};
+
+/*! Open a connection to a database file and apply options to it.
+ * \throws	Entception	If the file could not be opened, or the options could
+ *			not be applied. Nothing is left open.
+ */
+sqlite3* openSqlite3(const char* dbFile, const Sqlite3Options& options) throw(Entception&);
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
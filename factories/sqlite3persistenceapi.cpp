@@ -4,8 +4,6 @@
  */
 #include <sstream>
 
-#include <iostream>
-
 #include <sqlite3.h>
 
 #include "sqlite3persistenceapi.hpp"
@@ -15,100 +13,304 @@ using namespace tdk::ent;
 
 namespace {
 
-class Sqlite3ReadVisitor : public ReadVisitor
+/*! Read visitor which binds each visited value to the next parameter of a
+ * prepared statement.
+ *
+ * Strings and blobs are bound without being copied, so the visited primitive
+ * must remain valid until the statement has been stepped. This is the case for
+ * the duration of a persistence call, as the entity can not change during it.
+ */
+class Sqlite3BindVisitor : public ReadVisitor
 {
 public:
-	Sqlite3ReadVisitor(stringstream& s) : ss(s) {}
+	Sqlite3BindVisitor(sqlite3_stmt* stmt) : stmt_(stmt), index_(0) {}
 
 	virtual bool visit(const bool& b) {
-		ss << (b ? "true" : "false");
-		return true;
+		return sqlite3_bind_int(stmt_, ++index_, b ? 1 : 0) == SQLITE_OK;
 	}
-	
+
 	virtual bool visit(const char& c) {
-		return false;
+		// The char is a temporary, so SQLite has to take its own copy.
+		return sqlite3_bind_text(stmt_, ++index_, &c, 1, SQLITE_TRANSIENT) == SQLITE_OK;
 	}
 
 	virtual bool visit(const int& i) {
-		ss << i;
-		return true;
+		return sqlite3_bind_int(stmt_, ++index_, i) == SQLITE_OK;
 	}
 
-	virtual bool visit(const unsigned int& i) {
-		ss << i;
-		return true;
+	virtual bool visit(const unsigned int& ui) {
+		return sqlite3_bind_int64(stmt_, ++index_, ui) == SQLITE_OK;
 	}
 
 	virtual bool visit(const double& d) {
-		ss << d;
-		return true;
+		return sqlite3_bind_double(stmt_, ++index_, d) == SQLITE_OK;
 	}
 
-	virtual bool visit(const StringPrimitive& str)
-	{
-		ss << "'";
-		for ( unsigned int i = 0; i < str.len(); ++i ) {
-			if ( str.data()[i] == '\'' ) {
-				ss << "''";
-			} else {
-				ss << str.data()[i];
-			}
-		}
-		ss << "'";
-		return true;
+	virtual bool visit(const StringPrimitive& str) {
+		return sqlite3_bind_text(stmt_, ++index_, str.data(), str.len(), SQLITE_STATIC) == SQLITE_OK;
+	}
+
+	virtual bool visit(const int64_t& i) {
+		return sqlite3_bind_int64(stmt_, ++index_, i) == SQLITE_OK;
 	}
 
+	virtual bool visit(const BlobPrimitive& blob) {
+		// A NULL pointer would bind NULL, rather than an empty blob.
+		if ( !blob.data() )	return sqlite3_bind_zeroblob(stmt_, ++index_, 0) == SQLITE_OK;
+		return sqlite3_bind_blob(stmt_, ++index_, blob.data(), blob.len(), SQLITE_STATIC) == SQLITE_OK;
+	}
+
+	virtual ~Sqlite3BindVisitor() {}
 
-	virtual ~Sqlite3ReadVisitor() {}
-	
 private:
-	stringstream& ss;
+	sqlite3_stmt* stmt_;
+	int index_;		// Index of the last bound parameter. SQLite's are 1 based.
 };
 
 
-class Sqlite3WriteVisitor : public WriteVisitor
+/*! Write visitor which assigns the columns of the current result row of a
+ * statement to the visited properties, in column order. The columns are read
+ * with their native type, so there is no conversion through text.
+ *
+ * Strings and blobs point directly in to SQLite's column memory, which is only
+ * valid until the statement is stepped or reset. Properties take their own copy
+ * when converting from the primitive.
+ */
+class Sqlite3ColumnVisitor : public WriteVisitor
 {
 public:
-	const char* valStr;	// Value to assign, but as a string from sqlite3 callback.
+	Sqlite3ColumnVisitor(sqlite3_stmt* stmt) : stmt_(stmt), col_(0) {}
 
 	virtual void visit(bool& b) {
-
+		b = sqlite3_column_int(stmt_, col_++) != 0;
 	}
 
 	virtual void visit(char& c) {
-
+		const unsigned char* text = sqlite3_column_text(stmt_, col_++);
+		c = text ? static_cast<char>(text[0]) : '\0';
 	}
 
 	virtual void visit(int& i) {
-
+		i = sqlite3_column_int(stmt_, col_++);
 	}
 
 	virtual void visit(unsigned int& ui) {
+		ui = static_cast<unsigned int>(sqlite3_column_int64(stmt_, col_++));
+	}
 
+	virtual void visit(double& d) {
+		d = sqlite3_column_double(stmt_, col_++);
 	}
 
 	virtual void visit(StringPrimitive& str) {
+		// The text must be fetched before the length, as fetching it may
+		// convert the column and change its length.
+		const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, col_));
+		int len = sqlite3_column_bytes(stmt_, col_++);
+		str = text ? StringPrimitive(text, len) : StringPrimitive("", 0);
+	}
+
+	virtual void visit(int64_t& i) {
+		i = sqlite3_column_int64(stmt_, col_++);
+	}
 
+	virtual void visit(BlobPrimitive& blob) {
+		const void* data = sqlite3_column_blob(stmt_, col_);
+		int len = sqlite3_column_bytes(stmt_, col_++);
+		blob = BlobPrimitive(data, data ? len : 0);
 	}
+
+	virtual ~Sqlite3ColumnVisitor() {}
+
+private:
+	sqlite3_stmt* stmt_;
+	int col_;	// Index of the next column to read. SQLite's are 0 based.
+};
+
+/*! Resets a cached statement when it goes out of scope, so that it is ready to
+ * be bound and stepped again by the next operation using it.
+ */
+class StatementReset
+{
+public:
+	StatementReset(sqlite3_stmt* stmt) : stmt_(stmt) {}
+	~StatementReset() { sqlite3_reset(stmt_); }
+private:
+	sqlite3_stmt* stmt_;
 };
 
-/** Sqlite3 callback implementation for entity saving operations.
+/*! Build a statement cache key.
  *
- * \param	propDeque	The context should be a pointer to a deque of AbstractProperty pointers.
- * \param	colCount	Number of columns retreived.
- * \param	colNames	Names of the columns. Should match properties in an Entity.
- * \param	colData		Data retreived for each column.
+ * The cache key is the operation, the entity type and the mask of the columns
+ * involved in the statement. The entity type's schema fixes the order of its
+ * properties, so the mask is enough to tell any two statements apart.
  */
-int save_callback(void* propDeque, int colCount, char** colNames, char** colData)
+string statementKey(const char* op, const Entity& ent, PropertyMask mask)
 {
-	const deque<AbstractProperty*>& props = *reinterpret_cast< deque<AbstractProperty*>* >(propDeque);
+	static const char digits[] = "0123456789abcdef";
+
+	string key(op);
+	key += ' ';
+	key += ent.entitytype();
+	key += ' ';
+	do {
+		key += digits[mask & 0xf];
+		mask >>= 4;
+	} while ( mask );
+	return key;
+}
 
-	cout << "We have " << colCount << " columns" << endl;
+/*! Write the names of the properties as a list of parameter assignments or
+ * comparisons, e.g. "name=?,age=?".
+ */
+template <typename Props>
+void writeParams(stringstream& sql, const Props& props, const char* separator)
+{
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( i > 0 ) {
+			sql << separator;
+		}
+		sql << props[i]->propertyName() << "=?";
+	}
+}
 
-	Sqlite3WriteVisitor vis;
+/*! Bind the values of the properties to the next parameters of a statement.
+ * \return	The property that could not be bound.
+ * \retval	NULL	All the properties were bound.
+ */
+template <typename Props>
+const AbstractProperty* bindProperties(Sqlite3BindVisitor& binder, const Props& props)
+{
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( !props[i]->acceptReader(binder) ) {
+			return props[i];
+		}
+	}
+	return NULL;
+}
+
+/*! The properties of a collection, in the order of the entity properties that
+ * they name. Statements built from the selection only depend on its mask, so
+ * collections naming the same properties in any order share statements. It
+ * has the parts of the array interface needed by the statement builders.
+ */
+class CollectionSelection
+{
+public:
+	CollectionSelection(const Entity& ent, const AbstractPropertyCollection& collection)
+		: mask_(0), count_(0), valid_(true)
+	{
+		const EntitySchema& schema = ent.schema();
+		AbstractPropertyCollection::PropertyArray props = collection.props();
+		AbstractProperty* byIndex[MAX_PROPERTIES];
+
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			int index = schema.indexOf(props[i]->propertyName());
+			if ( index < 0 ) {
+				valid_ = false;
+				return;
+			}
+			byIndex[index] = props[i];
+			mask_ |= PropertyMask(1) << index;
+		}
+
+		for ( size_t i = 0; i < schema.size(); ++i ) {
+			if ( mask_ & (PropertyMask(1) << i) )	props_[count_++] = byIndex[i];
+		}
+	}
 
+	/*! Whether or not the collection is a subset of the entity. */
+	bool valid() const { return valid_; }
+	PropertyMask mask() const { return mask_; }
 
-	return 0;
+	size_t size() const { return count_; }
+	bool empty() const { return count_ == 0; }
+	AbstractProperty* operator [] (size_t i) const { return props_[i]; }
+
+private:
+	PropertyMask mask_;
+	AbstractProperty* props_[MAX_PROPERTIES];
+	size_t count_;
+	bool valid_;
+};
+
+/*! The properties used to find an existing entity. This is the primary key if
+ * the entity has one, and otherwise all of its properties. It has the parts of
+ * the array interface needed by the statement builders.
+ */
+class MatchProperties
+{
+public:
+	MatchProperties(const Entity& ent) : props_(ent.properties()), key_(ent.primaryKey()) {}
+	size_t size() const { return key_ ? 1 : props_.size(); }
+	bool empty() const { return size() == 0; }
+	AbstractProperty* operator [] (size_t i) const { return key_ ? key_ : props_[i]; }
+private:
+	Entity::PropertyList props_;
+	AbstractProperty* key_;
+};
+
+/*! A selection of an entity's properties, chosen by a mask. It has the parts
+ * of the array interface needed by the statement builders.
+ */
+class PropertySelection
+{
+public:
+	PropertySelection(const Entity::PropertyList& props, PropertyMask mask) : count_(0) {
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			if ( mask & (PropertyMask(1) << i) )	props_[count_++] = props[i];
+		}
+	}
+	size_t size() const { return count_; }
+	bool empty() const { return count_ == 0; }
+	AbstractProperty* operator [] (size_t i) const { return props_[i]; }
+private:
+	AbstractProperty* props_[MAX_PROPERTIES];
+	size_t count_;
+};
+
+/*! Build the statement selecting all the properties of an entity that match
+ * some criteria.
+ * \param	end		Text to end the statement with, such as a limit.
+ */
+string selectSql(const Entity& ent, const CollectionSelection& criteria, const char* end)
+{
+	// We need to explicitly list all props
+	Entity::PropertyList props = ent.properties();
+	stringstream sql;
+	sql << "SELECT ";
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		sql << (i > 0 ? "," : "") << props[i]->propertyName();
+	}
+	sql << " FROM " << ent.entitytype();
+	if ( !criteria.empty() ) {
+		sql << " WHERE ";
+		writeParams(sql, criteria, " AND ");
+	}
+	sql << end;
+	return sql.str();
+}
+
+/*! Assign the current row of a select statement to the entity.
+ *
+ * The select lists the entity's properties in order, so each statement shape
+ * maps column i to property i and no names need to be matched.
+ */
+void readRow(sqlite3_stmt* stmt, Entity& ent)
+{
+	Entity::PropertyList props = ent.properties();
+	Sqlite3ColumnVisitor writer(stmt);
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		props[i]->acceptWriter(writer);
+	}
+}
+
+string bindFailure(const AbstractProperty* prop)
+{
+	string msg("Could not bind property '");
+	msg += prop->propertyName();
+	msg += '\'';
+	return msg;
 }
 
 }	// End anon namespace
@@ -117,205 +319,396 @@ int save_callback(void* propDeque, int colCount, char** colNames, char** colData
 namespace tdk {
 namespace ent {
 
+Sqlite3PersistenceApi::~Sqlite3PersistenceApi()
+{
+	clearStatementCache();
+}
+
+void Sqlite3PersistenceApi::setDb(sqlite3* db)
+{
+	clearStatementCache();
+	db_ = db;
+}
+
+void Sqlite3PersistenceApi::clearStatementCache()
+{
+	for ( StatementCache::iterator it = statements_.begin(); it != statements_.end(); ++it ) {
+		sqlite3_finalize(it->second);
+	}
+	statements_.clear();
+}
+
+void Sqlite3PersistenceApi::exec(const char* sql) throw(Entception&)
+{
+	char* sqliteErr = NULL;
+	if ( sqlite3_exec(db_, sql, NULL, NULL, &sqliteErr) != SQLITE_OK ) {
+		string msg(sql);
+		msg += " failed: ";
+		msg += sqliteErr ? sqliteErr : sqlite3_errmsg(db_);
+		sqlite3_free(sqliteErr);
+		throw Entception(msg);
+	}
+}
+
+sqlite3_stmt* Sqlite3PersistenceApi::findStatement(const string& key) const
+{
+	StatementCache::const_iterator it = statements_.find(key);
+	return it == statements_.end() ? NULL : it->second;
+}
+
+sqlite3_stmt* Sqlite3PersistenceApi::checkoutStatement(const string& key)
+{
+	StatementCache::iterator it = statements_.find(key);
+	if ( it == statements_.end() )	return NULL;
+
+	sqlite3_stmt* stmt = it->second;
+	statements_.erase(it);
+	return stmt;
+}
+
+void Sqlite3PersistenceApi::checkinStatement(const string& key, sqlite3_stmt* stmt)
+{
+	// Only one statement of each shape is kept.
+	if ( !statements_.insert(StatementCache::value_type(key, stmt)).second ) {
+		sqlite3_finalize(stmt);
+	}
+}
+
+sqlite3_stmt* Sqlite3PersistenceApi::prepareStatement(const string& key, const string& sql)
+{
+	sqlite3_stmt* stmt = NULL;
+	if ( sqlite3_prepare_v2(db_, sql.c_str(), sql.length() + 1, &stmt, NULL) != SQLITE_OK ) {
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
+	statements_[key] = stmt;
+	return stmt;
+}
+
 bool Sqlite3PersistenceApi::save(const Entity& e) throw(Entception&)
 {
-	stringstream ss;
-	
-	const deque<AbstractProperty*>& props = e.properties();
-	
-	ss << "INSERT INTO " << e.entitytype() << '(';
-	// Get all the property names
-	for ( unsigned int i=0; i<props.size(); ++i ) {
-		ss << props[i]->propertyName();
-		cout << props[i]->propertyName() << endl;
-		if ( i < (props.size() - 1) ) {
-			ss << ',';
+	Entity::PropertyList props = e.properties();
+
+	string key = statementKey("INSERT", e, 0);
+	sqlite3_stmt* stmt = findStatement(key);
+	if ( !stmt ) {
+		stringstream sql;
+		sql << "INSERT INTO " << e.entitytype() << '(';
+		// Get all the property names
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			sql << (i > 0 ? "," : "") << props[i]->propertyName();
 		}
-	}
-	Sqlite3ReadVisitor reader(ss);
-	ss << ") VALUES(";
-	for ( unsigned int i=0; i<props.size(); ++i ) {
-		// Attempt to visit the property.
-		if ( !props[i]->acceptReader(reader) ) {
-			string msg("Could not visit property '");
-			msg += props[i]->propertyName();
-			msg += '\'';
-			throw SaveEntception(&e, msg.c_str());
+		sql << ") VALUES(";
+		for ( size_t i = 0; i < props.size(); ++i ) {
+			sql << (i > 0 ? ",?" : "?");
 		}
-		if ( i < props.size() - 1 ) {	// Add comma between all but last value in query
-			ss << ',';
+		sql << ");";
+
+		stmt = prepareStatement(key, sql.str());
+		if ( !stmt ) {
+			throw SaveEntception(&e, sqlite3_errmsg(db_));
 		}
 	}
-	ss << ");";	// Terminate the query
-	
-	// TODO: Call sqlite3_exec or w/e the func is.
-	char* sqliteErr = NULL;
-	cout << "Would like to execute this query: " << ss.str() << endl;
-	int res = sqlite3_exec(db_, ss.str().c_str(), save_callback, const_cast<void*>(reinterpret_cast<const void*>(&props)), &sqliteErr);
-	
-	if ( res != SQLITE_OK ) {
-		cout << "ERROR. result = " << res << endl;
-	} else {
-		cout << "Query executed ok" << endl;
-	}
-	if ( sqliteErr ) {
-		cout << "Sqlite3 error: " << sqliteErr << endl;
-		sqlite3_free(sqliteErr);
+
+	StatementReset reset(stmt);
+	Sqlite3BindVisitor binder(stmt);
+	if ( const AbstractProperty* failed = bindProperties(binder, props) ) {
+		throw SaveEntception(&e, bindFailure(failed));
 	}
 
-	return false;
+	if ( sqlite3_step(stmt) != SQLITE_DONE ) {
+		throw SaveEntception(&e, sqlite3_errmsg(db_));
+	}
+	return true;
+}
+
+bool Sqlite3PersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	beginTransaction();
+
+	try {
+		// Each entity of the same shape reuses the same cached insert.
+		for ( size_t i = 0; i < count; ++i ) {
+			save(*ents[i]);
+		}
+		commitTransaction();
+	} catch (Entception& e) {
+		rollbackTransaction();
+		THROW_AGAIN(e, "Batch save rolled back.");
+	}
+	return true;
+}
+
+void Sqlite3PersistenceApi::beginTransaction() throw(Entception&)
+{
+	stringstream sql;
+	sql << "SAVEPOINT ent_sp" << depth_ + 1 << ';';
+	exec(sql.str().c_str());
+	++depth_;
+}
+
+void Sqlite3PersistenceApi::commitTransaction() throw(Entception&)
+{
+	if ( depth_ == 0 ) {
+		throw Entception("No transaction to commit");
+	}
+
+	// The savepoint stays open if the release fails, so it can be rolled back.
+	stringstream sql;
+	sql << "RELEASE ent_sp" << depth_ << ';';
+	exec(sql.str().c_str());
+	--depth_;
+}
+
+void Sqlite3PersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	if ( depth_ == 0 ) {
+		throw Entception("No transaction to roll back");
+	}
+
+	// Rolling back to a savepoint leaves it open, so it must also be released.
+	stringstream sql;
+	sql << "ROLLBACK TO ent_sp" << depth_ << "; RELEASE ent_sp" << depth_ << ';';
+	--depth_;
+	exec(sql.str().c_str());
 }
 
 bool Sqlite3PersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
 {
-	std::stringstream sql;
-	
 	// Validate collection against entity.
-	if ( !ent.isSubset(updates) ) {
+	CollectionSelection newVals(ent, updates);
+	if ( !newVals.valid() ) {
 		throw UpdateEntception(&ent, "Updates are not a valid subset.");
 	}
-	
-	const Entity::PropertyDeque& newVals = updates.props();
-	
-	sql << "UPDATE " << ent.entitytype() << "(";
-	
-	// Get all the property names for the update
-	for ( unsigned int i = 0; i < newVals.size(); ++i ) {
-		sql << newVals[i]->propertyName();
-		if ( i < newVals.size() -2 ) {
-			sql << ',';
-		}
+
+	MatchProperties match(ent);
+	if ( newVals.empty() ) {
+		return false;
 	}
-	// Specify the update values.
-	Sqlite3ReadVisitor reader(sql);
-	sql << ") VALUES(";
-	for ( unsigned int i = 0; i < newVals.size(); ++i ) {
-		// Attempt to visit the value.
-		if ( !newVals[i]->acceptReader(reader) ) {
-			string msg("Could not visit update property '");
-			msg += newVals[i]->propertyName();
-			msg += '\'';
-			throw UpdateEntception(&ent, msg);
+
+	string key = statementKey("UPDATE", ent, newVals.mask());
+	sqlite3_stmt* stmt = findStatement(key);
+	if ( !stmt ) {
+		/* update ent.name set (updates = values) where (match key or each ent.properties); */
+		stringstream sql;
+		sql << "UPDATE " << ent.entitytype() << " SET ";
+		writeParams(sql, newVals, ",");
+		// Specify the where clause, requiring the entity to be a currently saved one.
+		if ( !match.empty() ) {
+			sql << " WHERE ";
+			writeParams(sql, match, " AND ");
 		}
-	}
-	
-	// Specify the where clause, requiring the entity to be a currently saved on.
-	sql << ") WHERE(";
-	const Entity::PropertyDeque& props = ent.properties();
-	for ( unsigned int i = 0; i < props.size(); ++i ) {
-		// Add the property names first.
-		sql << props[i]->propertyName() << '=';
-		
-		// Now attempt to visit the value.
-		if ( !props[i]->acceptReader(reader) ) {
-			string msg("Could not visit match property '");
-			msg += props[i]->propertyName();
-			msg += '\'';
-			throw UpdateEntception(&ent, msg);
+		sql << ';';
+
+		stmt = prepareStatement(key, sql.str());
+		if ( !stmt ) {
+			throw UpdateEntception(&ent, sqlite3_errmsg(db_));
 		}
-		
-		if ( i < newVals.size() -2 ) {	// Add comma for all but last item.
-			sql << ',';
+	}
+
+	StatementReset reset(stmt);
+	Sqlite3BindVisitor binder(stmt);
+	const AbstractProperty* failed = bindProperties(binder, newVals);
+	if ( !failed ) {
+		failed = bindProperties(binder, match);
+	}
+	if ( failed ) {
+		throw UpdateEntception(&ent, bindFailure(failed));
+	}
+
+	if ( sqlite3_step(stmt) != SQLITE_DONE ) {
+		throw UpdateEntception(&ent, sqlite3_errmsg(db_));
+	}
+	return sqlite3_changes(db_) > 0;
+}
+
+bool Sqlite3PersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	Entity::PropertyList props = ent.properties();
+
+	// Without a key, the unmodified properties could match other rows too.
+	int pk = ent.schema().primaryKey();
+	if ( pk < 0 ) {
+		throw UpdateEntception(&ent, "The entity type has no primary key, so the entity can not be found.");
+	}
+	if ( props[pk]->dirty() ) {
+		throw UpdateEntception(&ent, "The primary key has been modified, so the entity can not be found.");
+	}
+
+	PropertySelection newVals(props, dirty);
+	PropertySelection match(props, PropertyMask(1) << pk);
+	if ( newVals.empty() ) {
+		return false;
+	}
+
+	// Statements are cached per dirty mask, as the properties of an entity
+	// type are always in the same order.
+	string key = statementKey("FLUSH", ent, dirty);
+	sqlite3_stmt* stmt = findStatement(key);
+	if ( !stmt ) {
+		stringstream sql;
+		sql << "UPDATE " << ent.entitytype() << " SET ";
+		writeParams(sql, newVals, ",");
+		sql << " WHERE ";
+		writeParams(sql, match, " AND ");
+		sql << ';';
+
+		stmt = prepareStatement(key, sql.str());
+		if ( !stmt ) {
+			throw UpdateEntception(&ent, sqlite3_errmsg(db_));
 		}
 	}
-	sql << ");";
-	/* update ent.name values(updates.values) where (match each ent.properties); */
-	
-	// Attempt to execute the query.
-	char* msg;
-	//int res = sqlite3_exec(db_, sql.str().c_str(), sqlite3_callback, TODO_UPDATE_CONTEXT_OBJ, &msg);
-	
-	
-	return false;
+
+	StatementReset reset(stmt);
+	Sqlite3BindVisitor binder(stmt);
+	const AbstractProperty* failed = bindProperties(binder, newVals);
+	if ( !failed ) {
+		failed = bindProperties(binder, match);
+	}
+	if ( failed ) {
+		throw UpdateEntception(&ent, bindFailure(failed));
+	}
+
+	if ( sqlite3_step(stmt) != SQLITE_DONE ) {
+		throw UpdateEntception(&ent, sqlite3_errmsg(db_));
+	}
+	return sqlite3_changes(db_) > 0;
 }
 
 bool Sqlite3PersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
 {
-	std::stringstream sql;
-	
 	// Validate collection against entity.
-	if ( !ent.isSubset(criteria) ) {
+	CollectionSelection loadVals(ent, criteria);
+	if ( !loadVals.valid() ) {
 		throw LoadEntception(&ent, "Load criteria are not a valid subset.");
 	}
-	
-	const Entity::PropertyDeque& props = ent.properties();
-	
-	// Start creating the select statement. We need to explicitly list all props
-	sql << "SELECT FROM " << ent.entitytype() << '(';
-	for ( size_t i = 0; i < props.size(); ++i ) {
-		sql << props[i]->propertyName();
-		
-		if ( i < props.size() - 2 ) {
-			sql << ',';
+
+	string key = statementKey("SELECT", ent, loadVals.mask());
+	sqlite3_stmt* stmt = findStatement(key);
+	if ( !stmt ) {
+		stmt = prepareStatement(key, selectSql(ent, loadVals, " LIMIT 1;"));
+		if ( !stmt ) {
+			throw LoadEntception(&ent, sqlite3_errmsg(db_));
 		}
 	}
-	sql << ") WHERE(";
-	
-	// Now we need to build the where clause equalities.
-	Sqlite3ReadVisitor reader(sql);
-	const Entity::PropertyDeque& loadVals = criteria.props();
-	for ( size_t i = 0; i < loadVals.size(); ++i ) {
-		sql << loadVals[i]->propertyName() << '=';
-		
-		// Attempt to visit the property so it's value is appended to the query.
-		if ( !loadVals[i]->acceptReader(reader) ) {
-			string msg("Could not visit match property '");
-			msg += loadVals[i]->propertyName();
-			msg += '\'';
-			throw LoadEntception(&ent, msg.c_str());
+
+	StatementReset reset(stmt);
+	Sqlite3BindVisitor binder(stmt);
+	if ( const AbstractProperty* failed = bindProperties(binder, loadVals) ) {
+		throw LoadEntception(&ent, bindFailure(failed));
+	}
+
+	int res = sqlite3_step(stmt);
+	if ( res == SQLITE_DONE ) {
+		return false;	// Nothing matched the criteria.
+	}
+	if ( res != SQLITE_ROW ) {
+		throw LoadEntception(&ent, sqlite3_errmsg(db_));
+	}
+
+	readRow(stmt, ent);
+	return true;
+}
+
+/*! Cursor which steps through the rows of a select statement. The statement
+ * is checked out of the API's cache while the cursor is open, so any number
+ * of cursors of the same shape can be open at once, and a cursor that is
+ * opened again later does not need to be prepared again.
+ */
+class Sqlite3PersistenceApi::Cursor : public PersistenceCursor
+{
+public:
+	Cursor(Sqlite3PersistenceApi& api, const string& key, sqlite3_stmt* stmt, size_t columns)
+		: api_(api), key_(key), stmt_(stmt), columns_(columns) {}
+
+	virtual bool step() throw(Entception&) {
+		int res = sqlite3_step(stmt_);
+		if ( res == SQLITE_ROW )	return true;
+		if ( res == SQLITE_DONE )	return false;
+
+		throw Entception(sqlite3_errmsg(api_.db_));
+	}
+
+	virtual void read(Entity& ent) throw(Entception&) {
+		if ( ent.properties().size() != columns_ ) {
+			throw LoadEntception(&ent, "Entity does not match the shape of the cursor.");
 		}
-		
-		if ( i < loadVals.size() - 2 ) {	// Add comma for all but last val.
-			sql << ',';
+		readRow(stmt_, ent);
+	}
+
+	virtual ~Cursor() {
+		sqlite3_reset(stmt_);
+		api_.checkinStatement(key_, stmt_);
+	}
+
+private:
+	Sqlite3PersistenceApi& api_;
+	string key_;
+	sqlite3_stmt* stmt_;
+	size_t columns_;
+};
+
+PersistenceCursor* Sqlite3PersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	CollectionSelection loadVals(shape, criteria);
+	if ( !loadVals.valid() ) {
+		throw LoadEntception(&shape, "Query criteria are not a valid subset.");
+	}
+
+	Entity::PropertyList props = shape.properties();
+	string key = statementKey("CURSOR", shape, loadVals.mask());
+	sqlite3_stmt* stmt = checkoutStatement(key);
+	if ( !stmt ) {
+		if ( sqlite3_prepare_v2(db_, selectSql(shape, loadVals, ";").c_str(), -1, &stmt, NULL) != SQLITE_OK ) {
+			sqlite3_finalize(stmt);
+			throw LoadEntception(&shape, sqlite3_errmsg(db_));
 		}
 	}
-	sql << ");";	// Terminate query.
-	
-	// Perform query
-	//if ( sqlite3_exec(...) != SQLITE_OK ) {
-	//
-	//}
-	
-	// TODO: Will need a visitor that will perform assignment. Does Sqlite give us strings, ints, blobs?
-	//Sqlite3ReadVisitor assigner(sql);
-	//Sqlite3WriteVisitor writer(sql);
-	// Now 
-	
-	return NULL;
+
+	// From here the cursor owns the statement, and returns it to the cache.
+	Cursor* cursor = new Cursor(*this, key, stmt, props.size());
+
+	Sqlite3BindVisitor binder(stmt);
+	if ( const AbstractProperty* failed = bindProperties(binder, loadVals) ) {
+		delete cursor;
+		throw LoadEntception(&shape, bindFailure(failed));
+	}
+	return cursor;
 }
 
 bool Sqlite3PersistenceApi::del(const Entity& e) throw(Entception&)
 {
-	stringstream sql;
-	
-		// Or is it REMOVE
-	sql << "DELETE * FROM " << e.entitytype() << " WHERE(";
-	
-	// Build up the where clause by iterating the entities properties.
-	const Entity::PropertyDeque& props = e.properties();
-	Sqlite3ReadVisitor reader(sql);
-	for ( size_t i; i < props.size(); ++i ) {
-		sql << props[i]->propertyName() << '=';
-		
-		// Attempt to visit the property to get it to SQL text.
-		if ( !props[i]->acceptReader(reader) ) {
-			string msg("Could not visit property '");
-			msg += props[i]->propertyName();
-			msg += '\'';
-			throw DelEntception(&e, msg.c_str());
-		}
-		
-		if ( i < props.size() - 2 ) {	// Add comma for all but last field.
-			sql << ',';
+	// Build up the where clause from the key, or all the entity's properties.
+	MatchProperties match(e);
+	if ( match.empty() ) {
+		// Without a where clause every entity of this type would be deleted.
+		throw DelEntception(&e, "Entity has no properties to match on");
+	}
+
+	string key = statementKey("DELETE", e, 0);
+	sqlite3_stmt* stmt = findStatement(key);
+	if ( !stmt ) {
+		stringstream sql;
+		sql << "DELETE FROM " << e.entitytype() << " WHERE ";
+		writeParams(sql, match, " AND ");
+		sql << ';';
+
+		stmt = prepareStatement(key, sql.str());
+		if ( !stmt ) {
+			throw DelEntception(&e, sqlite3_errmsg(db_));
 		}
 	}
-	sql << ");";	// Terminate the query.
-	
-	// if ( sqlite3_exec(...) != SQLITE_OK ) {
-	//
-	//}
-	
-	return false;
+
+	StatementReset reset(stmt);
+	Sqlite3BindVisitor binder(stmt);
+	if ( const AbstractProperty* failed = bindProperties(binder, match) ) {
+		throw DelEntception(&e, bindFailure(failed));
+	}
+
+	if ( sqlite3_step(stmt) != SQLITE_DONE ) {
+		throw DelEntception(&e, sqlite3_errmsg(db_));
+	}
+	return sqlite3_changes(db_) > 0;
 }
 
 }	// End namespace ent
@@ -5,35 +5,111 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
+#include <map>
+#include <string>
+
 #include "entities/entity.hpp"
 
 // Forward declaration.
 struct sqlite3;
+struct sqlite3_stmt;
 
 namespace tdk {
 namespace ent {
 
-/*! Persistence implementation for SQLite 3. */
+/*! Persistence implementation for SQLite 3.
+ *
+ * Every statement is prepared once per shape (operation, entity type and the
+ * set of columns involved) and cached for the lifetime of the connection.
+ * Property values are bound straight to the statement parameters, so no SQL
+ * text is built or parsed for repeated operations.
+ */
 class Sqlite3PersistenceApi : public PersistenceApi
 {
 public:
-	Sqlite3PersistenceApi() : db_(NULL) {}
-	Sqlite3PersistenceApi(sqlite3* db);
+	Sqlite3PersistenceApi() : db_(NULL), depth_(0) {}
+	Sqlite3PersistenceApi(sqlite3* db) : db_(db), depth_(0) {}
 
 	virtual bool save(const Entity&) throw(Entception&);
-	
+
+	/*! Save all the entities inside a single transaction, so the batch costs
+	 * one sync to disk rather than one per entity. If a transaction is
+	 * already open, the batch is a savepoint within it.
+	 */
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+
 	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
-	
+
+	/*! Update only the modified columns. Statements are cached per shape of
+	 * modified properties.
+	 */
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+
 	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
-	
+
 	virtual bool del(const Entity&) throw(Entception&);
-	
-	virtual ~Sqlite3PersistenceApi() {}
 
-	void setDb(sqlite3* db) { db_ = db; }
+	/*! Open a cursor stepping through a select statement. The cursor must be
+	 * deleted before this API is destroyed or its connection changed.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	/*! Transactions are implemented with SQLite savepoints, which nest. The
+	 * outermost savepoint begins the SQLite transaction and releasing it
+	 * commits, unless a transaction was already opened on the connection by
+	 * other means.
+	 */
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	virtual ~Sqlite3PersistenceApi();
+
+	/*! Set the database connection to operate on. Statements prepared against
+	 * a previous connection are finalized.
+	 */
+	void setDb(sqlite3* db);
+
+	/*! Finalize all the cached statements. This must be done before the
+	 * connection is closed, otherwise sqlite3_close will fail.
+	 */
+	void clearStatementCache();
 
 private:
+	/*! Execute a statement that produces no rows, such as BEGIN or COMMIT.
+	 * \throws	Entception	If the statement failed.
+	 */
+	void exec(const char* sql) throw(Entception&);
+
+	/*! Find a cached statement.
+	 * \param	key		Shape of the statement. See the key building in the
+	 *			implementation file.
+	 * \retval	NULL	The statement has not been prepared yet.
+	 */
+	sqlite3_stmt* findStatement(const std::string& key) const;
+
+	/*! Prepare a statement and add it to the cache.
+	 * \retval	NULL	The statement could not be prepared. Use sqlite3_errmsg
+	 *			for the reason.
+	 */
+	sqlite3_stmt* prepareStatement(const std::string& key, const std::string& sql);
+
+	/*! Take a statement out of the cache, for exclusive use by a cursor.
+	 * \retval	NULL	No statement of that shape is cached.
+	 */
+	sqlite3_stmt* checkoutStatement(const std::string& key);
+
+	/*! Return a statement taken by checkoutStatement to the cache. */
+	void checkinStatement(const std::string& key, sqlite3_stmt* stmt);
+
+	class Cursor;
+	friend class Cursor;
+
+	typedef std::map<std::string, sqlite3_stmt*> StatementCache;
+
 	sqlite3* db_;
+	unsigned int depth_;	// Number of nested transactions currently open.
+	StatementCache statements_;
 };
 
 
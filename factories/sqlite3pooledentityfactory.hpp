@@ -0,0 +1,48 @@
+#ifndef SQLITE3_POOLED_ENTITY_FACTORY_HPP
+#define SQLITE3_POOLED_ENTITY_FACTORY_HPP
+/*! \file	sqlite3pooledentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "entities/entityfactory.hpp"
+#include "entities/factories/sqlite3pooledpersistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that installs a pooled SQLite3 persistence API in to the
+ * entities it creates. Unlike Sqlite3EntityFactory, the factory and its
+ * entities can be used from any number of threads at once, as long as each
+ * entity is only used by one thread at a time.
+ *
+ * \see	Sqlite3PooledPersistenceApi
+ */
+class Sqlite3PooledEntityFactory : public EntityFactory
+{
+public:
+	/*! Create a pooled SQLite3 entity factory.
+	 *
+	 * \param	dbFile	Name of the database file to open and operate on.
+	 * \param	readers	Number of read only connections to open. One per
+	 *			thread that will be loading at the same time is ideal.
+	 * \param	options	Options to open the connections with.
+	 *			\see	Sqlite3PooledPersistenceApi::Sqlite3PooledPersistenceApi
+	 *
+	 * \throw	Entception	If there are no readers, or the database file can
+	 *			not be opened.
+	 */
+	Sqlite3PooledEntityFactory(const char* dbFile, unsigned int readers = 4,
+			const Sqlite3Options& options = Sqlite3Options()) throw(Entception&)
+		: persistence_(dbFile, readers, options) {}
+
+private:
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(&persistence_); }
+	virtual PersistenceApi& persistenceApi() { return persistence_; }
+	Sqlite3PooledPersistenceApi persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,255 @@
+/*! \file	sqlite3pooledpersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+#include <chrono>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "sqlite3pooledpersistenceapi.hpp"
+
+using namespace std;
+using namespace tdk::ent;
+
+namespace tdk {
+namespace ent {
+
+const int Sqlite3PooledPersistenceApi::BUSY_TIMEOUT_MS;
+
+/*! Checks a reader out of the pool for the life of the lease. */
+class Sqlite3PooledPersistenceApi::ReaderLease
+{
+public:
+	ReaderLease(Sqlite3PooledPersistenceApi& pool) : pool_(pool), c_(pool.checkoutReader()) {}
+	~ReaderLease() { if ( c_ )	pool_.checkinReader(c_); }
+
+	Connection* get() const { return c_; }
+	Connection* release() { Connection* c = c_; c_ = NULL; return c; }
+
+private:
+	Sqlite3PooledPersistenceApi& pool_;
+	Connection* c_;
+};
+
+/*! Cursor that keeps the connection it was opened on for as long as it is
+ * open. That is either a reader checked out of the pool, or the writer,
+ * which is kept locked.
+ */
+class Sqlite3PooledPersistenceApi::PooledCursor : public PersistenceCursor
+{
+public:
+	PooledCursor(Sqlite3PooledPersistenceApi& pool, PersistenceCursor* cursor, Connection* reader)
+		: pool_(pool), cursor_(cursor), reader_(reader) {}
+
+	PooledCursor(Sqlite3PooledPersistenceApi& pool, PersistenceCursor* cursor, unique_lock<recursive_mutex>&& writer)
+		: pool_(pool), cursor_(cursor), reader_(NULL), writer_(std::move(writer)) {}
+
+	virtual bool step() throw(Entception&) { return cursor_->step(); }
+	virtual void read(Entity& ent) throw(Entception&) { cursor_->read(ent); }
+
+	virtual ~PooledCursor() {
+		// The cursor's statement goes back to its connection's cache first.
+		delete cursor_;
+		if ( reader_ )	pool_.checkinReader(reader_);
+	}
+
+private:
+	Sqlite3PooledPersistenceApi& pool_;
+	PersistenceCursor* cursor_;
+	Connection* reader_;
+	unique_lock<recursive_mutex> writer_;
+};
+
+Sqlite3PooledPersistenceApi::Sqlite3PooledPersistenceApi(const char* dbFile, unsigned int readers,
+		const Sqlite3Options& options) throw(Entception&)
+	: owner_(thread::id()), depth_(0)
+{
+	if ( readers == 0 ) {
+		throw Entception("A connection pool needs at least one reader");
+	}
+
+	// Each connection is only used by one thread at a time, so SQLite's own
+	// mutex is not needed.
+	Sqlite3Options writerOptions(options);
+	writerOptions.readOnly = false;
+	writerOptions.noMutex = true;
+	writerOptions.journalMode = Sqlite3Options::JOURNAL_WAL;
+	if ( writerOptions.busyTimeoutMs <= 0 )	writerOptions.busyTimeoutMs = BUSY_TIMEOUT_MS;
+	busyTimeoutMs_ = writerOptions.busyTimeoutMs;
+
+	// The journal mode is a property of the file, set by the writer.
+	Sqlite3Options readerOptions(writerOptions);
+	readerOptions.readOnly = true;
+	readerOptions.journalMode = Sqlite3Options::JOURNAL_DEFAULT;
+
+	writer_.db = openSqlite3(dbFile, writerOptions);
+	writer_.api.setDb(writer_.db);
+
+	try {
+		for ( unsigned int i = 0; i < readers; ++i ) {
+			Connection* c = new Connection;
+			readers_.push_back(c);
+			c->db = openSqlite3(dbFile, readerOptions);
+			c->api.setDb(c->db);
+		}
+	} catch (Entception& e) {
+		for ( size_t i = 0; i < readers_.size(); ++i ) {
+			close(*readers_[i]);
+			delete readers_[i];
+		}
+		close(writer_);
+		throw;
+	}
+
+	freeReaders_ = readers_;
+}
+
+Sqlite3PooledPersistenceApi::~Sqlite3PooledPersistenceApi()
+{
+	for ( size_t i = 0; i < readers_.size(); ++i ) {
+		close(*readers_[i]);
+		delete readers_[i];
+	}
+
+	// A writer that has not used the WAL since the readers last did would not
+	// remove it when closed, so checkpoint it first.
+	sqlite3_wal_checkpoint_v2(writer_.db, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL);
+	close(writer_);
+}
+
+void Sqlite3PooledPersistenceApi::close(Connection& c)
+{
+	// Cached statements would keep the connection from closing.
+	c.api.clearStatementCache();
+	sqlite3_close(c.db);
+	c.db = NULL;
+}
+
+Sqlite3PooledPersistenceApi::Connection* Sqlite3PooledPersistenceApi::checkoutReader()
+{
+	unique_lock<mutex> lock(readersMutex_);
+	if ( !readerFreed_.wait_for(lock, chrono::milliseconds(busyTimeoutMs_),
+			[this] { return !freeReaders_.empty(); }) ) {
+		return NULL;
+	}
+
+	Connection* c = freeReaders_.back();
+	freeReaders_.pop_back();
+	return c;
+}
+
+void Sqlite3PooledPersistenceApi::checkinReader(Connection* c)
+{
+	{
+		lock_guard<mutex> lock(readersMutex_);
+		freeReaders_.push_back(c);
+	}
+	readerFreed_.notify_one();
+}
+
+bool Sqlite3PooledPersistenceApi::save(const Entity& e) throw(Entception&)
+{
+	lock_guard<recursive_mutex> lock(writerMutex_);
+	return writer_.api.save(e);
+}
+
+bool Sqlite3PooledPersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	lock_guard<recursive_mutex> lock(writerMutex_);
+	return writer_.api.saveAll(ents, count);
+}
+
+bool Sqlite3PooledPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	lock_guard<recursive_mutex> lock(writerMutex_);
+	return writer_.api.update(ent, updates);
+}
+
+bool Sqlite3PooledPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	lock_guard<recursive_mutex> lock(writerMutex_);
+	return writer_.api.flush(ent, dirty);
+}
+
+bool Sqlite3PooledPersistenceApi::del(const Entity& e) throw(Entception&)
+{
+	lock_guard<recursive_mutex> lock(writerMutex_);
+	return writer_.api.del(e);
+}
+
+bool Sqlite3PooledPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( inTransaction() ) {
+		lock_guard<recursive_mutex> lock(writerMutex_);
+		return writer_.api.load(ent, criteria);
+	}
+
+	ReaderLease reader(*this);
+	if ( !reader.get() ) {
+		throw LoadEntception(&ent, "No reader connection became free.");
+	}
+	return reader.get()->api.load(ent, criteria);
+}
+
+PersistenceCursor* Sqlite3PooledPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	if ( inTransaction() ) {
+		unique_lock<recursive_mutex> lock(writerMutex_);
+		PersistenceCursor* cursor = writer_.api.openCursor(shape, criteria);
+		return new PooledCursor(*this, cursor, std::move(lock));
+	}
+
+	ReaderLease reader(*this);
+	if ( !reader.get() ) {
+		throw LoadEntception(&shape, "No reader connection became free.");
+	}
+	PersistenceCursor* cursor = reader.get()->api.openCursor(shape, criteria);
+	return new PooledCursor(*this, cursor, reader.release());
+}
+
+void Sqlite3PooledPersistenceApi::beginTransaction() throw(Entception&)
+{
+	writerMutex_.lock();
+	try {
+		writer_.api.beginTransaction();
+	} catch (Entception& e) {
+		writerMutex_.unlock();
+		throw;
+	}
+
+	if ( depth_++ == 0 )	owner_.store(this_thread::get_id());
+}
+
+void Sqlite3PooledPersistenceApi::commitTransaction() throw(Entception&)
+{
+	if ( !inTransaction() ) {
+		throw Entception("No transaction to commit on this thread");
+	}
+
+	// The writer stays locked if the commit fails, so it can be rolled back.
+	writer_.api.commitTransaction();
+
+	if ( --depth_ == 0 )	owner_.store(thread::id());
+	writerMutex_.unlock();
+}
+
+void Sqlite3PooledPersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	if ( !inTransaction() ) {
+		throw Entception("No transaction to roll back on this thread");
+	}
+
+	// The transaction is over even if the roll back fails.
+	if ( --depth_ == 0 )	owner_.store(thread::id());
+	try {
+		writer_.api.rollbackTransaction();
+	} catch (Entception& e) {
+		writerMutex_.unlock();
+		throw;
+	}
+	writerMutex_.unlock();
+}
+
+}	// End namespace ent
+}	// End namespace tdk
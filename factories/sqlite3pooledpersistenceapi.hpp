@@ -0,0 +1,129 @@
+#ifndef SQLITE3_POOLED_PERSISTENCE_HPP
+#define SQLITE3_POOLED_PERSISTENCE_HPP
+/*! \file	sqlite3pooledpersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "entities/factories/sqlite3options.hpp"
+#include "entities/factories/sqlite3persistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Thread safe persistence for SQLite 3, over a pool of connections to one
+ * database file in WAL mode.
+ *
+ * There is a single writer connection, and several read only connections.
+ * Loads and queries check a reader out of the pool for the duration of the
+ * operation, so they run in parallel with each other and with writes. Writes
+ * are serialised on the writer connection, as SQLite only allows one writer
+ * at a time anyway.
+ *
+ * A transaction holds the writer connection from begin to commit or roll
+ * back, and can only be used from the thread that began it. While it is open,
+ * that thread's loads and queries also go to the writer, so they see the
+ * transaction's own changes.
+ *
+ * Each connection has its own statement cache. Connections to in memory
+ * databases can not be pooled, as each would be a separate database.
+ */
+class Sqlite3PooledPersistenceApi : public PersistenceApi
+{
+public:
+	/*! Open the connections to a database file.
+	 *
+	 * \param	dbFile	Name of the database file to open. It is created if it
+	 *			does not exist, and switched in to WAL mode.
+	 * \param	readers	Number of read only connections to open, at least one.
+	 * \param	options	Options to open the connections with. The journal mode
+	 *			is always WAL, the readers are always read only, and the
+	 *			busy timeout defaults to BUSY_TIMEOUT_MS.
+	 *
+	 * \throws	Entception	If there are no readers, any of the connections
+	 *			could not be opened, or the database could not be switched in
+	 *			to WAL mode.
+	 */
+	Sqlite3PooledPersistenceApi(const char* dbFile, unsigned int readers,
+		const Sqlite3Options& options = Sqlite3Options()) throw(Entception&);
+
+	/*! Close all the connections. No cursors may still be open. */
+	virtual ~Sqlite3PooledPersistenceApi();
+
+	virtual bool save(const Entity&) throw(Entception&);
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool del(const Entity&) throw(Entception&);
+
+	/*! Load from a reader, waiting for one to become free if they are all in
+	 * use.
+	 * \throws	LoadEntception	If no reader became free within the busy
+	 *			timeout.
+	 */
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	/*! Open a cursor on a reader, which stays checked out until the cursor is
+	 * deleted.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	/*! Default milliseconds to wait for a locked database, or for a free
+	 * reader.
+	 */
+	static const int BUSY_TIMEOUT_MS = 5000;
+
+private:
+	struct Connection {
+		Connection() : db(NULL) {}
+		sqlite3* db;
+		Sqlite3PersistenceApi api;
+	};
+
+	/*! Take a free reader out of the pool, waiting for one if necessary.
+	 * \retval	NULL	No reader became free within the busy timeout.
+	 */
+	Connection* checkoutReader();
+
+	/*! Return a reader to the pool. */
+	void checkinReader(Connection* c);
+
+	/*! Whether or not the calling thread has a transaction open. */
+	bool inTransaction() const { return owner_.load() == std::this_thread::get_id(); }
+
+	void close(Connection& c);
+
+	class ReaderLease;
+	class PooledCursor;
+	friend class ReaderLease;
+	friend class PooledCursor;
+
+	Sqlite3PooledPersistenceApi(const Sqlite3PooledPersistenceApi&);
+	Sqlite3PooledPersistenceApi& operator = (const Sqlite3PooledPersistenceApi&);
+
+	Connection writer_;
+	std::recursive_mutex writerMutex_;	// Held for each write, and for the whole of a transaction.
+	std::atomic<std::thread::id> owner_;	// Thread with a transaction open, if any.
+	unsigned int depth_;	// Transactions open on owner_.
+
+	std::vector<Connection*> readers_;
+	std::vector<Connection*> freeReaders_;
+	std::mutex readersMutex_;
+	std::condition_variable readerFreed_;
+	int busyTimeoutMs_;		// Milliseconds to wait for a free reader.
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
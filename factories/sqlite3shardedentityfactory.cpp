@@ -0,0 +1,56 @@
+/*! \file	sqlite3shardedentityfactory.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+#include "entities/factories/sqlite3shardedentityfactory.hpp"
+
+#include <sqlite3.h>
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+Sqlite3ShardedEntityFactory::Sqlite3ShardedEntityFactory(const vector<string>& dbFiles,
+		const Sqlite3Options& options) throw(Entception&)
+	: persistence_(NULL)
+{
+	Sqlite3Options shardOptions(options);
+	shardOptions.noMutex = true;
+
+	try {
+		vector<PersistenceApi*> apis;
+		for ( size_t i = 0; i < dbFiles.size(); ++i ) {
+			Connection* c = new Connection;
+			shards_.push_back(c);
+			c->db = openSqlite3(dbFiles[i].c_str(), shardOptions);
+			c->api.setDb(c->db);
+			apis.push_back(&c->api);
+		}
+
+		persistence_ = new ShardedPersistenceApi(apis);
+	} catch (Entception& e) {
+		close();
+		throw;
+	}
+}
+
+Sqlite3ShardedEntityFactory::~Sqlite3ShardedEntityFactory()
+{
+	delete persistence_;
+	close();
+}
+
+void Sqlite3ShardedEntityFactory::close()
+{
+	for ( size_t i = 0; i < shards_.size(); ++i ) {
+		// Cached statements would keep the connection from closing.
+		shards_[i]->api.clearStatementCache();
+		sqlite3_close(shards_[i]->db);
+		delete shards_[i];
+	}
+	shards_.clear();
+}
+
+}	// End namespace ent
+}	// End namespace tdk
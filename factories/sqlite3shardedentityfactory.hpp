@@ -0,0 +1,85 @@
+#ifndef SQLITE3_SHARDED_ENTITY_FACTORY_HPP
+#define SQLITE3_SHARDED_ENTITY_FACTORY_HPP
+/*! \file	sqlite3shardedentityfactory.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <string>
+#include <vector>
+
+#include "entities/entityfactory.hpp"
+#include "entities/shardedpersistenceapi.hpp"
+#include "entities/factories/sqlite3options.hpp"
+#include "entities/factories/sqlite3persistenceapi.hpp"
+
+struct sqlite3;
+
+namespace tdk {
+namespace ent {
+
+/*! Entity factory that spreads the entities it creates over several SQLite3
+ * database files, with a connection to each, by a hash of their primary key.
+ * Each file is a shard with its own writer, so threads saving entities whose
+ * keys are in different shards do so in parallel. Saves outside a transaction
+ * spend most of their time waiting for the sync to disk, so they only scale
+ * with the number of shards if the files are on separate disks.
+ *
+ * ~~~{.cpp}
+ * std::vector<std::string> files;
+ * files.push_back("/disk1/people.db");
+ * files.push_back("/disk2/people.db");
+ * Sqlite3ShardedEntityFactory factory(files, Sqlite3Options::throughput());
+ * ~~~
+ *
+ * Every file needs the tables of the entity types, as with
+ * Sqlite3EntityFactory, and the files must always be given in the same order.
+ * The factory and its entities can be used from any number of threads at
+ * once, as long as each entity is only used by one thread at a time.
+ *
+ * \see	ShardedPersistenceApi
+ */
+class Sqlite3ShardedEntityFactory : public EntityFactory
+{
+public:
+	/*! Open a connection to each shard's database file.
+	 *
+	 * \param	dbFiles	Names of the database files, one per shard.
+	 * \param	options	Options to open every connection with. Each connection
+	 *			is only used by one thread at a time, so is always opened
+	 *			without SQLite's connection mutex.
+	 *
+	 * \throw	Entception	If there are no files, or any of them can not be
+	 *			opened.
+	 */
+	Sqlite3ShardedEntityFactory(const std::vector<std::string>& dbFiles,
+			const Sqlite3Options& options = Sqlite3Options()) throw(Entception&);
+
+	~Sqlite3ShardedEntityFactory();
+
+	/*! Get the persistence, to find the shard of a key. */
+	ShardedPersistenceApi& persistence() { return *persistence_; }
+
+private:
+	struct Connection {
+		Connection() : db(NULL) {}
+		sqlite3* db;
+		Sqlite3PersistenceApi api;
+	};
+
+	virtual void installPersistenceApi(Entity* e) { e->setPersistence(persistence_); }
+	virtual PersistenceApi& persistenceApi() { return *persistence_; }
+
+	void close();
+
+	Sqlite3ShardedEntityFactory(const Sqlite3ShardedEntityFactory&);
+	Sqlite3ShardedEntityFactory& operator = (const Sqlite3ShardedEntityFactory&);
+
+	std::vector<Connection*> shards_;
+	ShardedPersistenceApi* persistence_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
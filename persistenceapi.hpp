@@ -5,6 +5,9 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
+#include <stddef.h>
+
+#include "abstractproperty.hpp"
 #include "entception.hpp"
 
 
@@ -13,6 +16,34 @@ namespace ent {
 
 class Entity;
 
+/*! A cursor steps through all the entities in persistent storage that match
+ * some criteria, one at a time. Only the current entity is held, so any
+ * number of entities can be iterated over with constant memory.
+ *
+ * \see	PersistenceApi::openCursor
+ */
+class PersistenceCursor
+{
+public:
+	/*! Move to the next matching entity.
+	 * \return	Whether or not there was another entity.
+	 * \throws	Entception	If the persistence failed to move to the next entity.
+	 */
+	virtual bool step() throw(Entception&) = 0;
+
+	/*! Assign the data of the current entity to an entity object. This is only
+	 * valid after step has returned true. Strings and blobs are visited as
+	 * primitives that may point in to the cursor's own memory, which remains
+	 * valid until the next step.
+	 *
+	 * \param[out]	ent		Entity to load the data in to. This must be of the
+	 *			same type as the entity the cursor was opened with.
+	 */
+	virtual void read(Entity& ent) throw(Entception&) = 0;
+
+	virtual ~PersistenceCursor() {}
+};
+
 /*! API for defining how entities can be saved, loaded and deleted from
  * persistent storage.
  */
@@ -30,6 +61,29 @@ public:
 	 *			any errors.
 	 */
 	virtual bool save(const Entity& e) throw (Entception&)= 0;
+
+	/*! Save a batch of entities to persistant storage. As with save, the
+	 * entities are assumed to have never been saved before.
+	 *
+	 * The default implementation saves each entity in turn. Implementors
+	 * should override this when they can save the whole batch more cheaply,
+	 * such as inside a single transaction.
+	 *
+	 * \param	ents	Array of the entities to save.
+	 * \param	count	Number of entities in the array.
+	 *
+	 * \return	Whether or not all the entities could be saved.
+	 *
+	 * \throws	Entception		Implementations should throw an Entception for
+	 *			any errors.
+	 */
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&) {
+		bool saved = true;
+		for ( size_t i = 0; i < count; ++i ) {
+			saved = save(*ents[i]) && saved;
+		}
+		return saved;
+	}
 	
 	/*! Update the given entity in persistent storage. Implementors will assume
 	 * that the entity has been saved before, but it just needs updating.
@@ -44,6 +98,31 @@ public:
 	 */
 	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&) = 0;
 	
+	/*! Write only the modified properties of an entity to persistent storage.
+	 * Implementors will assume that the entity has been saved before, and
+	 * that it already holds the new values of the modified properties.
+	 *
+	 * The entity is found by its primary key, which must not have been
+	 * modified. Entity types without a primary key can not be flushed, as the
+	 * unmodified properties may match other rows as well; use update instead.
+	 *
+	 * The default implementation throws, for persistences that do not
+	 * support partial updates.
+	 *
+	 * \param	ent		The entity to update.
+	 * \param	dirty	Mask of the entity's properties that have been modified.
+	 *
+	 * \return	Whether or not the entity was updated.
+	 *
+	 * \throws	UpdateEntception	If the entity type has no primary key, or the
+	 *			key has been modified.
+	 * \throws	Entception		Implementations should throw an Entception for
+	 *			any logic errors.
+	 */
+	virtual bool flush(const Entity& ent, PropertyMask /*dirty*/) throw(Entception&) {
+		throw UpdateEntception(&ent, "Partial updates are not supported by this persistence");
+	}
+
 	/*! Load an entity from persistent storage, using a collection of properties
 	 * as the criteria for loading it.
 	 *
@@ -54,6 +133,23 @@ public:
 	 */
 	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&) = 0;
 	
+	/*! Open a cursor over all the entities in persistent storage that match a
+	 * collection of properties.
+	 *
+	 * The default implementation throws, for persistences that do not
+	 * support cursors.
+	 *
+	 * \param	shape		Entity of the type to iterate over. It is only used
+	 *			to determine the entity type and its properties.
+	 * \param	criteria	Collection of properties that entities must match.
+	 *
+	 * \return	A new cursor, which the caller owns. It must be deleted before
+	 *			this persistence is destroyed.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& /*shape*/, const AbstractPropertyCollection& /*criteria*/) throw(Entception&) {
+		throw Entception("Cursors are not supported by this persistence");
+	}
+
 	/*! Delete the given entity from persistant storage.
 	 * \param	e	Entity to base deletion off of. Entity name and properties
 	 *			will be used.
@@ -61,6 +157,32 @@ public:
 	 */
 	virtual bool del(const Entity& e) throw(Entception&) = 0;
 
+	/*! Begin a transaction. Everything done through this persistence until
+	 * the matching commitTransaction or rollbackTransaction is applied
+	 * atomically. Transactions may be nested, in which case the inner
+	 * transaction is a savepoint within the outer one.
+	 *
+	 * The default implementation throws, for persistences that do not
+	 * support transactions.
+	 *
+	 * \throws	Entception	If a transaction could not be started.
+	 */
+	virtual void beginTransaction() throw(Entception&) {
+		throw Entception("Transactions are not supported by this persistence");
+	}
+
+	/*! Commit the innermost transaction that was begun. */
+	virtual void commitTransaction() throw(Entception&) {
+		throw Entception("Transactions are not supported by this persistence");
+	}
+
+	/*! Undo everything done in the innermost transaction that was begun,
+	 * and end it.
+	 */
+	virtual void rollbackTransaction() throw(Entception&) {
+		throw Entception("Transactions are not supported by this persistence");
+	}
+
 	virtual ~PersistenceApi() {}
 };
 
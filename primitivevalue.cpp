@@ -0,0 +1,230 @@
+/*! \file	primitivevalue.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <math.h>
+#include <functional>
+
+#include "primitivevalue.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+// 2^63, the first double past the end of int64_t.
+const double INT64_END = 9223372036854775808.0;
+
+template <typename T>
+int compare(T a, T b)
+{
+	return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+/*! Compare an integer with a double exactly, without rounding the integer to
+ * a double. The double must not be NaN.
+ */
+int compare(int64_t i, double d)
+{
+	if ( d < -INT64_END )	return 1;
+	if ( d >= INT64_END )	return -1;
+
+	int64_t whole = static_cast<int64_t>(d);
+	if ( i != whole )	return i < whole ? -1 : 1;
+	double fraction = d - static_cast<double>(whole);
+	return fraction > 0 ? -1 : (fraction < 0 ? 1 : 0);
+}
+
+/*! Compare two numbers by value, whatever their kinds. NaN equals itself, and
+ * is less than every other number, so numbers are totally ordered.
+ */
+int compareNumbers(const PrimitiveValue& a, const PrimitiveValue& b)
+{
+	bool aNan = !a.integral() && isnan(a.asDouble());
+	bool bNan = !b.integral() && isnan(b.asDouble());
+	if ( aNan || bNan )	return aNan == bNan ? 0 : (aNan ? -1 : 1);
+
+	if ( a.integral() && b.integral() )	return compare(a.asInt64(), b.asInt64());
+	if ( a.integral() )	return compare(a.asInt64(), b.asDouble());
+	if ( b.integral() )	return -compare(b.asInt64(), a.asDouble());
+	return compare(a.asDouble(), b.asDouble());
+}
+
+bool isNumber(PrimitiveKind kind)
+{
+	return kind != PRIMITIVE_STRING && kind != PRIMITIVE_BLOB;
+}
+
+}	// End anon namespace
+
+/*! Copies the value of a property in to a PrimitiveValue. */
+class PrimitiveValue::Reader : public ReadVisitor
+{
+public:
+	Reader(PrimitiveValue& v) : v_(v) {}
+
+	virtual bool visit(const bool& b) { return integer(PRIMITIVE_BOOL, b); }
+	virtual bool visit(const char& c) { return integer(PRIMITIVE_CHAR, c); }
+	virtual bool visit(const int& i) { return integer(PRIMITIVE_INT, i); }
+	virtual bool visit(const unsigned int& ui) { return integer(PRIMITIVE_UINT, ui); }
+	virtual bool visit(const int64_t& i) { return integer(PRIMITIVE_INT64, i); }
+
+	virtual bool visit(const double& d) {
+		v_.kind_ = PRIMITIVE_DOUBLE;
+		v_.num_.d = d;
+		return true;
+	}
+
+	virtual bool visit(const StringPrimitive& str) {
+		v_.kind_ = PRIMITIVE_STRING;
+		v_.bytes_.assign(str.data() ? str.data() : "", str.len());
+		return true;
+	}
+
+	virtual bool visit(const BlobPrimitive& blob) {
+		v_.kind_ = PRIMITIVE_BLOB;
+		v_.bytes_.assign(blob.data() ? static_cast<const char*>(blob.data()) : "", blob.len());
+		return true;
+	}
+
+private:
+	bool integer(PrimitiveKind kind, int64_t i) {
+		v_.kind_ = kind;
+		v_.num_.i = i;
+		return true;
+	}
+
+	PrimitiveValue& v_;
+};
+
+/*! Assigns a PrimitiveValue to a property. */
+class PrimitiveValue::Writer : public WriteVisitor
+{
+public:
+	Writer(const PrimitiveValue& v) : v_(v), assigned_(false) {}
+
+	virtual void visit(bool& b) { if ( number() )	b = v_.asInt64() != 0; }
+	virtual void visit(char& c) { if ( number() )	c = static_cast<char>(v_.asInt64()); }
+	virtual void visit(int& i) { if ( number() )	i = static_cast<int>(v_.asInt64()); }
+	virtual void visit(unsigned int& ui) { if ( number() )	ui = static_cast<unsigned int>(v_.asInt64()); }
+	virtual void visit(int64_t& i) { if ( number() )	i = v_.asInt64(); }
+	virtual void visit(double& d) { if ( number() )	d = v_.asDouble(); }
+
+	virtual void visit(StringPrimitive& str) {
+		if ( v_.kind_ != PRIMITIVE_STRING )	return;
+		str = StringPrimitive(v_.bytes_.data(), v_.bytes_.size());
+		assigned_ = true;
+	}
+
+	virtual void visit(BlobPrimitive& blob) {
+		if ( v_.kind_ != PRIMITIVE_BLOB )	return;
+		blob = BlobPrimitive(v_.bytes_.data(), v_.bytes_.size());
+		assigned_ = true;
+	}
+
+	bool assigned() const { return assigned_; }
+
+private:
+	bool number() {
+		assigned_ = v_.kind_ != PRIMITIVE_STRING && v_.kind_ != PRIMITIVE_BLOB;
+		return assigned_;
+	}
+
+	const PrimitiveValue& v_;
+	bool assigned_;
+};
+
+PrimitiveValue PrimitiveValue::of(const AbstractProperty& prop)
+{
+	PrimitiveValue v;
+	Reader r(v);
+	// Reading does not change the property.
+	const_cast<AbstractProperty&>(prop).acceptReader(r);
+	return v;
+}
+
+PrimitiveValue PrimitiveValue::ofInteger(PrimitiveKind kind, int64_t i)
+{
+	PrimitiveValue v;
+	v.kind_ = kind;
+	v.num_.i = i;
+	return v;
+}
+
+PrimitiveValue PrimitiveValue::ofDouble(double d)
+{
+	PrimitiveValue v;
+	v.kind_ = PRIMITIVE_DOUBLE;
+	v.num_.d = d;
+	return v;
+}
+
+PrimitiveValue PrimitiveValue::ofBytes(PrimitiveKind kind, const char* data, size_t len)
+{
+	PrimitiveValue v;
+	v.kind_ = kind;
+	v.bytes_.assign(data, len);
+	return v;
+}
+
+bool PrimitiveValue::assignTo(AbstractProperty& prop) const
+{
+	Writer w(*this);
+	prop.acceptWriter(w);
+	return w.assigned();
+}
+
+int64_t PrimitiveValue::asInt64() const
+{
+	if ( integral() )	return num_.i;
+	if ( kind_ == PRIMITIVE_DOUBLE )	return static_cast<int64_t>(num_.d);
+	return 0;
+}
+
+double PrimitiveValue::asDouble() const
+{
+	if ( integral() )	return static_cast<double>(num_.i);
+	if ( kind_ == PRIMITIVE_DOUBLE )	return num_.d;
+	return 0;
+}
+
+size_t PrimitiveValue::hash() const
+{
+	if ( integral() )	return std::hash<int64_t>()(num_.i);
+	if ( kind_ == PRIMITIVE_DOUBLE ) {
+		// Whole numbers hash as integers, as they equal the integer values.
+		double d = num_.d;
+		if ( isnan(d) )	return 0;
+		if ( d >= -INT64_END && d < INT64_END && d == floor(d) ) {
+			return std::hash<int64_t>()(static_cast<int64_t>(d));
+		}
+		return std::hash<double>()(d);
+	}
+	return std::hash<string>()(bytes_) ^ kind_;
+}
+
+bool PrimitiveValue::operator == (const PrimitiveValue& other) const
+{
+	bool number = isNumber(kind_);
+	if ( number != isNumber(other.kind_) )	return false;
+	if ( number )	return compareNumbers(*this, other) == 0;
+
+	return kind_ == other.kind_ && bytes_ == other.bytes_;
+}
+
+bool PrimitiveValue::operator < (const PrimitiveValue& other) const
+{
+	bool number = isNumber(kind_);
+	bool otherNumber = isNumber(other.kind_);
+	if ( number != otherNumber )	return number;
+	if ( number )	return compareNumbers(*this, other) < 0;
+
+	if ( kind_ != other.kind_ )	return kind_ == PRIMITIVE_STRING;
+	return bytes_ < other.bytes_;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
@@ -0,0 +1,103 @@
+#ifndef PRIMITIVE_VALUE_HPP
+#define PRIMITIVE_VALUE_HPP
+/*! \file	primitivevalue.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "abstractproperty.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! A copy of the value of a property, held as the primitive it is visited as.
+ * Strings and blobs are copied, so the value does not depend on the property
+ * it came from.
+ *
+ * Values can be compared and hashed, to key containers by property values.
+ * Numbers of every kind are compared by value, so a key read from an int
+ * property matches the same key read from an int64_t, and an int 3 equals a
+ * double 3.0. Equality, ordering and hashing always agree.
+ */
+class PrimitiveValue
+{
+public:
+	/*! Create an empty int value. */
+	PrimitiveValue() : kind_(PRIMITIVE_INT) { num_.i = 0; }
+
+	/*! Copy the value of a property. */
+	static PrimitiveValue of(const AbstractProperty& prop);
+
+	/*! Create a value of one of the integer kinds. */
+	static PrimitiveValue ofInteger(PrimitiveKind kind, int64_t i);
+
+	static PrimitiveValue ofDouble(double d);
+
+	/*! Create a string or blob value, copying the bytes. */
+	static PrimitiveValue ofBytes(PrimitiveKind kind, const char* data, size_t len);
+
+	/*! Assign this value to a property. Numbers are converted to the kind of
+	 * the property, but strings and blobs can only be assigned to properties
+	 * of the same kind. As with a WriteVisitor, the property is not marked as
+	 * dirty. View properties point in to this value, so must not outlive it.
+	 *
+	 * \return	Whether or not the value could be assigned.
+	 */
+	bool assignTo(AbstractProperty& prop) const;
+
+	PrimitiveKind kind() const { return kind_; }
+
+	/*! Whether or not the value is of one of the integer kinds, including
+	 * bool and char.
+	 */
+	bool integral() const { return isIntegral(kind_); }
+
+	/*! Get a number as an int64_t, or 0 for strings and blobs. */
+	int64_t asInt64() const;
+
+	/*! Get a number as a double, or 0 for strings and blobs. */
+	double asDouble() const;
+
+	/*! Get the bytes of a string or blob. */
+	const std::string& bytes() const { return bytes_; }
+
+	size_t hash() const;
+
+	bool operator == (const PrimitiveValue& other) const;
+	bool operator != (const PrimitiveValue& other) const { return !(*this == other); }
+
+	/*! Order values as SQLite does: numbers by value, then strings, then
+	 * blobs, each compared byte by byte. NaN is ordered before every other
+	 * number.
+	 */
+	bool operator < (const PrimitiveValue& other) const;
+
+	/*! Hash functor, for unordered containers. */
+	struct Hash {
+		size_t operator () (const PrimitiveValue& v) const { return v.hash(); }
+	};
+
+	static bool isIntegral(PrimitiveKind kind) {
+		return kind != PRIMITIVE_DOUBLE && kind != PRIMITIVE_STRING && kind != PRIMITIVE_BLOB;
+	}
+
+private:
+	class Reader;
+	class Writer;
+
+	PrimitiveKind kind_;
+	union {
+		int64_t i;
+		double d;
+	} num_;
+	std::string bytes_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
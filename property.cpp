@@ -0,0 +1,148 @@
+/*! \file	property.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "property.hpp"
+
+#include <stdint.h>
+#include <cstring>
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+// Smallest heap block an arena allocates, including its header.
+const size_t MIN_BLOCK_SIZE = 4096;
+
+char* alignUp(char* p, size_t align)
+{
+	return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(uintptr_t(align) - 1));
+}
+
+}	// End anon namespace
+
+void* PropertyArena::allocate(size_t size, size_t align)
+{
+	char* p = alignUp(cur_, align);
+	if ( cur_ && p + size <= end_ ) {
+		cur_ = p + size;
+		return p;
+	}
+
+	// Start a new block, big enough for the allocation after aligning it.
+	size_t blockSize = sizeof(Block) + size + align;
+	if ( blockSize < MIN_BLOCK_SIZE )	blockSize = MIN_BLOCK_SIZE;
+
+	Block* b = static_cast<Block*>(::operator new(blockSize));
+	b->next = blocks_;
+	blocks_ = b;
+
+	end_ = reinterpret_cast<char*>(b) + blockSize;
+	p = alignUp(reinterpret_cast<char*>(b + 1), align);
+	cur_ = p + size;
+	return p;
+}
+
+void PropertyArena::reset()
+{
+	releaseBlocks();
+	cur_ = buffer_;
+	end_ = buffer_ + bufferSize_;
+}
+
+void PropertyArena::releaseBlocks()
+{
+	while ( blocks_ ) {
+		Block* next = blocks_->next;
+		::operator delete(blocks_);
+		blocks_ = next;
+	}
+}
+
+PropertyCollection::PropertyCollection()
+	: arena_(&inlineArena_), inlineArena_(inline_, sizeof(inline_)),
+	relocators_(inlineRelocators_), capacity_(INLINE_PROPERTIES)
+{
+	props_ = inlineProps_;
+}
+
+PropertyCollection::PropertyCollection(PropertyArena& arena)
+	: arena_(&arena), relocators_(inlineRelocators_), capacity_(INLINE_PROPERTIES)
+{
+	props_ = inlineProps_;
+}
+
+PropertyCollection::PropertyCollection(PropertyCollection&& other)
+	: arena_(&inlineArena_), inlineArena_(inline_, sizeof(inline_)),
+	relocators_(inlineRelocators_), capacity_(INLINE_PROPERTIES)
+{
+	props_ = inlineProps_;
+
+	if ( other.arena_ != &other.inlineArena_ ) {
+		// The properties live in an arena, so only the pointers need taking.
+		arena_ = other.arena_;
+		if ( other.props_ != other.inlineProps_ ) {
+			props_ = other.props_;
+			relocators_ = other.relocators_;
+			capacity_ = other.capacity_;
+		} else {
+			memcpy(inlineProps_, other.inlineProps_, sizeof(inlineProps_));
+			memcpy(inlineRelocators_, other.inlineRelocators_, sizeof(inlineRelocators_));
+		}
+		size_ = other.size_;
+
+		other.props_ = other.inlineProps_;
+		other.relocators_ = other.inlineRelocators_;
+		other.capacity_ = INLINE_PROPERTIES;
+		other.size_ = 0;
+		return;
+	}
+
+	// The properties live inside the other collection, so must be moved out.
+	reserve(other.size_);
+	for ( size_t i = 0; i < other.size_; ++i ) {
+		Relocator r = other.relocators_[i];
+		push(r(other.props_[i], *arena_), r);
+	}
+	other.size_ = 0;
+	other.clear();
+}
+
+void PropertyCollection::clear()
+{
+	for ( size_t i = 0; i < size_; ++i ) {
+		props_[i]->~AbstractProperty();
+	}
+	size_ = 0;
+
+	if ( arena_ == &inlineArena_ ) {
+		inlineArena_.reset();
+		props_ = inlineProps_;
+		relocators_ = inlineRelocators_;
+		capacity_ = INLINE_PROPERTIES;
+	}
+}
+
+void PropertyCollection::reserve(size_t capacity)
+{
+	if ( capacity <= capacity_ )	return;
+
+	size_t newCapacity = capacity_ * 2;
+	if ( newCapacity < capacity )	newCapacity = capacity;
+
+	AbstractProperty** props = static_cast<AbstractProperty**>(
+		arena_->allocate(newCapacity * sizeof(AbstractProperty*), alignof(AbstractProperty*)));
+	Relocator* relocators = static_cast<Relocator*>(
+		arena_->allocate(newCapacity * sizeof(Relocator), alignof(Relocator)));
+
+	memcpy(props, props_, size_ * sizeof(AbstractProperty*));
+	memcpy(relocators, relocators_, size_ * sizeof(Relocator));
+	props_ = props;
+	relocators_ = relocators;
+	capacity_ = newCapacity;
+}
+
+}	// End namespace ent
+}	// End namespace tdk
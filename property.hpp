@@ -5,7 +5,10 @@
  * \copyright	Copyright 2012. See COPYING for details.
  */
 
-#include <iostream>
+#include <cstddef>
+#include <new>
+#include <utility>
+
 #include "abstractproperty.hpp"
 #include "conversion.hpp"
 
@@ -22,59 +25,174 @@ class Property : public AbstractProperty
 public:
 	/*!Create a property, giving it a name and owner.
 	 */
-	Property(const char* name, Entity* owner) : AbstractProperty(name, owner) {}
+	Property(const char* name, Entity* owner) : AbstractProperty(name, owner, kind()) {}
 	
 	/*! Create a property, giving it a name, owner, and initial value.
 	 */
-	Property(const char* name, Entity* owner, const T& value) : AbstractProperty(name, owner), val_(value) {}
+	Property(const char* name, Entity* owner, const T& value) : AbstractProperty(name, owner, kind()), val_(value) {}
 
 	/*! Create a property, giving it a name, but no owner. */
 	Property(const char* name) : AbstractProperty(name) {}
 	
 	/*! Create a property, giving it a name and initial value, but no owner. */
 	Property(const char* name, const T& value) : AbstractProperty(name), val_(value) {}
+
+	/*! Create a property, giving it a name and an initial value that is moved
+	 * into it, but no owner.
+	 */
+	Property(const char* name, T&& value) : AbstractProperty(name), val_(std::move(value)) {}
 	
 	/*! Get the value of the property. */
 	//const T& operator () () const { return val_; }
 	const T& val() const { return val_; }
 	
-	/*! Set the value of the property. */
+	/*! Set the value of the property, marking it as dirty. */
 	Property<T>& operator = (const T& newVal) {
-		std::cout << "operator =. Assigning " << newVal << std::endl;
 		val_ = newVal;
+		markDirty();
 		return *this;
 	}
 
-	void set(const T& newVal) { val_ = newVal; }
+	void set(const T& newVal) {
+		val_ = newVal;
+		markDirty();
+	}
 
 	/*! Override the virtual accept reader method, which will allow a read
 	 * visitor for the encapsulated type T to be used on this property.
 	 */
-	virtual bool acceptReader(ReadVisitor& rv) {
-		return rv.visit(PersistenceTypeConversion<T>::toPrimitive(val_));
+	virtual bool acceptReader(ReadVisitor& rv) { return readWith(rv); }
+
+	virtual void acceptWriter(WriteVisitor& wv) { writeWith(wv); }
+
+	/*! Read the value of the property with a visitor of any type that has a
+	 * visit method for the primitive type of T. The call is made statically,
+	 * so it can be inlined.
+	 * \see	forEachProperty
+	 */
+	template <typename Visitor>
+	bool readWith(Visitor& v) const {
+		return v.visit(PersistenceTypeConversion<T>::toPrimitive(val_));
 	}
 
-	virtual void acceptWriter(WriteVisitor& wv) {
+	/*! Assign the value of the property with a visitor of any type that has a
+	 * visit method for the primitive type of T. Like a WriteVisitor, this does
+	 * not mark the property as dirty.
+	 */
+	template <typename Visitor>
+	void writeWith(Visitor& v) {
 		typename PersistenceTypeConversion<T>::PrimitiveType p;
-		wv.visit(p);
-		val_ = PersistenceTypeConversion<T>::fromPrimitive(p);
+		v.visit(p);
+		PersistenceTypeAssign<T>::assign(val_, p);
 	}
 
 private:
 	Property<T>(const Property<T>& other) {}
+
+	// Used by collections to move their properties into new storage.
+	Property<T>(Property<T>&& other) : AbstractProperty(other.propertyName()), val_(std::move(other.val_)) {}
+	friend class PropertyCollection;
+
+	static PrimitiveKind kind() {
+		return PrimitiveKindOf<typename PersistenceTypeConversion<T>::PrimitiveType>::value;
+	}
+
 	T val_;
 };
 
 
+/*! An arena hands out memory for the properties of collections, from a
+ * buffer supplied by the caller and then from blocks on the heap once the
+ * buffer is used up. Memory is never freed individually, but all at once when
+ * the arena is reset or destroyed, so one arena can serve many short lived
+ * collections without touching the heap.
+ *
+ * ~~~{.cpp}
+ * char buffer[4096];
+ * PropertyArena arena(buffer, sizeof(buffer));
+ * for ( ... ) {
+ * 	PropertyCollection criteria(arena);
+ * 	criteria.add(person->id, id);
+ * 	person->load(criteria);
+ * }
+ * ~~~
+ *
+ * Arenas are not thread safe.
+ */
+class PropertyArena
+{
+public:
+	/*! Create an arena that only allocates from the heap. */
+	PropertyArena() : buffer_(NULL), bufferSize_(0), cur_(NULL), end_(NULL), blocks_(NULL) {}
+
+	/*! Create an arena that allocates from a buffer, and then from the heap.
+	 * \param	buffer	Memory to allocate from, which must outlive the arena.
+	 * \param	size	Size of the buffer in bytes.
+	 */
+	PropertyArena(void* buffer, size_t size)
+		: buffer_(static_cast<char*>(buffer)), bufferSize_(size),
+		cur_(buffer_), end_(buffer_ + size), blocks_(NULL) {}
+
+	~PropertyArena() { releaseBlocks(); }
+
+	/*! Allocate memory with the given alignment, which must be a power of two.
+	 * \throws	std::bad_alloc	If a block could not be allocated on the heap.
+	 */
+	void* allocate(size_t size, size_t align);
+
+	/*! Free everything allocated from the arena at once. Nothing allocated
+	 * from it may still be in use.
+	 */
+	void reset();
+
+private:
+	struct Block {
+		Block* next;
+	};
+
+	void releaseBlocks();
+
+	PropertyArena(const PropertyArena&);
+	PropertyArena& operator = (const PropertyArena&);
+
+	char* buffer_;
+	size_t bufferSize_;
+	char* cur_;
+	char* end_;
+	Block* blocks_;
+};
+
 /*! The PropertyCollection class is used to create a collection properties from
  * entities. These properties take the name (and optionally, value) from the
  * another property, but do not add themselves to the owner of said property.
  * Property collections are important for persistence, as it allows loading and
  * updating to be performed with incomplete entity data.
+ *
+ * The properties are placed in a small buffer inside the collection, so
+ * collections of a few properties do not allocate at all. Larger collections
+ * overflow onto the heap. Alternatively, collections can place their
+ * properties in an arena shared with other collections. All the properties are
+ * destroyed together with the collection.
  */
 class PropertyCollection : public AbstractPropertyCollection
 {
 public:
+	/*! Create a collection that stores its properties inline. */
+	PropertyCollection();
+
+	/*! Create a collection that stores its properties in an arena.
+	 * \param	arena	Arena to allocate from, which must outlive the collection.
+	 */
+	explicit PropertyCollection(PropertyArena& arena);
+
+	/*! Move a collection. Properties stored inline are moved into the new
+	 * collection, and those in an arena are handed over to it.
+	 */
+	PropertyCollection(PropertyCollection&& other);
+
+	/*! Destroy a property collection, destroying all the properties it contains. */
+	~PropertyCollection() { clear(); }
+
 	/*! Add a property to the collection, keeping it's name but assigning it a
 	 * new value.
 	 *
@@ -84,9 +202,16 @@ public:
 	 * \param	newVal	Value to assign to the property.
 	 */
 	template <typename T>
-	void add(Property<T>& prop, const T& newVal) {
-		Property<T>* p = new Property<T>( prop.propertyName(), newVal );
-		props_.push_back(p);
+	void add(const Property<T>& prop, const T& newVal) {
+		push(new (allocate<T>()) Property<T>( prop.propertyName(), newVal ), &relocate<T>);
+	}
+
+	/*! Add a property to the collection, keeping it's name but moving a new
+	 * value into it.
+	 */
+	template <typename T>
+	void add(const Property<T>& prop, T&& newVal) {
+		push(new (allocate<T>()) Property<T>( prop.propertyName(), std::move(newVal) ), &relocate<T>);
 	}
 	
 	/*! Add a property to the collection, keeping it's name and value.
@@ -94,18 +219,56 @@ public:
 	 * \param	prop	Property to add to the collection, copying the name and value.
 	 */
 	template <typename T>
-	void add(Property<T>& prop) {
-		Property<T>* p = new Property<T>( prop.propertyName(), prop() );
-		props_.push_back(p);
+	void add(const Property<T>& prop) {
+		push(new (allocate<T>()) Property<T>( prop.propertyName(), prop.val() ), &relocate<T>);
 	}
-	
-	/*! Destroy a property collection, deleting all the properties it contains. */
-	~PropertyCollection() {
-		for ( size_t i = 0; i < props_.size(); ++i ) {
-			delete props_[i];
-		}
+
+	/*! Destroy all the properties in the collection. Memory in an arena is not
+	 * freed until the arena is reset.
+	 */
+	void clear();
+
+private:
+	// Move constructs a property into memory from an arena, and destroys the
+	// original.
+	typedef AbstractProperty* (*Relocator)(AbstractProperty* from, PropertyArena& to);
+
+	template <typename T>
+	static AbstractProperty* relocate(AbstractProperty* from, PropertyArena& to) {
+		Property<T>* p = static_cast<Property<T>*>(from);
+		AbstractProperty* moved = new (to.allocate(sizeof(Property<T>), alignof(Property<T>))) Property<T>(std::move(*p));
+		p->~Property<T>();
+		return moved;
+	}
+
+	// Make room for another property, then allocate memory for it. Making
+	// room first means nothing is leaked if that allocation fails.
+	template <typename T>
+	void* allocate() {
+		reserve(size_ + 1);
+		return arena_->allocate(sizeof(Property<T>), alignof(Property<T>));
+	}
+
+	void push(AbstractProperty* p, Relocator r) {
+		relocators_[size_] = r;
+		props_[size_++] = p;
 	}
 
+	void reserve(size_t capacity);
+
+	PropertyCollection(const PropertyCollection&);
+	PropertyCollection& operator = (const PropertyCollection&);
+
+	static const size_t INLINE_PROPERTIES = 8;
+	static const size_t INLINE_BYTES = 512;
+
+	PropertyArena* arena_;
+	PropertyArena inlineArena_;
+	Relocator* relocators_;
+	size_t capacity_;
+	AbstractProperty* inlineProps_[INLINE_PROPERTIES];
+	Relocator inlineRelocators_[INLINE_PROPERTIES];
+	alignas(alignof(std::max_align_t)) char inline_[INLINE_BYTES];
 };
 
 }	// End namespace ent
@@ -8,6 +8,8 @@
  * an AbstractProperty* is available, the visitor pattern is used to perform
  * a double dispatch.
  */
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 
 namespace tdk {
@@ -41,6 +43,46 @@ private:
 	size_t len_;
 };
 
+/** Binary data is visited as a pointer and length, so it can be passed to and
+ * from persistent storage without being copied or encoded.
+ */
+class BlobPrimitive
+{
+public:
+	BlobPrimitive() : data_(NULL), len_(0) {}
+	BlobPrimitive(const void* data, size_t len) : data_(data), len_(len) {}
+	const void* data() const { return data_; }
+	size_t len() const { return len_; }
+private:
+	const void* data_;
+	size_t len_;
+};
+
+/** The kinds of primitive that properties can be visited as. */
+typedef enum {
+	PRIMITIVE_BOOL,
+	PRIMITIVE_CHAR,
+	PRIMITIVE_INT,
+	PRIMITIVE_UINT,
+	PRIMITIVE_DOUBLE,
+	PRIMITIVE_STRING,
+	PRIMITIVE_INT64,
+	PRIMITIVE_BLOB,
+} PrimitiveKind;
+
+/** Traits class giving the PrimitiveKind of each primitive type. */
+template <typename Primitive>
+struct PrimitiveKindOf;
+
+template <> struct PrimitiveKindOf<bool> { static const PrimitiveKind value = PRIMITIVE_BOOL; };
+template <> struct PrimitiveKindOf<char> { static const PrimitiveKind value = PRIMITIVE_CHAR; };
+template <> struct PrimitiveKindOf<int> { static const PrimitiveKind value = PRIMITIVE_INT; };
+template <> struct PrimitiveKindOf<unsigned int> { static const PrimitiveKind value = PRIMITIVE_UINT; };
+template <> struct PrimitiveKindOf<double> { static const PrimitiveKind value = PRIMITIVE_DOUBLE; };
+template <> struct PrimitiveKindOf<StringPrimitive> { static const PrimitiveKind value = PRIMITIVE_STRING; };
+template <> struct PrimitiveKindOf<int64_t> { static const PrimitiveKind value = PRIMITIVE_INT64; };
+template <> struct PrimitiveKindOf<BlobPrimitive> { static const PrimitiveKind value = PRIMITIVE_BLOB; };
+
 /** Visitor class used for reading from properties. */
 class ReadVisitor
 {
@@ -51,6 +93,8 @@ public:
 	virtual bool visit(const unsigned int& ui) = 0;
 	virtual bool visit(const double& d) = 0;
 	virtual bool visit(const StringPrimitive& str) = 0;
+	virtual bool visit(const int64_t& i) = 0;
+	virtual bool visit(const BlobPrimitive& blob) = 0;
 
 	virtual ~ReadVisitor() {}
 };
@@ -63,7 +107,10 @@ public:
 	virtual void visit(char& c) = 0;
 	virtual void visit(int& i) = 0;
 	virtual void visit(unsigned int& ui) = 0;
+	virtual void visit(double& d) = 0;
 	virtual void visit(StringPrimitive& str) = 0;
+	virtual void visit(int64_t& i) = 0;
+	virtual void visit(BlobPrimitive& blob) = 0;
 
 	virtual ~WriteVisitor() {}
 };
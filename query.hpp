@@ -0,0 +1,120 @@
+#ifndef QUERY_HPP
+#define QUERY_HPP
+/*! \file	query.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <iterator>
+
+#include "persistenceapi.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! A query is a range over all the entities that matched some criteria. The
+ * entities are loaded lazily from a persistence cursor, one at a time, in to a
+ * single entity owned by the query. Iterating over a query therefore uses
+ * constant memory, no matter how many entities match.
+ *
+ * Queries are created by EntityFactory::query.
+ *
+ * ~~~{.cpp}
+ * Query<Person> people = factory.query<Person>(criteria);
+ * for ( Query<Person>::iterator it = people.begin(); it != people.end(); ++it ) {
+ *     std::cout << it->name.val() << std::endl;
+ * }
+ * ~~~
+ *
+ * As the same entity is reused for every row, references to it are only valid
+ * until the query moves on. Copy out anything that needs to be kept.
+ *
+ * Entities with Property<StringPrimitive> or Property<BlobPrimitive> are
+ * loaded without copying their strings and blobs at all, as the properties
+ * point straight in to the row held by the cursor. This is the fastest way to
+ * scan text heavy tables, but those properties are also only valid until the
+ * query moves on.
+ *
+ * \tparam	Ent		Entity type being queried.
+ */
+template <typename Ent>
+class Query
+{
+public:
+	/*! Input iterator over the entities of a query. */
+	class iterator : public std::iterator<std::input_iterator_tag, Ent>
+	{
+	public:
+		iterator() : query_(NULL) {}
+
+		Ent& operator * () const { return *query_->ent_; }
+		Ent* operator -> () const { return query_->ent_; }
+
+		iterator& operator ++ () {
+			if ( !query_->next() )	query_ = NULL;
+			return *this;
+		}
+
+		bool operator == (const iterator& other) const { return query_ == other.query_; }
+		bool operator != (const iterator& other) const { return query_ != other.query_; }
+
+	private:
+		iterator(Query* query) : query_(query) {}
+		Query* query_;	// Query being iterated, or NULL at the end.
+
+		friend class Query;
+	};
+
+	/*! Create a query over the entities of a cursor.
+	 * \param	ent		Entity to load each row in to. The query takes ownership.
+	 * \param	cursor	Cursor to step through. The query takes ownership.
+	 */
+	Query(Ent* ent, PersistenceCursor* cursor) : ent_(ent), cursor_(cursor), started_(false) {}
+
+	Query(Query&& other) : ent_(other.ent_), cursor_(other.cursor_), started_(other.started_) {
+		other.ent_ = NULL;
+		other.cursor_ = NULL;
+	}
+
+	~Query() {
+		delete cursor_;
+		delete ent_;
+	}
+
+	/*! Load the next matching entity.
+	 * \return	Whether or not there was another entity. If there was, it is
+	 *			available through entity().
+	 */
+	bool next() throw(Entception&) {
+		started_ = true;
+		if ( !cursor_->step() )	return false;
+
+		cursor_->read(*ent_);
+		return true;
+	}
+
+	/*! Get the entity holding the most recently loaded data. */
+	Ent& entity() const { return *ent_; }
+
+	/*! Start iterating over the query. A query can only be iterated once. */
+	iterator begin() throw(Entception&) {
+		if ( started_ || !next() )	return end();
+		return iterator(this);
+	}
+
+	iterator end() { return iterator(); }
+
+private:
+	Query(const Query&);
+	Query& operator = (const Query&);
+
+	Ent* ent_;
+	PersistenceCursor* cursor_;
+	bool started_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
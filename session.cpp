@@ -0,0 +1,112 @@
+/*! \file	session.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "session.hpp"
+
+namespace tdk {
+namespace ent {
+
+Session::Owned& Session::ownedEntry(const Entity& e) throw(Entception&)
+{
+	OwnedMap::iterator it = owned_.find(&e);
+	if ( it == owned_.end() ) {
+		throw Entception("Entity does not belong to this session");
+	}
+	return it->second;
+}
+
+void Session::remap(Entity& e)
+{
+	Owned& o = owned_[&e];
+	unmap(o);
+
+	AbstractProperty* pk = e.primaryKey();
+	if ( !pk )	return;
+
+	o.key = PrimitiveValue::of(*pk);
+	Identity id(o.type, o.key);
+	std::pair<IdentityMap::iterator, bool> inserted = identities_.insert(std::make_pair(id, &e));
+	if ( !inserted.second ) {
+		// Persistent storage says the key is now this entity's, so the entity
+		// mapped before must be stale.
+		owned_[inserted.first->second].mapped = false;
+		inserted.first->second = &e;
+	}
+	o.mapped = true;
+}
+
+void Session::unmap(Owned& o)
+{
+	if ( !o.mapped )	return;
+	identities_.erase(Identity(o.type, o.key));
+	o.mapped = false;
+}
+
+void Session::discard(Entity& e)
+{
+	OwnedMap::iterator it = owned_.find(&e);
+	unmap(it->second);
+	void (*destroy)(Entity*) = it->second.destroy;
+	owned_.erase(it);
+	destroy(&e);
+}
+
+bool Session::save(Entity& e) throw(Entception&)
+{
+	ownedEntry(e);
+	bool saved = e.save();
+	if ( saved )	remap(e);
+	return saved;
+}
+
+bool Session::update(Entity& e, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	ownedEntry(e);
+	if ( !e.update(updates) )	return false;
+
+	AbstractPropertyCollection::PropertyArray props = updates.props();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( AbstractProperty* p = e[props[i]->propertyName()] ) {
+			PrimitiveValue::of(*props[i]).assignTo(*p);
+		}
+	}
+
+	remap(e);
+	return true;
+}
+
+bool Session::flush(Entity& e) throw(Entception&)
+{
+	ownedEntry(e);
+	bool flushed = e.flush();
+	if ( flushed )	remap(e);
+	return flushed;
+}
+
+bool Session::del(Entity& e) throw(Entception&)
+{
+	Owned& o = ownedEntry(e);
+	bool deleted = e.del();
+	if ( deleted )	unmap(o);
+	return deleted;
+}
+
+void Session::evict(Entity& e)
+{
+	OwnedMap::iterator it = owned_.find(&e);
+	if ( it != owned_.end() )	unmap(it->second);
+}
+
+void Session::clear()
+{
+	identities_.clear();
+	for ( OwnedMap::iterator it = owned_.begin(); it != owned_.end(); ++it ) {
+		it->second.destroy(const_cast<Entity*>(it->first));
+	}
+	owned_.clear();
+}
+
+}	// End namespace ent
+}	// End namespace tdk
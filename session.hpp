@@ -0,0 +1,201 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+/*! \file	session.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <unordered_map>
+
+#include "entity.hpp"
+#include "entityfactory.hpp"
+#include "primitivevalue.hpp"
+#include "property.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! A session is a unit of work on an entity factory, holding an identity map
+ * of the entities it has loaded or saved. Each row is only loaded once per
+ * session: finding an entity by primary key that is already in the map
+ * returns the same entity object, without touching persistent storage.
+ *
+ * ~~~{.cpp}
+ * Session session(factory);
+ * Country* uk = session.find<Country>(44);
+ * ...
+ * Country* same = session.find<Country>(44);	// No query, same == uk
+ * ~~~
+ *
+ * The session owns every entity it creates or finds, which are all deleted
+ * with it. Saves, updates and deletes of those entities should be made
+ * through the session, which keeps the map in step with persistent storage.
+ * Changes made to the same rows elsewhere are not seen, so sessions are meant
+ * to be short lived, such as one per request. Entities with view properties,
+ * such as Property<StringPrimitive>, must not be updated through a session.
+ *
+ * Entity types without a primary key can be created and saved through a
+ * session, but are never held in the map. Sessions are not thread safe.
+ */
+class Session
+{
+public:
+	/*! Create a session on a factory, which must outlive it. */
+	explicit Session(EntityFactory& factory) : factory_(factory) {}
+
+	/*! Delete every entity of the session. */
+	~Session() { clear(); }
+
+	/*! Create an entity owned by the session. It enters the identity map once
+	 * it has been saved.
+	 */
+	template <typename Ent>
+	Ent* create() {
+		Ent* ent = factory_.template create<Ent>();
+		Owned& o = owned_[ent];
+		o.destroy = &destroy<Ent>;
+		o.type = typeToken<Ent>();
+		o.mapped = false;
+		return ent;
+	}
+
+	/*! Find an entity by the value of its primary key. The entity in the
+	 * identity map is returned if there is one, or else the entity is loaded
+	 * and added to the map.
+	 *
+	 * \tparam	Ent		Entity type to find.
+	 * \tparam	K		Type of the primary key property's value.
+	 *
+	 * \return	The entity, which the session owns.
+	 * \retval	NULL	No entity has the key.
+	 *
+	 * \throws	Entception	If the entity type has no primary key, or the
+	 *			load failed.
+	 */
+	template <typename Ent, typename K>
+	Ent* find(const K& key) throw(Entception&) {
+		Property<K> keyProp("", key);
+		Identity id(typeToken<Ent>(), PrimitiveValue::of(keyProp));
+		IdentityMap::const_iterator it = identities_.find(id);
+		if ( it != identities_.end() )	return static_cast<Ent*>(it->second);
+
+		Ent* ent = create<Ent>();
+		try {
+			AbstractProperty* pk = ent->primaryKey();
+			if ( !pk ) {
+				throw LoadEntception(ent, "Entity type has no primary key to find it by");
+			}
+
+			PropertyCollection criteria;
+			criteria.add(Property<K>(pk->propertyName()), key);
+			if ( !ent->load(criteria) ) {
+				discard(*ent);
+				return NULL;
+			}
+		} catch (Entception& e) {
+			discard(*ent);
+			THROW_AGAIN(e, "Session failed to find an entity.");
+		}
+
+		remap(*ent);
+		return ent;
+	}
+
+	/*! Find an entity by a string primary key. */
+	template <typename Ent>
+	Ent* find(const char* key) throw(Entception&) { return find<Ent>(std::string(key)); }
+
+	/*! Save an entity of the session, and add it to the identity map.
+	 * \throws	Entception	If the entity does not belong to the session, or
+	 *			the save failed.
+	 */
+	bool save(Entity& e) throw(Entception&);
+
+	/*! Update an entity of the session. Once persistent storage has been
+	 * updated, the updates are assigned to the entity too, so it stays the
+	 * same as the row.
+	 */
+	bool update(Entity& e, const AbstractPropertyCollection& updates) throw(Entception&);
+
+	/*! Write the modified properties of an entity of the session. */
+	bool flush(Entity& e) throw(Entception&);
+
+	/*! Delete an entity of the session from persistent storage, and remove it
+	 * from the identity map. The entity object lives on until the session is
+	 * cleared or destroyed.
+	 */
+	bool del(Entity& e) throw(Entception&);
+
+	/*! Remove an entity from the identity map, so the next find of its key
+	 * loads it again. The entity object lives on until the session is cleared
+	 * or destroyed.
+	 */
+	void evict(Entity& e);
+
+	/*! Delete every entity of the session and empty the identity map. */
+	void clear();
+
+	/*! Get the number of entities in the identity map. */
+	size_t size() const { return identities_.size(); }
+
+private:
+	/*! An entity type and primary key value. Types are told apart by a token
+	 * per entity class, so no entity has to be constructed to look one up.
+	 */
+	struct Identity {
+		Identity(const void* t, const PrimitiveValue& k) : type(t), key(k) {}
+		const void* type;
+		PrimitiveValue key;
+		bool operator == (const Identity& other) const { return type == other.type && key == other.key; }
+	};
+
+	struct IdentityHash {
+		size_t operator () (const Identity& id) const {
+			return id.key.hash() ^ (reinterpret_cast<size_t>(id.type) >> 3);
+		}
+	};
+
+	/*! An entity owned by the session, and whether it is in the map. */
+	struct Owned {
+		void (*destroy)(Entity*);
+		const void* type;
+		bool mapped;
+		PrimitiveValue key;
+	};
+
+	typedef std::unordered_map<Identity, Entity*, IdentityHash> IdentityMap;
+	typedef std::unordered_map<const Entity*, Owned> OwnedMap;
+
+	template <typename Ent>
+	static const void* typeToken() {
+		static const char token = 0;
+		return &token;
+	}
+
+	// Entity has no virtual destructor, so entities are deleted as their own
+	// type.
+	template <typename Ent>
+	static void destroy(Entity* e) { delete static_cast<Ent*>(e); }
+
+	Owned& ownedEntry(const Entity& e) throw(Entception&);
+
+	// Put an entity in the map under its current primary key.
+	void remap(Entity& e);
+	void unmap(Owned& o);
+
+	// Delete an entity of the session straight away.
+	void discard(Entity& e);
+
+	Session(const Session&);
+	Session& operator = (const Session&);
+
+	EntityFactory& factory_;
+	IdentityMap identities_;
+	OwnedMap owned_;
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,450 @@
+/*! \file	shardedpersistenceapi.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <string.h>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "entity.hpp"
+#include "shardedpersistenceapi.hpp"
+
+using namespace std;
+
+namespace tdk {
+namespace ent {
+
+namespace {
+
+/*! FNV-1a hash of the 8 bytes of a number, least significant first, so it is
+ * the same on every platform.
+ */
+uint64_t hashBytes(uint64_t v)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for ( int i = 0; i < 8; ++i ) {
+		hash = (hash ^ ((v >> (i * 8)) & 0xff)) * 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t hashBytes(const string& bytes)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for ( size_t i = 0; i < bytes.size(); ++i ) {
+		hash = (hash ^ static_cast<unsigned char>(bytes[i])) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/*! Call a function with each index up to a count, each on a thread of its own
+ * if parallel, or else in turn on this thread. Every call is complete on
+ * return.
+ * \throws	The first exception thrown by any of the calls.
+ */
+template <typename Fn>
+void forEachIndex(size_t count, bool parallel, Fn fn)
+{
+	if ( !parallel || count < 2 ) {
+		for ( size_t i = 0; i < count; ++i ) {
+			fn(i);
+		}
+		return;
+	}
+
+	// This thread takes the first index itself.
+	vector< future<void> > others;
+	exception_ptr error;
+	try {
+		for ( size_t i = 1; i < count; ++i ) {
+			others.push_back(async(launch::async, fn, i));
+		}
+		fn(0);
+	} catch (...) {
+		error = current_exception();
+	}
+
+	for ( size_t i = 0; i < others.size(); ++i ) {
+		try {
+			others[i].get();
+		} catch (...) {
+			if ( !error )	error = current_exception();
+		}
+	}
+	if ( error )	rethrow_exception(error);
+}
+
+}	// End anon namespace
+
+/*! Steps through cursors on several shards in turn. Each shard is only locked
+ * while its cursor is used, so other threads can use the shards in between.
+ */
+class ShardedPersistenceApi::MergedCursor : public PersistenceCursor
+{
+public:
+	/*! Take over a cursor per shard, or NULL for shards without rows.
+	 * \param	primed	Whether or not each cursor has already been stepped to
+	 *			its first row.
+	 */
+	MergedCursor(ShardedPersistenceApi& api, vector<PersistenceCursor*>& cursors, vector<char>& primed)
+			: api_(api), current_(0) {
+		cursors_.swap(cursors);
+		primed_.swap(primed);
+	}
+
+	virtual bool step() throw(Entception&) {
+		for ( ; current_ < cursors_.size(); ++current_ ) {
+			if ( !cursors_[current_] )	continue;
+
+			if ( primed_[current_] ) {
+				primed_[current_] = 0;
+				return true;
+			}
+
+			lock_guard<recursive_mutex> lock(api_.shards_[current_]->mutex);
+			if ( cursors_[current_]->step() )	return true;
+
+			// Give the shard its statement back as soon as it is finished with.
+			delete cursors_[current_];
+			cursors_[current_] = NULL;
+		}
+		return false;
+	}
+
+	virtual void read(Entity& ent) throw(Entception&) {
+		if ( current_ >= cursors_.size() ) {
+			throw LoadEntception(&ent, "The cursor is not on a row.");
+		}
+
+		lock_guard<recursive_mutex> lock(api_.shards_[current_]->mutex);
+		cursors_[current_]->read(ent);
+	}
+
+	virtual ~MergedCursor() {
+		for ( size_t i = 0; i < cursors_.size(); ++i ) {
+			if ( !cursors_[i] )	continue;
+			lock_guard<recursive_mutex> lock(api_.shards_[i]->mutex);
+			delete cursors_[i];
+		}
+	}
+
+private:
+	ShardedPersistenceApi& api_;
+	vector<PersistenceCursor*> cursors_;
+	vector<char> primed_;
+	size_t current_;	// Shard being stepped through.
+};
+
+ShardedPersistenceApi::ShardedPersistenceApi(const vector<PersistenceApi*>& shards) throw(Entception&)
+	: owner_(thread::id()), depth_(0), committed_(0)
+{
+	if ( shards.empty() ) {
+		throw Entception("A sharded persistence needs at least one shard.");
+	}
+
+	for ( size_t i = 0; i < shards.size(); ++i ) {
+		shards_.push_back(new Shard(shards[i]));
+	}
+}
+
+ShardedPersistenceApi::~ShardedPersistenceApi()
+{
+	for ( size_t i = 0; i < shards_.size(); ++i ) {
+		delete shards_[i];
+	}
+}
+
+size_t ShardedPersistenceApi::shardOf(const PrimitiveValue& key) const
+{
+	uint64_t hash;
+	if ( key.integral() ) {
+		hash = hashBytes(static_cast<uint64_t>(key.asInt64()));
+	} else if ( key.kind() == PRIMITIVE_DOUBLE ) {
+		double d = key.asDouble();
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		hash = hashBytes(bits);
+	} else {
+		hash = hashBytes(key.bytes());
+	}
+
+	// The low bits of FNV-1a are poorly mixed.
+	hash ^= hash >> 32;
+	return static_cast<size_t>(hash % shards_.size());
+}
+
+size_t ShardedPersistenceApi::shardOf(const Entity& ent) const throw(Entception&)
+{
+	AbstractProperty* pk = ent.primaryKey();
+	if ( !pk ) {
+		throw Entception(string("Entity type ") + ent.entitytype() + " has no primary key to shard by");
+	}
+	return shardOf(PrimitiveValue::of(*pk));
+}
+
+int ShardedPersistenceApi::shardOf(const Entity& shape, const AbstractPropertyCollection& criteria) const
+{
+	const EntitySchema& schema = shape.schema();
+	if ( schema.primaryKey() < 0 )	return -1;
+
+	AbstractPropertyCollection::PropertyArray props = criteria.props();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( schema.indexOf(props[i]->propertyName()) == schema.primaryKey() ) {
+			return static_cast<int>(shardOf(PrimitiveValue::of(*props[i])));
+		}
+	}
+	return -1;
+}
+
+bool ShardedPersistenceApi::save(const Entity& ent) throw(Entception&)
+{
+	Shard& s = *shards_[shardOf(ent)];
+	lock_guard<recursive_mutex> lock(s.mutex);
+	return s.api->save(ent);
+}
+
+bool ShardedPersistenceApi::saveAll(const Entity* const* ents, size_t count) throw(Entception&)
+{
+	vector< vector<const Entity*> > parts(shards_.size());
+	for ( size_t i = 0; i < count; ++i ) {
+		parts[shardOf(*ents[i])].push_back(ents[i]);
+	}
+
+	vector<size_t> used;
+	for ( size_t i = 0; i < parts.size(); ++i ) {
+		if ( !parts[i].empty() )	used.push_back(i);
+	}
+
+	vector<char> saved(used.size(), 0);
+	if ( inTransaction() ) {
+		// The shards are already locked by this thread, so the parts are
+		// saved in turn, and the transaction is the caller's.
+		forEachIndex(used.size(), false, [&] (size_t j) {
+			const vector<const Entity*>& part = parts[used[j]];
+			saved[j] = shards_[used[j]]->api->saveAll(part.data(), part.size());
+		});
+	} else {
+		// Each part is saved in a transaction of its own shard, and none are
+		// committed until every part is saved, so a failed part leaves
+		// nothing behind. This thread holds the locks, in order, while the
+		// parts are saved in parallel.
+		for ( size_t j = 0; j < used.size(); ++j ) {
+			shards_[used[j]]->mutex.lock();
+		}
+
+		vector<char> begun(used.size(), 0);
+		size_t committed = 0;
+		try {
+			forEachIndex(used.size(), true, [&] (size_t j) {
+				PersistenceApi& api = *shards_[used[j]]->api;
+				const vector<const Entity*>& part = parts[used[j]];
+				api.beginTransaction();
+				begun[j] = 1;
+				saved[j] = api.saveAll(part.data(), part.size());
+			});
+
+			// Committing is not atomic across shards, as with transactions.
+			for ( ; committed < used.size(); ++committed ) {
+				shards_[used[committed]]->api->commitTransaction();
+			}
+		} catch (Entception& e) {
+			for ( size_t j = committed; j < used.size(); ++j ) {
+				if ( !begun[j] )	continue;
+				try {
+					shards_[used[j]]->api->rollbackTransaction();
+				} catch (Entception& rollbackFailure) {
+					// The batch failed to save, which is what to report.
+				}
+			}
+			for ( size_t j = used.size(); j-- > 0; ) {
+				shards_[used[j]]->mutex.unlock();
+			}
+			throw;
+		}
+
+		for ( size_t j = used.size(); j-- > 0; ) {
+			shards_[used[j]]->mutex.unlock();
+		}
+	}
+
+	for ( size_t j = 0; j < saved.size(); ++j ) {
+		if ( !saved[j] )	return false;
+	}
+	return true;
+}
+
+bool ShardedPersistenceApi::update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&)
+{
+	size_t shard = shardOf(ent);
+
+	// A new key could belong in another shard.
+	const EntitySchema& schema = ent.schema();
+	AbstractPropertyCollection::PropertyArray props = updates.props();
+	for ( size_t i = 0; i < props.size(); ++i ) {
+		if ( schema.indexOf(props[i]->propertyName()) == schema.primaryKey()
+				&& PrimitiveValue::of(*props[i]) != PrimitiveValue::of(*ent.primaryKey()) ) {
+			throw UpdateEntception(&ent, "The primary key of a sharded entity can not be changed.");
+		}
+	}
+
+	Shard& s = *shards_[shard];
+	lock_guard<recursive_mutex> lock(s.mutex);
+	return s.api->update(ent, updates);
+}
+
+bool ShardedPersistenceApi::flush(const Entity& ent, PropertyMask dirty) throw(Entception&)
+{
+	size_t shard = shardOf(ent);
+
+	// The entity holds its new key, which would find the wrong shard.
+	if ( dirty & (PropertyMask(1) << ent.schema().primaryKey()) ) {
+		throw UpdateEntception(&ent, "The primary key has been modified, so the entity can not be found.");
+	}
+
+	Shard& s = *shards_[shard];
+	lock_guard<recursive_mutex> lock(s.mutex);
+	return s.api->flush(ent, dirty);
+}
+
+bool ShardedPersistenceApi::load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	int shard = shardOf(ent, criteria);
+	if ( shard >= 0 ) {
+		Shard& s = *shards_[shard];
+		lock_guard<recursive_mutex> lock(s.mutex);
+		return s.api->load(ent, criteria);
+	}
+
+	unique_ptr<MergedCursor> cursor(fanOut(ent, criteria));
+	if ( !cursor->step() )	return false;
+	cursor->read(ent);
+	return true;
+}
+
+bool ShardedPersistenceApi::del(const Entity& ent) throw(Entception&)
+{
+	Shard& s = *shards_[shardOf(ent)];
+	lock_guard<recursive_mutex> lock(s.mutex);
+	return s.api->del(ent);
+}
+
+PersistenceCursor* ShardedPersistenceApi::openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	int shard = shardOf(shape, criteria);
+	if ( shard < 0 )	return fanOut(shape, criteria);
+
+	vector<PersistenceCursor*> cursors(shards_.size(), NULL);
+	vector<char> primed(shards_.size(), 0);
+	{
+		Shard& s = *shards_[shard];
+		lock_guard<recursive_mutex> lock(s.mutex);
+		cursors[shard] = s.api->openCursor(shape, criteria);
+	}
+	return new MergedCursor(*this, cursors, primed);
+}
+
+ShardedPersistenceApi::MergedCursor* ShardedPersistenceApi::fanOut(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&)
+{
+	// Cursors are opened and deleted on the thread that locked their shard.
+	vector<PersistenceCursor*> cursors(shards_.size(), NULL);
+	vector<char> primed(shards_.size(), 0);
+	try {
+		forEachIndex(shards_.size(), !inTransaction(), [&] (size_t i) {
+			Shard& s = *shards_[i];
+			lock_guard<recursive_mutex> lock(s.mutex);
+			cursors[i] = s.api->openCursor(shape, criteria);
+			primed[i] = cursors[i]->step();
+			if ( !primed[i] ) {
+				delete cursors[i];
+				cursors[i] = NULL;
+			}
+		});
+	} catch (Entception& e) {
+		for ( size_t i = 0; i < cursors.size(); ++i ) {
+			if ( !cursors[i] )	continue;
+			lock_guard<recursive_mutex> lock(shards_[i]->mutex);
+			delete cursors[i];
+		}
+		throw;
+	}
+
+	return new MergedCursor(*this, cursors, primed);
+}
+
+void ShardedPersistenceApi::beginTransaction() throw(Entception&)
+{
+	// Shards are always locked in order, so transactions on two threads can
+	// not deadlock.
+	size_t i = 0;
+	try {
+		for ( ; i < shards_.size(); ++i ) {
+			shards_[i]->mutex.lock();
+			shards_[i]->api->beginTransaction();
+		}
+	} catch (Entception& e) {
+		shards_[i]->mutex.unlock();
+		while ( i-- > 0 ) {
+			try {
+				shards_[i]->api->rollbackTransaction();
+			} catch (Entception& rollbackFailure) {
+				// The transaction failed to begin, which is what to report.
+			}
+			shards_[i]->mutex.unlock();
+		}
+		throw;
+	}
+
+	if ( depth_++ == 0 )	owner_.store(this_thread::get_id());
+	committed_ = 0;
+}
+
+void ShardedPersistenceApi::commitTransaction() throw(Entception&)
+{
+	if ( !inTransaction() ) {
+		throw Entception("No transaction to commit on this thread");
+	}
+
+	// The shards stay locked if a commit fails, so the shards that are not
+	// committed yet can be rolled back.
+	for ( ; committed_ < shards_.size(); ++committed_ ) {
+		shards_[committed_]->api->commitTransaction();
+	}
+
+	endTransaction();
+}
+
+void ShardedPersistenceApi::rollbackTransaction() throw(Entception&)
+{
+	if ( !inTransaction() ) {
+		throw Entception("No transaction to roll back on this thread");
+	}
+
+	// The transaction is over even if rolling back a shard fails.
+	exception_ptr error;
+	for ( size_t i = committed_; i < shards_.size(); ++i ) {
+		try {
+			shards_[i]->api->rollbackTransaction();
+		} catch (Entception& e) {
+			if ( !error )	error = current_exception();
+		}
+	}
+
+	endTransaction();
+	if ( error )	rethrow_exception(error);
+}
+
+void ShardedPersistenceApi::endTransaction()
+{
+	committed_ = 0;
+	if ( --depth_ == 0 )	owner_.store(thread::id());
+
+	for ( size_t i = shards_.size(); i-- > 0; ) {
+		shards_[i]->mutex.unlock();
+	}
+}
+
+}	// End namespace ent
+}	// End namespace tdk
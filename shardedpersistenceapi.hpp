@@ -0,0 +1,150 @@
+#ifndef SHARDED_PERSISTENCE_API_HPP
+#define SHARDED_PERSISTENCE_API_HPP
+/*! \file	shardedpersistenceapi.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "persistenceapi.hpp"
+#include "primitivevalue.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! Persistence that spreads the rows of every entity type over several other
+ * persistences, the shards, by a hash of their primary key. Every entity type
+ * stored must have a primary key, and the key of a row can not be changed.
+ *
+ * Saves, updates, flushes and deletes go to the shard of the entity's key, as
+ * do loads and cursors whose criteria include the key. Each shard has its own
+ * lock, so threads writing to different shards do so in parallel; with a
+ * database file per shard, on separate disks if need be, writes are no longer
+ * limited to SQLite's single writer. Batches saved with saveAll are split by
+ * shard, and each part saved in parallel, in a transaction on its shard. If
+ * any part fails to save, every part is rolled back, but as with
+ * transactions, committing the parts is not atomic: if a shard fails to
+ * commit its part, the parts committed before it stay saved, and the rest are
+ * rolled back. Which shard each row went to can be found with shardOf.
+ *
+ * Loads and cursors by any other criteria fan out: a cursor is opened on every
+ * shard at once, on a thread per shard, and stepped to its first row. A load
+ * takes the first row of the first shard that has one. A cursor steps through
+ * the rows of each shard in turn, in the order of the shards. Fanning out
+ * needs shards that support cursors, and costs a thread per shard, so loading
+ * by key is much cheaper.
+ *
+ * Transactions are begun on every shard, and hold every shard's lock until
+ * they are committed or rolled back, so can only be used from the thread that
+ * began them. Committing is not atomic across shards: the shards are
+ * committed in turn, and if one fails the transaction is left open on it and
+ * the shards after it, to be rolled back, while those before it stay
+ * committed. While a transaction is open, its thread fans out one shard at a
+ * time.
+ *
+ * The shards are only used by one thread at a time each, so need not be
+ * thread safe, but must not be used other than through this persistence.
+ */
+class ShardedPersistenceApi : public PersistenceApi
+{
+public:
+	/*! Create a persistence over some shards.
+	 * \param	shards	Persistences to spread rows over, which must outlive
+	 *			this one. Rows are placed by the number of shards and their
+	 *			order, so both must stay the same for the life of the data.
+	 * \throws	Entception	If there are no shards.
+	 */
+	explicit ShardedPersistenceApi(const std::vector<PersistenceApi*>& shards) throw(Entception&);
+	virtual ~ShardedPersistenceApi();
+
+	/*! Save an entity to the shard of its key.
+	 * \throws	Entception	If the entity type has no primary key, as for every
+	 *			other method that writes.
+	 */
+	virtual bool save(const Entity& ent) throw(Entception&);
+
+	/*! Save a batch, split by shard. Outside a transaction, the parts are
+	 * saved in parallel and then committed in turn, so the batch is only
+	 * partly saved if a shard fails to commit.
+	 */
+	virtual bool saveAll(const Entity* const* ents, size_t count) throw(Entception&);
+
+	/*! Update an entity on the shard of its key.
+	 * \throws	UpdateEntception	If the updates change the key.
+	 */
+	virtual bool update(const Entity& ent, const AbstractPropertyCollection& updates) throw(Entception&);
+	virtual bool flush(const Entity& ent, PropertyMask dirty) throw(Entception&);
+	virtual bool load(Entity& ent, const AbstractPropertyCollection& criteria) throw(Entception&);
+	virtual bool del(const Entity& ent) throw(Entception&);
+
+	/*! Open a cursor on the shard of the key in the criteria, or else on every
+	 * shard. The cursor must be deleted before this persistence is destroyed.
+	 */
+	virtual PersistenceCursor* openCursor(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	virtual void beginTransaction() throw(Entception&);
+	virtual void commitTransaction() throw(Entception&);
+	virtual void rollbackTransaction() throw(Entception&);
+
+	/*! Get the number of shards. */
+	size_t shards() const { return shards_.size(); }
+
+	/*! Get the index of the shard the row with a primary key value is in.
+	 * Keys are hashed by value, so an int key and an int64_t key with the
+	 * same number are in the same shard, and the hash is the same on every
+	 * platform.
+	 */
+	size_t shardOf(const PrimitiveValue& key) const;
+
+private:
+	struct Shard {
+		Shard(PersistenceApi* p) : api(p) {}
+		PersistenceApi* api;
+		std::recursive_mutex mutex;	// Held for each call, and for the whole of a transaction.
+	};
+
+	class MergedCursor;
+	friend class MergedCursor;
+
+	/*! Get the index of the shard of an entity's key.
+	 * \throws	Entception	If the entity type has no primary key.
+	 */
+	size_t shardOf(const Entity& ent) const throw(Entception&);
+
+	/*! Get the index of the shard of the key in some criteria.
+	 * \retval	-1	The criteria do not include the key.
+	 */
+	int shardOf(const Entity& shape, const AbstractPropertyCollection& criteria) const;
+
+	/*! Open a cursor on every shard, in parallel unless the calling thread
+	 * has a transaction open, and step each to its first row.
+	 */
+	MergedCursor* fanOut(const Entity& shape, const AbstractPropertyCollection& criteria) throw(Entception&);
+
+	/*! Whether or not the calling thread has a transaction open. */
+	bool inTransaction() const { return owner_.load() == std::this_thread::get_id(); }
+
+	/*! End the innermost transaction, after it has been committed or rolled
+	 * back on every shard.
+	 */
+	void endTransaction();
+
+	ShardedPersistenceApi(const ShardedPersistenceApi&);
+	ShardedPersistenceApi& operator = (const ShardedPersistenceApi&);
+
+	std::vector<Shard*> shards_;
+	std::atomic<std::thread::id> owner_;	// Thread with a transaction open, if any.
+	unsigned int depth_;	// Transactions open on owner_.
+	size_t committed_;		// Shards the innermost transaction has been committed on.
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif
@@ -0,0 +1,136 @@
+/*! \file	transaction.cpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include "transaction.hpp"
+
+namespace tdk {
+namespace ent {
+
+Transaction::Transaction(EntityFactory& factory) throw(Entception&)
+	: persistence_(factory.persistenceApi()), parent_(NULL), openChildren_(0), active_(false)
+{
+	persistence_.beginTransaction();
+	active_ = true;
+}
+
+Transaction::Transaction(Transaction& parent) throw(Entception&)
+	: persistence_(parent.persistence_), parent_(&parent), openChildren_(0), active_(false)
+{
+	if ( !parent.active_ ) {
+		throw Entception("Can not nest a transaction in an inactive transaction");
+	}
+
+	persistence_.beginTransaction();
+	active_ = true;
+	++parent_->openChildren_;
+}
+
+Transaction::~Transaction()
+{
+	if ( !active_ )	return;
+
+	// Destructors must not throw, and there is nobody to report the failure to.
+	try {
+		rollback();
+	} catch (Entception&) {
+	}
+}
+
+void Transaction::queue(Operation op, Entity& e, const AbstractPropertyCollection* updates)
+{
+	Change c;
+	c.op = op;
+	c.ent = &e;
+	c.updates = updates;
+	changes_.push_back(c);
+}
+
+bool Transaction::write(const Change& c) throw(Entception&)
+{
+	PersistenceApi* p = c.ent->persistence_;
+	if ( !p ) {
+		if ( c.op == SAVE )	throw SaveEntception(c.ent, "No persistence installed");
+		return false;
+	}
+
+	switch ( c.op ) {
+	case SAVE:
+		return p->save(*c.ent);
+	case UPDATE:
+		return p->update(*c.ent, *c.updates);
+	case FLUSH: {
+		PropertyMask dirty = c.ent->dirtyProperties();
+		return dirty && p->flush(*c.ent, dirty);
+	}
+	case DEL:
+		return p->del(*c.ent);
+	}
+	return false;
+}
+
+void Transaction::commit() throw(Entception&)
+{
+	if ( !active_ ) {
+		throw Entception("Transaction is not active");
+	}
+	if ( openChildren_ > 0 ) {
+		throw Entception("Can not commit a transaction with nested transactions open");
+	}
+
+	try {
+		for ( size_t i = 0; i < changes_.size(); ++i ) {
+			const Change& c = changes_[i];
+			if ( write(c) && (c.op == SAVE || c.op == FLUSH) ) {
+				written_.push_back(c.ent);
+			}
+		}
+		persistence_.commitTransaction();
+	} catch (Entception& e) {
+		try {
+			rollback();
+		} catch (Entception&) {
+		}
+		THROW_AGAIN(e, "Transaction rolled back.");
+	}
+
+	// A nested transaction's changes are only stored once its parent is
+	// committed too.
+	if ( parent_ ) {
+		parent_->written_.insert(parent_->written_.end(), written_.begin(), written_.end());
+	} else {
+		for ( size_t i = 0; i < written_.size(); ++i ) {
+			written_[i]->clearDirty();
+		}
+	}
+
+	finish();
+}
+
+void Transaction::rollback() throw(Entception&)
+{
+	if ( !active_ ) {
+		throw Entception("Transaction is not active");
+	}
+	if ( openChildren_ > 0 ) {
+		throw Entception("Can not roll back a transaction with nested transactions open");
+	}
+
+	// The transaction is over whether or not the persistence manages it.
+	finish();
+	persistence_.rollbackTransaction();
+}
+
+void Transaction::finish()
+{
+	active_ = false;
+	changes_.clear();
+	written_.clear();
+	if ( parent_ ) {
+		--parent_->openChildren_;
+	}
+}
+
+}	// End namespace ent
+}	// End namespace tdk
@@ -0,0 +1,136 @@
+#ifndef TRANSACTION_HPP
+#define TRANSACTION_HPP
+/*! \file	transaction.hpp
+ *
+ * \copyright	Copyright 2012. See COPYING for details.
+ */
+
+#include <deque>
+#include <vector>
+
+#include "entity.hpp"
+#include "entityfactory.hpp"
+
+namespace tdk {
+namespace ent {
+
+/*! A transaction is a unit of work performed on the persistence of an entity
+ * factory. Changes are queued on the transaction and only written when it is
+ * committed, all within a single persistence transaction. Anything done
+ * directly through the factory's entities while the transaction is open is
+ * also part of it.
+ *
+ * The transaction is rolled back if it is destroyed without being committed,
+ * so an exception leaving the scope of a transaction undoes all of its work.
+ *
+ * ~~~{.cpp}
+ * Transaction tx(factory);
+ * tx.save(*person);
+ * tx.del(*oldPerson);
+ * tx.commit();
+ * ~~~
+ *
+ * Transactions may be nested by constructing a transaction from another. The
+ * nested transaction is a savepoint, which can be rolled back without
+ * affecting the rest of the outer transaction.
+ */
+class Transaction
+{
+public:
+	/*! Begin a transaction on the persistence of an entity factory.
+	 * \throws	Entception	If the persistence could not begin a transaction.
+	 */
+	Transaction(EntityFactory& factory) throw(Entception&);
+
+	/*! Begin a transaction nested inside another. The parent transaction can
+	 * not be committed until this transaction has been committed or rolled
+	 * back.
+	 */
+	Transaction(Transaction& parent) throw(Entception&);
+
+	/*! Roll back the transaction, unless it has been committed. */
+	~Transaction();
+
+	/*! Queue an entity to be saved when the transaction is committed. */
+	void save(Entity& e) { queue(SAVE, e, NULL); }
+
+	/*! Queue an entity to be updated when the transaction is committed.
+	 * \param	updates	Collection of properties to update the entity with. This
+	 *			must remain valid until the transaction is committed.
+	 */
+	void update(Entity& e, const AbstractPropertyCollection& updates) { queue(UPDATE, e, &updates); }
+
+	/*! Queue an entity to have its modified properties written when the
+	 * transaction is committed. The properties modified by then are written.
+	 */
+	void flush(Entity& e) { queue(FLUSH, e, NULL); }
+
+	/*! Queue an entity to be deleted when the transaction is committed. */
+	void del(Entity& e) { queue(DEL, e, NULL); }
+
+	/*! Write all the queued changes, in the order they were queued, and
+	 * commit them.
+	 *
+	 * Entities hold no metadata about how they relate to each other, so the
+	 * changes can not be put in to dependency order here. Callers must queue
+	 * them in an order the persistence accepts: an entity that others refer
+	 * to must be saved before them and deleted after them, and a row must be
+	 * deleted before another with the same key is saved.
+	 *
+	 * The properties of the saved and flushed entities are only marked as
+	 * matching persistent storage once the changes are committed, or for a
+	 * nested transaction, once the outermost transaction is committed. If
+	 * the transaction is rolled back, they stay modified, and can be written
+	 * again.
+	 *
+	 * \throws	Entception	If any change could not be written, or the commit
+	 *			failed. The whole transaction is rolled back.
+	 */
+	void commit() throw(Entception&);
+
+	/*! Discard all the queued changes and roll back the transaction. */
+	void rollback() throw(Entception&);
+
+	/*! Whether or not the transaction can still be committed or rolled back. */
+	bool active() const { return active_; }
+
+private:
+	typedef enum {
+		SAVE,
+		UPDATE,
+		FLUSH,
+		DEL,
+	} Operation;
+
+	struct Change {
+		Operation op;
+		Entity* ent;
+		const AbstractPropertyCollection* updates;
+	};
+
+	void queue(Operation op, Entity& e, const AbstractPropertyCollection* updates);
+
+	/*! Write a queued change, without marking the entity's properties as
+	 * matching persistent storage.
+	 * \return	Whether or not the change was written.
+	 */
+	bool write(const Change& c) throw(Entception&);
+
+	// End the transaction, in the persistence and with the parent.
+	void finish();
+
+	Transaction(const Transaction&);
+	Transaction& operator = (const Transaction&);
+
+	PersistenceApi& persistence_;
+	Transaction* parent_;
+	unsigned int openChildren_;
+	bool active_;
+	std::deque<Change> changes_;
+	std::vector<Entity*> written_;	// Entities to mark clean once committed.
+};
+
+}	// End namespace ent
+}	// End namespace tdk
+
+#endif